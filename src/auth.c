@@ -1,3 +1,6 @@
+#include <pthread.h>
+#include <string.h>
+
 #include "auth.h"
 #include "constants.h"
 #include "random.h"
@@ -30,16 +33,58 @@ const unsigned char prime_order_bytes_dup[ED448_SCALAR_BYTES] = {
     0x23, 0x78, 0xc2, 0x92, 0xab, 0x58, 0x44, 0xf3,
 };
 
-otr4_err_t snizkpk_authenticate(snizkpk_proof_t *dst,
-                                const snizkpk_keypair_t *pair1,
-                                const snizkpk_pubkey_t A2,
-                                const snizkpk_pubkey_t A3,
-                                const unsigned char *msg, size_t msglen) {
+/* Every challenge starts with the domain, base point and group order, so that
+ * prefix is absorbed once and the sponge state copied for each proof. */
+static decaf_shake256_ctx_t challenge_prefix;
+static pthread_once_t challenge_prefix_once = PTHREAD_ONCE_INIT;
 
+static void challenge_prefix_init(void) {
+  hash_init_with_dom(challenge_prefix);
+  hash_update(challenge_prefix, base_point_bytes_dup, ED448_POINT_BYTES);
+  hash_update(challenge_prefix, prime_order_bytes_dup, ED448_SCALAR_BYTES);
+}
+
+static void hash_point(decaf_shake256_ctx_t hd, const snizkpk_pubkey_t p) {
+  unsigned char point_buff[ED448_POINT_BYTES];
+
+  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, p);
+  hash_update(hd, point_buff, ED448_POINT_BYTES);
+}
+
+/* c = HashToScalar(G || q || A1 || A2 || A3 || T1 || T2 || T3 || msg) */
+static void challenge(snizkpk_privkey_t c, const snizkpk_pubkey_t A1,
+                      const snizkpk_pubkey_t A2, const snizkpk_pubkey_t A3,
+                      const snizkpk_pubkey_t T1, const snizkpk_pubkey_t T2,
+                      const snizkpk_pubkey_t T3,
+                      const snizkpk_msg_part_t *parts, size_t count) {
   decaf_shake256_ctx_t hd;
   uint8_t hash[HASH_BYTES];
-  unsigned char point_buff[ED448_POINT_BYTES];
 
+  pthread_once(&challenge_prefix_once, challenge_prefix_init);
+  memcpy(hd, challenge_prefix, sizeof(decaf_shake256_ctx_t));
+
+  hash_point(hd, A1);
+  hash_point(hd, A2);
+  hash_point(hd, A3);
+  hash_point(hd, T1);
+  hash_point(hd, T2);
+  hash_point(hd, T3);
+
+  for (size_t i = 0; i < count; i++)
+    hash_update(hd, parts[i].data, parts[i].len);
+
+  hash_final(hd, hash, sizeof(hash));
+  hash_destroy(hd);
+
+  decaf_448_scalar_decode_long(c, hash, ED448_SCALAR_BYTES);
+}
+
+otr4_err_t snizkpk_authenticate_parts(snizkpk_proof_t *dst,
+                                      const snizkpk_keypair_t *pair1,
+                                      const snizkpk_pubkey_t A2,
+                                      const snizkpk_pubkey_t A3,
+                                      const snizkpk_msg_part_t *parts,
+                                      size_t count) {
   snizkpk_privkey_t t1;
   snizkpk_pubkey_t T1, T2, T3, A2c2, A3c3;
 
@@ -55,35 +100,8 @@ otr4_err_t snizkpk_authenticate(snizkpk_proof_t *dst,
   decaf_448_point_scalarmul(A3c3, A3, dst->c3);
   decaf_448_point_add(T3, T3, A3c3);
 
-  hash_init_with_dom(hd);
-  hash_update(hd, base_point_bytes_dup, ED448_POINT_BYTES);
-  hash_update(hd, prime_order_bytes_dup, ED448_SCALAR_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, pair1->pub);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A2);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A3);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, T1);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, T2);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, T3);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  hash_update(hd, msg, msglen);
-
-  hash_final(hd, hash, sizeof(hash));
-  hash_destroy(hd);
-
   snizkpk_privkey_t c, c1a1;
-  decaf_448_scalar_decode_long(c, hash, ED448_SCALAR_BYTES);
+  challenge(c, pair1->pub, A2, A3, T1, T2, T3, parts, count);
 
   decaf_448_scalar_sub(dst->c1, c, dst->c2);
   decaf_448_scalar_sub(dst->c1, dst->c1, dst->c3);
@@ -94,58 +112,30 @@ otr4_err_t snizkpk_authenticate(snizkpk_proof_t *dst,
   return OTR4_SUCCESS;
 }
 
-otr4_err_t snizkpk_verify(const snizkpk_proof_t *src, const snizkpk_pubkey_t A1,
-                          const snizkpk_pubkey_t A2, const snizkpk_pubkey_t A3,
-                          const unsigned char *msg, size_t msglen) {
-
-  decaf_shake256_ctx_t hd;
-  uint8_t hash[HASH_BYTES];
-  unsigned char point_buff[ED448_POINT_BYTES];
-
-  hash_init_with_dom(hd);
-
-  snizkpk_pubkey_t gr1, gr2, gr3, A1c1, A2c2, A3c3;
-
-  decaf_448_point_scalarmul(gr1, decaf_448_point_base, src->r1);
-  decaf_448_point_scalarmul(gr2, decaf_448_point_base, src->r2);
-  decaf_448_point_scalarmul(gr3, decaf_448_point_base, src->r3);
-
-  decaf_448_point_scalarmul(A1c1, A1, src->c1);
-  decaf_448_point_scalarmul(A2c2, A2, src->c2);
-  decaf_448_point_scalarmul(A3c3, A3, src->c3);
-
-  decaf_448_point_add(A1c1, A1c1, gr1);
-  decaf_448_point_add(A2c2, A2c2, gr2);
-  decaf_448_point_add(A3c3, A3c3, gr3);
-
-  hash_update(hd, base_point_bytes_dup, ED448_POINT_BYTES);
-  hash_update(hd, prime_order_bytes_dup, ED448_SCALAR_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A1);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A2);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A3);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A1c1);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A2c2);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  decaf_448_point_mul_by_cofactor_and_encode_like_eddsa(point_buff, A3c3);
-  hash_update(hd, point_buff, ED448_POINT_BYTES);
-
-  hash_update(hd, msg, msglen);
+otr4_err_t snizkpk_authenticate(snizkpk_proof_t *dst,
+                                const snizkpk_keypair_t *pair1,
+                                const snizkpk_pubkey_t A2,
+                                const snizkpk_pubkey_t A3,
+                                const unsigned char *msg, size_t msglen) {
+  snizkpk_msg_part_t part = {msg, msglen};
+  return snizkpk_authenticate_parts(dst, pair1, A2, A3, &part, 1);
+}
 
-  hash_final(hd, hash, sizeof(hash));
-  hash_destroy(hd);
+otr4_err_t snizkpk_verify_parts(const snizkpk_proof_t *src,
+                                const snizkpk_pubkey_t A1,
+                                const snizkpk_pubkey_t A2,
+                                const snizkpk_pubkey_t A3,
+                                const snizkpk_msg_part_t *parts,
+                                size_t count) {
+  /* The proof is public, so the non constant-time double scalar
+   * multiplication (r * G + c * A) can be used. */
+  snizkpk_pubkey_t A1c1, A2c2, A3c3;
+  decaf_448_base_double_scalarmul_non_secret(A1c1, src->r1, A1, src->c1);
+  decaf_448_base_double_scalarmul_non_secret(A2c2, src->r2, A2, src->c2);
+  decaf_448_base_double_scalarmul_non_secret(A3c3, src->r3, A3, src->c3);
 
   snizkpk_privkey_t c, c1c2c3;
-  decaf_448_scalar_decode_long(c, hash, ED448_SCALAR_BYTES);
+  challenge(c, A1, A2, A3, A1c1, A2c2, A3c3, parts, count);
 
   decaf_448_scalar_add(c1c2c3, src->c1, src->c2);
   decaf_448_scalar_add(c1c2c3, c1c2c3, src->c3);
@@ -157,6 +147,32 @@ otr4_err_t snizkpk_verify(const snizkpk_proof_t *src, const snizkpk_pubkey_t A1,
   return OTR4_ERROR;
 }
 
+otr4_err_t snizkpk_verify(const snizkpk_proof_t *src, const snizkpk_pubkey_t A1,
+                          const snizkpk_pubkey_t A2, const snizkpk_pubkey_t A3,
+                          const unsigned char *msg, size_t msglen) {
+  snizkpk_msg_part_t part = {msg, msglen};
+  return snizkpk_verify_parts(src, A1, A2, A3, &part, 1);
+}
+
+otr4_err_t snizkpk_verify_batch(bool *valid,
+                               const snizkpk_verify_entry_t *entries,
+                               size_t count) {
+  otr4_err_t err = OTR4_SUCCESS;
+
+  for (size_t i = 0; i < count; i++) {
+    const snizkpk_verify_entry_t *e = &entries[i];
+    otr4_err_t entry_err = snizkpk_verify(e->proof, *e->A1, *e->A2, *e->A3,
+                                          e->msg, e->msglen);
+    if (valid)
+      valid[i] = entry_err == OTR4_SUCCESS;
+
+    if (entry_err)
+      err = OTR4_ERROR;
+  }
+
+  return err;
+}
+
 void snizkpk_proof_destroy(snizkpk_proof_t *src) {
   ec_scalar_destroy(src->c1);
   ec_scalar_destroy(src->r1);
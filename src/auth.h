@@ -1,6 +1,7 @@
 #ifndef AUTH_H
 #define AUTH_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "ed448.h"
@@ -33,6 +34,45 @@ otr4_err_t snizkpk_verify(const snizkpk_proof_t *src, const snizkpk_pubkey_t A1,
                           const snizkpk_pubkey_t A2, const snizkpk_pubkey_t A3,
                           const unsigned char *msg, size_t msglen);
 
+/* The message is hashed part by part, as if the parts were concatenated, so
+ * callers need not copy them into one buffer. */
+typedef struct {
+  const unsigned char *data;
+  size_t len;
+} snizkpk_msg_part_t;
+
+otr4_err_t snizkpk_authenticate_parts(snizkpk_proof_t *dst,
+                                      const snizkpk_keypair_t *pair1,
+                                      const snizkpk_pubkey_t A2,
+                                      const snizkpk_pubkey_t A3,
+                                      const snizkpk_msg_part_t *parts,
+                                      size_t count);
+
+otr4_err_t snizkpk_verify_parts(const snizkpk_proof_t *src,
+                                const snizkpk_pubkey_t A1,
+                                const snizkpk_pubkey_t A2,
+                                const snizkpk_pubkey_t A3,
+                                const snizkpk_msg_part_t *parts,
+                                size_t count);
+
+typedef struct {
+  const snizkpk_proof_t *proof;
+  const snizkpk_pubkey_t *A1, *A2, *A3;
+  const unsigned char *msg;
+  size_t msglen;
+} snizkpk_verify_entry_t;
+
+/* Verifies every entry and returns OTR4_SUCCESS only if all of them are
+ * valid. If valid is not NULL, it receives the result for each entry.
+ *
+ * The proofs carry (c, r) rather than the commitments T, and T must be
+ * recomputed exactly to rebuild the challenge. A random linear combination of
+ * the verification equations can not replace that, so each entry is checked
+ * on its own with double scalar multiplications. */
+otr4_err_t snizkpk_verify_batch(bool *valid,
+                               const snizkpk_verify_entry_t *entries,
+                               size_t count);
+
 void generate_keypair(snizkpk_pubkey_t pub, snizkpk_privkey_t priv);
 
 void snizkpk_proof_destroy(snizkpk_proof_t *src);
@@ -57,6 +57,7 @@ VERSION HISTORY:
 
 /* system headers */
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 
 /* libotr headers */
@@ -92,6 +93,273 @@ static void encodeblock(char *out, const unsigned char *in, size_t len) {
   out[3] = len > 2 ? cb64[in2 & 0x3f] : '=';
 }
 
+/*
+** SIMD kernels
+**
+** Whole 3-byte blocks are encoded, and whole 4-character blocks of valid
+** characters are decoded, 12 or 24 bytes at a time. Short blocks, '=',
+** and characters to skip are always left to the byte-at-a-time code, so
+** the result is the same as without them. The reshuffling and lookups
+** follow Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding and
+** Decoding Using AVX2 Instructions".
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OTRL_B64_X86
+#include <immintrin.h>
+#endif
+
+static int b64_kernel = -1;
+
+static otrl_b64_kernel_t b64_supported_kernel(void) {
+#ifdef OTRL_B64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return OTRL_B64_AVX2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return OTRL_B64_SSE41;
+#endif
+  return OTRL_B64_SCALAR;
+}
+
+otrl_b64_kernel_t otrl_base64_kernel(void) {
+  if (b64_kernel < 0)
+    b64_kernel = b64_supported_kernel();
+
+  return b64_kernel;
+}
+
+otrl_b64_kernel_t otrl_base64_set_kernel(otrl_b64_kernel_t kernel) {
+  otrl_b64_kernel_t supported = b64_supported_kernel();
+  b64_kernel = kernel < supported ? kernel : supported;
+
+  return b64_kernel;
+}
+
+#ifdef OTRL_B64_X86
+
+/* Spreads 12 bytes over 16 6-bit indexes, one per byte */
+__attribute__((target("sse4.1"))) static inline __m128i
+sse41_unpack(__m128i in) {
+  in = _mm_shuffle_epi8(
+      in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+/* Maps 6-bit indexes to cb64 */
+__attribute__((target("sse4.1"))) static inline __m128i
+sse41_translate(__m128i indexes) {
+  __m128i offsets = _mm_subs_epu8(indexes, _mm_set1_epi8(51));
+  __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indexes);
+  offsets = _mm_or_si128(offsets, _mm_and_si128(less, _mm_set1_epi8(13)));
+  __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(shift, offsets), indexes);
+}
+
+/* Returns the number of bytes encoded; a multiple of 12. Reads 16 bytes
+ * for every 12 it encodes, and loads each block before storing its
+ * output, so otrl_base64_otr_encode_into can still encode in place. */
+__attribute__((target("sse4.1"))) static size_t
+sse41_encode(char *out, const unsigned char *in, size_t len) {
+  size_t done = 0;
+
+  while (len - done >= 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(in + done));
+    block = sse41_translate(sse41_unpack(block));
+    _mm_storeu_si128((__m128i *)out, block);
+    out += 16;
+    done += 12;
+  }
+
+  return done;
+}
+
+/* Maps cb64 characters to 6-bit indexes, or returns 0 if any of the 16
+ * is not one of them */
+__attribute__((target("sse4.1"))) static inline int
+sse41_lookup(__m128i *indexes, __m128i in) {
+  const __m128i lut_lo =
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi =
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  __m128i hi_nibbles =
+      _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+  __m128i lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+  __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+  __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  if (!_mm_testz_si128(lo, hi))
+    return 0;
+
+  __m128i slashes = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+  __m128i roll =
+      _mm_shuffle_epi8(lut_roll, _mm_add_epi8(slashes, hi_nibbles));
+  *indexes = _mm_add_epi8(in, roll);
+  return 1;
+}
+
+/* Packs 16 6-bit indexes into 12 bytes, at the bottom */
+__attribute__((target("sse4.1"))) static inline __m128i
+sse41_pack(__m128i indexes) {
+  __m128i pairs = _mm_maddubs_epi16(indexes, _mm_set1_epi32(0x01400140));
+  __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(quads, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                               13, 12, -1, -1, -1, -1));
+}
+
+/* Returns the number of characters decoded; a multiple of 16. Stops at
+ * the first block with anything but cb64 characters in it. */
+__attribute__((target("sse4.1"))) static size_t
+sse41_decode(unsigned char *out, const char *in, size_t len) {
+  size_t done = 0;
+
+  while (len - done >= 16) {
+    __m128i indexes;
+    __m128i block = _mm_loadu_si128((const __m128i *)(in + done));
+    if (!sse41_lookup(&indexes, block))
+      break;
+
+    block = sse41_pack(indexes);
+    _mm_storel_epi64((__m128i *)out, block);
+    uint32_t last = _mm_extract_epi32(block, 2);
+    memcpy(out + 8, &last, sizeof last);
+    out += 12;
+    done += 16;
+  }
+
+  return done;
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2_encode(char *out, const unsigned char *in, size_t len) {
+  const __m256i spread = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5,
+      4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i shift = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t done = 0;
+
+  /* Reads 28 bytes for every 24 it encodes */
+  while (len - done >= 28) {
+    __m256i block = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *)(in + done))),
+        _mm_loadu_si128((const __m128i *)(in + done + 12)), 1);
+
+    block = _mm256_shuffle_epi8(block, spread);
+    __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    __m256i indexes = _mm256_or_si256(t1, t3);
+
+    __m256i offsets = _mm256_subs_epu8(indexes, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indexes);
+    offsets =
+        _mm256_or_si256(offsets, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    block = _mm256_add_epi8(_mm256_shuffle_epi8(shift, offsets), indexes);
+
+    _mm256_storeu_si256((__m256i *)out, block);
+    out += 32;
+    done += 24;
+  }
+
+  return done + sse41_encode(out, in + done, len - done);
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2_decode(unsigned char *out, const char *in, size_t len) {
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+      0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll =
+      _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0,
+                       0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+                       0, 0);
+  const __m256i gather = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+      4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t done = 0;
+
+  while (len - done >= 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(in + done));
+
+    __m256i hi_nibbles =
+        _mm256_and_si256(_mm256_srli_epi32(block, 4), _mm256_set1_epi8(0x0f));
+    __m256i lo_nibbles = _mm256_and_si256(block, _mm256_set1_epi8(0x0f));
+    __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+      break;
+
+    __m256i slashes = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('/'));
+    __m256i roll =
+        _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(slashes, hi_nibbles));
+    __m256i indexes = _mm256_add_epi8(block, roll);
+
+    __m256i pairs =
+        _mm256_maddubs_epi16(indexes, _mm256_set1_epi32(0x01400140));
+    __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    block = _mm256_shuffle_epi8(quads, gather);
+    block = _mm256_permutevar8x32_epi32(
+        block, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+    _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(block));
+    _mm_storel_epi64((__m128i *)(out + 16), _mm256_extracti128_si256(block, 1));
+    out += 24;
+    done += 32;
+  }
+
+  return done + sse41_decode(out, in + done, len - done);
+}
+
+#endif
+
+static size_t encode_blocks(char *out, const unsigned char *in, size_t len) {
+  switch (otrl_base64_kernel()) {
+#ifdef OTRL_B64_X86
+  case OTRL_B64_AVX2:
+    return avx2_encode(out, in, len);
+  case OTRL_B64_SSE41:
+    return sse41_encode(out, in, len);
+#endif
+  default:
+    return 0;
+  }
+}
+
+static size_t decode_blocks(unsigned char *out, const char *in, size_t len) {
+  switch (otrl_base64_kernel()) {
+#ifdef OTRL_B64_X86
+  case OTRL_B64_AVX2:
+    return avx2_decode(out, in, len);
+  case OTRL_B64_SSE41:
+    return sse41_decode(out, in, len);
+#endif
+  default:
+    return 0;
+  }
+}
+
 /*
  * base64 encode data.  Insert no linebreaks or whitespace.
  *
@@ -101,6 +369,12 @@ static void encodeblock(char *out, const unsigned char *in, size_t len) {
 size_t otrl_base64_encode(char *base64data, const unsigned char *data,
                           size_t datalen) {
   size_t base64len = 0;
+  size_t done = encode_blocks(base64data, data, datalen);
+
+  base64data += done / 3 * 4;
+  base64len += done / 3 * 4;
+  data += done;
+  datalen -= done;
 
   while (datalen > 2) {
     encodeblock(base64data, data, 3);
@@ -156,6 +430,16 @@ size_t otrl_base64_decode(unsigned char *data, const char *base64data,
   size_t b64accum = 0;
 
   while (base64len > 0) {
+    if (b64accum == 0) {
+      size_t done = decode_blocks(data, base64data, base64len);
+      data += done / 4 * 3;
+      datalen += done / 4 * 3;
+      base64data += done;
+      base64len -= done;
+      if (base64len == 0)
+        break;
+    }
+
     char b = *base64data;
     unsigned char bdecode;
     ++base64data;
@@ -193,7 +477,6 @@ size_t otrl_base64_decode(unsigned char *data, const char *base64data,
  */
 char *otrl_base64_otr_encode(const unsigned char *buf, size_t buflen) {
   char *base64buf;
-  size_t base64len;
   const size_t HALF_MAX_SIZE_T = ((size_t)-1) >> 1;
 
   if (buflen > HALF_MAX_SIZE_T) {
@@ -205,18 +488,32 @@ char *otrl_base64_otr_encode(const unsigned char *buf, size_t buflen) {
     return NULL;
   }
 
-  /* Make the base64-encoding. */
-  base64len = ((buflen + 2) / 3) * 4;
-  base64buf = malloc(5 + base64len + 1 + 1);
+  base64buf = malloc(OTRL_B64_OTR_ENCODED_SIZE(buflen));
   if (base64buf == NULL) {
     return NULL;
   }
+  otrl_base64_otr_encode_into(base64buf, buf, buflen);
+
+  return base64buf;
+}
+
+/*
+ * Like otrl_base64_otr_encode, but write into base64buf, which must
+ * contain at least OTRL_B64_OTR_ENCODED_SIZE(buflen) bytes of space.
+ * buf may be the last buflen of those bytes, in which case it is encoded
+ * in place: the output of each block lands behind the input still to be
+ * read.
+ */
+size_t otrl_base64_otr_encode_into(char *base64buf, const unsigned char *buf,
+                                   size_t buflen) {
+  size_t base64len = ((buflen + 2) / 3) * 4;
+
   memmove(base64buf, "?OTR:", 5);
   otrl_base64_encode(base64buf + 5, buf, buflen);
   base64buf[5 + base64len] = '.';
   base64buf[5 + base64len + 1] = '\0';
 
-  return base64buf;
+  return 5 + base64len + 1;
 }
 
 /*
@@ -34,6 +34,25 @@
   (((encoded_len + OTRL_B64_ENCODED_LEN - 1) / OTRL_B64_ENCODED_LEN) *         \
    OTRL_B64_DECODED_LEN)
 
+/* otrl_base64_otr_encode of buflen bytes needs this many bytes, including
+ * the "?OTR:" and "." around the encoding and the terminating NUL: */
+#define OTRL_B64_OTR_ENCODED_SIZE(buflen)                                      \
+  (5 + (((buflen) + 2) / 3) * OTRL_B64_ENCODED_LEN + 1 + 1)
+
+/* Kernels otrl_base64_encode and otrl_base64_decode can use. They give
+ * the same results, the default being the fastest the CPU supports. */
+typedef enum {
+  OTRL_B64_SCALAR,
+  OTRL_B64_SSE41,
+  OTRL_B64_AVX2,
+} otrl_b64_kernel_t;
+
+otrl_b64_kernel_t otrl_base64_kernel(void);
+
+/* Use kernel, or the fastest supported one below it. Returns the kernel
+ * in use. Meant for tests and benchmarks. */
+otrl_b64_kernel_t otrl_base64_set_kernel(otrl_b64_kernel_t kernel);
+
 /*
  * base64 encode data.  Insert no linebreaks or whitespace.
  *
@@ -60,6 +79,15 @@ size_t otrl_base64_decode(unsigned char *data, const char *base64data,
  */
 char *otrl_base64_otr_encode(const unsigned char *buf, size_t buflen);
 
+/*
+ * Like otrl_base64_otr_encode, but write into base64buf, which must
+ * contain at least OTRL_B64_OTR_ENCODED_SIZE(buflen) bytes of space.
+ * buf may be the last buflen of those bytes, in which case it is encoded
+ * in place.  Return the length of the result, excluding the NUL.
+ */
+size_t otrl_base64_otr_encode_into(char *base64buf, const unsigned char *buf,
+                                   size_t buflen);
+
 /*
  * Base64-decode the portion of the given message between "?OTR:" and
  * ".".  Set *bufp to the decoded data, and set *lenp to its length.
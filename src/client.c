@@ -2,6 +2,8 @@
 
 #include <libotr/privkey.h>
 
+#include "b64.h"
+#include "constants.h"
 #include "deserialize.h"
 #include "instance_tag.h"
 #include "serialize.h"
@@ -10,6 +12,7 @@
 #define CONV(c) ((otr4_conversation_t *)c)
 
 static otr4_conversation_t *new_conversation_with(const char *recipient,
+                                                  uint32_t their_instance_tag,
                                                   otrv4_t *conn) {
   otr4_conversation_t *conv = malloc(sizeof(otr4_conversation_t));
   if (!conv) {
@@ -18,6 +21,7 @@ static otr4_conversation_t *new_conversation_with(const char *recipient,
   }
 
   conv->recipient = otrv4_strdup(recipient);
+  conv->their_instance_tag = their_instance_tag;
   conv->conn = conn;
 
   return conv;
@@ -35,13 +39,35 @@ static void conversation_free(void *data) {
   free(conv);
 }
 
+static size_t conversation_hash(const void *key) {
+  const otr4_conversation_t *conv = key;
+  size_t hash = hashmap_hash_bytes(HASHMAP_HASH_INIT, conv->recipient,
+                                   strlen(conv->recipient));
+  return hashmap_hash_bytes(hash, &conv->their_instance_tag,
+                            sizeof(conv->their_instance_tag));
+}
+
+static int conversation_eq(const void *a, const void *b) {
+  const otr4_conversation_t *conv_a = a, *conv_b = b;
+  return conv_a->their_instance_tag == conv_b->their_instance_tag &&
+         !strcmp(conv_a->recipient, conv_b->recipient);
+}
+
 otr4_client_t *otr4_client_new(otr4_client_state_t *state) {
   otr4_client_t *client = malloc(sizeof(otr4_client_t));
   if (!client)
     return NULL;
 
+  client->conversation_index =
+      hashmap_new(conversation_hash, conversation_eq);
+  if (!client->conversation_index) {
+    free(client);
+    return NULL;
+  }
+
   client->state = state;
-  client->conversations = NULL;
+  list_init(client->conversations);
+  pthread_mutex_init(&client->lock, NULL);
 
   return client;
 }
@@ -52,26 +78,44 @@ void otr4_client_free(otr4_client_t *client) {
 
   client->state = NULL;
 
-  list_free(client->conversations, conversation_free);
-  client->conversations = NULL;
+  hashmap_free(client->conversation_index);
+  client->conversation_index = NULL;
 
+  list_clear(client->conversations, conversation_free);
+
+  pthread_mutex_destroy(&client->lock);
   free(client);
 }
 
-// TODO: There may be multiple conversations with the same recipient if they
-// uses multiple instance tags. We are not allowing this yet.
-otr4_conversation_t *get_conversation_with(const char *recipient,
-                                           list_element_t *conversations) {
-  const list_element_t *el = NULL;
-  otr4_conversation_t *conv = NULL;
+/* Must be called with the client locked */
+static otr4_conversation_t *
+find_conversation_with(const char *recipient, uint32_t their_instance_tag,
+                       const otr4_client_t *client) {
+  otr4_conversation_t wanted = {
+      .recipient = (char *)recipient, .their_instance_tag = their_instance_tag,
+  };
 
-  for (el = conversations; el; el = el->next) {
-    conv = CONV(el->data);
-    if (!strcmp(conv->recipient, recipient))
-      return conv;
-  }
+  return hashmap_get(client->conversation_index, &wanted);
+}
 
-  return NULL;
+static otr4_conversation_t *
+get_instance_conversation_with(const char *recipient,
+                               uint32_t their_instance_tag,
+                               otr4_client_t *client) {
+  pthread_mutex_lock(&client->lock);
+  otr4_conversation_t *conv =
+      find_conversation_with(recipient, their_instance_tag, client);
+  pthread_mutex_unlock(&client->lock);
+
+  return conv;
+}
+
+/* The conversation with any of the recipient's instances. It is bound to
+ * the first instance that starts a DAKE with it, and other instances get
+ * their own conversations. */
+otr4_conversation_t *get_conversation_with(const char *recipient,
+                                           otr4_client_t *client) {
+  return get_instance_conversation_with(recipient, 0, client);
 }
 
 otrv4_policy_t get_policy_for(const char *recipient) {
@@ -137,12 +181,15 @@ static otrv4_t *create_connection_for(const char *recipient,
   return conn;
 }
 
-otr4_conversation_t *get_or_create_conversation_with(const char *recipient,
-                                                     otr4_client_t *client) {
+/* Must be called with the client locked */
+static otr4_conversation_t *
+insert_conversation_with(const char *recipient, uint32_t their_instance_tag,
+                         otr4_client_t *client) {
   otr4_conversation_t *conv = NULL;
   otrv4_t *conn = NULL;
 
-  conv = get_conversation_with(recipient, client->conversations);
+  /* Another thread may have added it since we looked */
+  conv = find_conversation_with(recipient, their_instance_tag, client);
   if (conv)
     return conv;
 
@@ -150,33 +197,141 @@ otr4_conversation_t *get_or_create_conversation_with(const char *recipient,
   if (!conn)
     return NULL;
 
-  conv = new_conversation_with(recipient, conn);
+  conv = new_conversation_with(recipient, their_instance_tag, conn);
   if (!conv)
     return NULL;
 
-  client->conversations = list_add(conv, client->conversations);
+  if (hashmap_put(client->conversation_index, conv, conv)) {
+    conversation_free(conv);
+    return NULL;
+  }
+
+  if (!list_append(client->conversations, conv)) {
+    hashmap_remove(client->conversation_index, conv);
+    conversation_free(conv);
+    return NULL;
+  }
 
   return conv;
 }
 
+static otr4_conversation_t *
+add_conversation_with(const char *recipient, uint32_t their_instance_tag,
+                      otr4_client_t *client) {
+  pthread_mutex_lock(&client->lock);
+  otr4_conversation_t *conv =
+      insert_conversation_with(recipient, their_instance_tag, client);
+  pthread_mutex_unlock(&client->lock);
+
+  return conv;
+}
+
+otr4_conversation_t *get_or_create_conversation_with(const char *recipient,
+                                                     otr4_client_t *client) {
+  otr4_conversation_t *conv = get_conversation_with(recipient, client);
+  if (conv)
+    return conv;
+
+  return add_conversation_with(recipient, 0, client);
+}
+
+/* Reads the message type and instance tags from the header of an OTRv4
+ * encoded message, decoding only as much as that needs. */
+static bool encoded_message_instance_tags(uint8_t *type, uint32_t *sender,
+                                          uint32_t *receiver,
+                                          const char *message) {
+  if (get_message_type(message) != IN_MSG_OTR_ENCODED)
+    return false;
+
+  const char *encoded = strstr(message, "?OTR:") + 5;
+  size_t encoded_len = strnlen(encoded, 16);
+  uint8_t header[OTRL_B64_MAX_DECODED_SIZE(16)];
+  size_t len = otrl_base64_decode(header, encoded, encoded_len);
+
+  otrv4_header_t version_and_type;
+  size_t read = 0;
+  if (len < DAKE_HEADER_BYTES ||
+      extract_header(&version_and_type, header, len) ||
+      version_and_type.version != OTRV4_ALLOW_V4 ||
+      deserialize_uint32(sender, header + 3, len - 3, &read) ||
+      deserialize_uint32(receiver, header + 7, len - 7, &read))
+    return false;
+
+  *type = version_and_type.type;
+  return true;
+}
+
+/* Picks the conversation with the instance that sent the message, or NULL
+ * if it should be ignored. */
+static otr4_conversation_t *route_message(const char *message,
+                                          otr4_conversation_t *conv,
+                                          otr4_client_t *client) {
+  uint8_t type = 0;
+  uint32_t sender = 0, receiver = 0;
+  if (!encoded_message_instance_tags(&type, &sender, &receiver, message) ||
+      !sender)
+    return conv;
+
+  if (receiver && receiver != (uint32_t)conv->conn->our_instance_tag)
+    return NULL;
+
+  otr4_conversation_t *instance_conv =
+      get_instance_conversation_with(conv->recipient, sender, client);
+  if (instance_conv)
+    return instance_conv;
+
+  uint32_t bound_to = conv->conn->their_instance_tag;
+  if (!bound_to || bound_to == sender)
+    return conv;
+
+  /* Only an Identity message can start a conversation with a new instance */
+  if (type != OTR_IDENTITY_MSG_TYPE)
+    return NULL;
+
+  return add_conversation_with(conv->recipient, sender, client);
+}
+
 otr4_conversation_t *otr4_client_get_conversation(int force_create,
                                                   const char *recipient,
                                                   otr4_client_t *client) {
   if (force_create)
     return get_or_create_conversation_with(recipient, client);
 
-  return get_conversation_with(recipient, client->conversations);
+  return get_conversation_with(recipient, client);
 }
 
-static int otrv4_send_message(char **newmsg, const char *message,
-                              const char *recipient, otr4_client_t *client) {
-  otr4_conversation_t *conv = NULL;
-  tlv_t *tlv = otrv4_tlv_new(OTRV4_TLV_NONE, 0, NULL);
+otr4_conversation_t *
+otr4_client_get_instance_conversation(uint32_t their_instance_tag,
+                                      const char *recipient,
+                                      otr4_client_t *client) {
+  otr4_conversation_t *conv =
+      get_instance_conversation_with(recipient, their_instance_tag, client);
+  if (conv)
+    return conv;
 
-  conv = get_or_create_conversation_with(recipient, client);
-  if (!conv)
-    return 1;
+  /* Or the first conversation, if it is bound to that instance */
+  conv = get_conversation_with(recipient, client);
+  if (conv && (uint32_t)conv->conn->their_instance_tag == their_instance_tag)
+    return conv;
+
+  return NULL;
+}
+
+/* The conversation with one of the recipient's instances, or with any of
+ * them (created if needed) if the instance tag is 0 */
+static otr4_conversation_t *
+conversation_for_instance(const char *recipient, uint32_t their_instance_tag,
+                          otr4_client_t *client) {
+  if (!their_instance_tag)
+    return get_or_create_conversation_with(recipient, client);
+
+  return otr4_client_get_instance_conversation(their_instance_tag, recipient,
+                                               client);
+}
 
+static int otrv4_send_message(char **newmsg, const char *message,
+                              otr4_conversation_t *conv) {
+  tlv_t *tlv = otrv4_tlv_new(OTRV4_TLV_NONE, 0, NULL);
   otr4_err_t error =
       otrv4_prepare_to_send_message(newmsg, message, tlv, conv->conn);
   otrv4_tlv_free(tlv);
@@ -189,24 +344,45 @@ static int otrv4_send_message(char **newmsg, const char *message,
 
 int otr4_client_send(char **newmessage, const char *message,
                      const char *recipient, otr4_client_t *client) {
+  return otr4_client_send_instance(newmessage, message, recipient, 0, client);
+}
+
+int otr4_client_send_instance(char **newmessage, const char *message,
+                              const char *recipient,
+                              uint32_t their_instance_tag,
+                              otr4_client_t *client) {
+  otr4_conversation_t *conv =
+      conversation_for_instance(recipient, their_instance_tag, client);
+  if (!conv)
+    return 1;
+
   /* OTR4 client will know how to transition to OTR3 if a v3 conversation is
    started */
-  return otrv4_send_message(newmessage, message, recipient, client);
+  return otrv4_send_message(newmessage, message, conv);
 }
 
 int otr4_client_send_fragment(otr4_message_to_send_t **newmessage,
                               const char *message, int mms,
                               const char *recipient, otr4_client_t *client) {
-  string_t to_send = NULL;
-  otr4_err_t err = otrv4_send_message(&to_send, message, recipient, client);
-  if (err != OTR4_SUCCESS)
-    return 1;
+  return otr4_client_send_fragment_instance(newmessage, message, mms,
+                                            recipient, 0, client);
+}
 
-  otr4_conversation_t *conv = NULL;
-  conv = get_or_create_conversation_with(recipient, client);
+int otr4_client_send_fragment_instance(otr4_message_to_send_t **newmessage,
+                                       const char *message, int mms,
+                                       const char *recipient,
+                                       uint32_t their_instance_tag,
+                                       otr4_client_t *client) {
+  otr4_conversation_t *conv =
+      conversation_for_instance(recipient, their_instance_tag, client);
   if (!conv)
     return 1;
 
+  string_t to_send = NULL;
+  otr4_err_t err = otrv4_send_message(&to_send, message, conv);
+  if (err != OTR4_SUCCESS)
+    return 1;
+
   uint32_t our_tag = conv->conn->our_instance_tag;
   uint32_t their_tag = conv->conn->their_instance_tag;
   err = otr4_fragment_message(mms, *newmessage, our_tag, their_tag, to_send);
@@ -219,9 +395,17 @@ int otr4_client_smp_start(char **tosend, const char *recipient,
                           const char *question, const size_t q_len,
                           const unsigned char *secret, size_t secretlen,
                           otr4_client_t *client) {
-  otr4_conversation_t *conv = NULL;
+  return otr4_client_smp_start_instance(tosend, recipient, 0, question, q_len,
+                                        secret, secretlen, client);
+}
 
-  conv = get_or_create_conversation_with(recipient, client);
+int otr4_client_smp_start_instance(char **tosend, const char *recipient,
+                                   uint32_t their_instance_tag,
+                                   const char *question, const size_t q_len,
+                                   const unsigned char *secret,
+                                   size_t secretlen, otr4_client_t *client) {
+  otr4_conversation_t *conv =
+      conversation_for_instance(recipient, their_instance_tag, client);
   if (!conv)
     return 1;
 
@@ -234,9 +418,16 @@ int otr4_client_smp_start(char **tosend, const char *recipient,
 int otr4_client_smp_respond(char **tosend, const char *recipient,
                             const unsigned char *secret, size_t secretlen,
                             otr4_client_t *client) {
-  otr4_conversation_t *conv = NULL;
+  return otr4_client_smp_respond_instance(tosend, recipient, 0, secret,
+                                          secretlen, client);
+}
 
-  conv = get_or_create_conversation_with(recipient, client);
+int otr4_client_smp_respond_instance(char **tosend, const char *recipient,
+                                     uint32_t their_instance_tag,
+                                     const unsigned char *secret,
+                                     size_t secretlen, otr4_client_t *client) {
+  otr4_conversation_t *conv =
+      conversation_for_instance(recipient, their_instance_tag, client);
   if (!conv)
     return 1;
 
@@ -266,6 +457,7 @@ int otr4_client_receive(char **newmessage, char **todisplay,
     return err;
 
   *newmessage = NULL;
+  *todisplay = NULL;
 
   conv = get_or_create_conversation_with(recipient, client);
   if (!conv)
@@ -275,6 +467,12 @@ int otr4_client_receive(char **newmessage, char **todisplay,
                  conv->conn->our_instance_tag))
     return should_ignore;
 
+  conv = route_message(unfrag_msg, conv, client);
+  if (!conv) {
+    free(unfrag_msg);
+    return should_ignore;
+  }
+
   response = otrv4_response_new();
   err = otrv4_receive_message(response, unfrag_msg, conv->conn);
   free(unfrag_msg);
@@ -282,7 +480,6 @@ int otr4_client_receive(char **newmessage, char **todisplay,
   if (response->to_send)
     *newmessage = otrv4_strdup(response->to_send);
 
-  *todisplay = NULL;
   if (response->to_display) {
     char *plain = otrv4_strdup(response->to_display);
     *todisplay = plain;
@@ -316,27 +513,130 @@ char *otr4_client_query_message(const char *recipient, const char *message,
 
 static void destroy_client_conversation(const otr4_conversation_t *conv,
                                         otr4_client_t *client) {
-  list_element_t *elem = list_get_by_value(conv, client->conversations);
-  client->conversations = list_remove_element(elem, client->conversations);
+  pthread_mutex_lock(&client->lock);
+  hashmap_remove(client->conversation_index, conv);
+
+  list_element_t *elem = list_get_by_value(conv, client->conversations->head);
+  list_unlink(client->conversations, elem);
+  pthread_mutex_unlock(&client->lock);
+
   list_free_nodes(elem);
 }
 
+static int close_conversation(char **newmsg, otr4_conversation_t *conv,
+                              otr4_client_t *client) {
+  if (otrv4_close(newmsg, conv->conn))
+    return 2;
+
+  destroy_client_conversation(conv, client);
+  conversation_free(conv);
+
+  return 0;
+}
+
 int otr4_client_disconnect(char **newmsg, const char *recipient,
                            otr4_client_t *client) {
-  otr4_conversation_t *conv = NULL;
+  return otr4_client_disconnect_instance(newmsg, recipient, 0, client);
+}
 
-  conv = get_conversation_with(recipient, client->conversations);
+int otr4_client_disconnect_instance(char **newmsg, const char *recipient,
+                                    uint32_t their_instance_tag,
+                                    otr4_client_t *client) {
+  otr4_conversation_t *conv =
+      their_instance_tag
+          ? otr4_client_get_instance_conversation(their_instance_tag,
+                                                  recipient, client)
+          : get_conversation_with(recipient, client);
   if (!conv)
     return 1;
 
-  if (otrv4_close(newmsg, conv->conn))
-    return 2;
+  return close_conversation(newmsg, conv, client);
+}
 
-  destroy_client_conversation(conv, client);
-  conversation_free(conv);
-  conv = NULL;
+/* Lists every conversation with the recipient, with any of its instances */
+static otr4_err_t conversations_with(list_t *found, const char *recipient,
+                                     otr4_client_t *client) {
+  otr4_err_t err = OTR4_SUCCESS;
 
-  return 0;
+  pthread_mutex_lock(&client->lock);
+  for (list_element_t *el = client->conversations->head; el; el = el->next) {
+    if (strcmp(CONV(el->data)->recipient, recipient))
+      continue;
+
+    if (!list_append(found, el->data)) {
+      err = OTR4_ERROR;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&client->lock);
+
+  return err;
+}
+
+/* Moves the messages into pieces, with the index and the messages in the
+ * same allocation as otr4_message_free expects */
+static otr4_err_t pack_messages(otr4_message_to_send_t *newmsgs,
+                                const list_t *messages) {
+  size_t index_len = list_size(messages) * sizeof(string_t);
+  size_t arena_len = 0;
+  for (list_element_t *el = messages->head; el; el = el->next)
+    arena_len += strlen(el->data) + 1;
+
+  string_t *pieces = malloc(index_len + arena_len);
+  if (!pieces)
+    return OTR4_ERROR;
+
+  char *cursor = (char *)(pieces + list_size(messages));
+  int total = 0;
+  for (list_element_t *el = messages->head; el; el = el->next) {
+    size_t len = strlen(el->data) + 1;
+    pieces[total++] = memcpy(cursor, el->data, len);
+    cursor += len;
+  }
+
+  newmsgs->pieces = pieces;
+  newmsgs->total = total;
+
+  return OTR4_SUCCESS;
+}
+
+int otr4_client_disconnect_all(otr4_message_to_send_t *newmsgs,
+                               const char *recipient, otr4_client_t *client) {
+  list_t convs[1], messages[1];
+  list_init(convs);
+  list_init(messages);
+
+  newmsgs->pieces = NULL;
+  newmsgs->total = 0;
+
+  if (conversations_with(convs, recipient, client) || !list_size(convs)) {
+    list_clear(convs, NULL);
+    return 1;
+  }
+
+  /* Close them all, even if some fail */
+  int result = 0;
+  for (list_element_t *el = convs->head; el; el = el->next) {
+    char *newmsg = NULL;
+    if (close_conversation(&newmsg, el->data, client)) {
+      free(newmsg);
+      result = 2;
+      continue;
+    }
+
+    if (newmsg && !list_append(messages, newmsg)) {
+      free(newmsg);
+      result = 2;
+    }
+  }
+
+  if (pack_messages(newmsgs, messages))
+    result = 2;
+
+  list_clear(convs, NULL);
+  list_clear(messages, free);
+
+  return result;
 }
 
 int otr4_client_get_our_fingerprint(otrv4_fingerprint_t fp,
@@ -4,8 +4,10 @@
 #define OTR4_CLIENT_ERROR_NOT_ENCRYPTED 0x1001
 
 #include <libotr/context.h>
+#include <pthread.h>
 
 #include "client_state.h"
+#include "hashmap.h"
 #include "instance_tag.h"
 #include "list.h"
 #include "otrv4.h"
@@ -18,13 +20,18 @@ typedef struct {
                           Pidgin) this could be a PurpleConversation */
 
   char *recipient;
+  uint32_t their_instance_tag; /* The recipient's instance, or 0 for any */
   otrv4_t *conn;
 } otr4_conversation_t;
 
-/* A client handle messages from/to a sender to/from multiple recipients. */
+/* A client handle messages from/to a sender to/from multiple recipients.
+ * Different conversations may be used from different threads, but each
+ * conversation from only one thread at a time. */
 typedef struct {
   otr4_client_state_t *state;
-  list_element_t *conversations;
+  list_t conversations[1];
+  hashmap_t *conversation_index; /* By recipient and their instance tag */
+  pthread_mutex_t lock;          /* For conversations and their index */
 } otr4_client_t;
 
 otr4_client_t *otr4_client_new(otr4_client_state_t *);
@@ -34,32 +41,72 @@ void otr4_client_free(otr4_client_t *client);
 char *otr4_client_query_message(const char *recipient, const char *message,
                                 otr4_client_t *client);
 
+/* The _instance variants use the conversation with one of the recipient's
+ * instances, and fail if there is none. An instance tag of 0 means any
+ * instance, as the variants without it do. */
 int otr4_client_send(char **newmessage, const char *message,
                      const char *recipient, otr4_client_t *client);
 
+int otr4_client_send_instance(char **newmessage, const char *message,
+                              const char *recipient,
+                              uint32_t their_instance_tag,
+                              otr4_client_t *client);
+
 int otr4_client_send_fragment(otr4_message_to_send_t **newmessage,
                               const char *message, int mms,
                               const char *recipient, otr4_client_t *client);
 
+int otr4_client_send_fragment_instance(otr4_message_to_send_t **newmessage,
+                                       const char *message, int mms,
+                                       const char *recipient,
+                                       uint32_t their_instance_tag,
+                                       otr4_client_t *client);
+
 int otr4_client_smp_start(char **tosend, const char *recipient,
                           const char *question, const size_t q_len,
                           const unsigned char *secret, size_t secretlen,
                           otr4_client_t *client);
 
+int otr4_client_smp_start_instance(char **tosend, const char *recipient,
+                                   uint32_t their_instance_tag,
+                                   const char *question, const size_t q_len,
+                                   const unsigned char *secret,
+                                   size_t secretlen, otr4_client_t *client);
+
 int otr4_client_smp_respond(char **tosend, const char *recipient,
                             const unsigned char *secret, size_t secretlen,
                             otr4_client_t *client);
 
+int otr4_client_smp_respond_instance(char **tosend, const char *recipient,
+                                     uint32_t their_instance_tag,
+                                     const unsigned char *secret,
+                                     size_t secretlen, otr4_client_t *client);
+
 int otr4_client_receive(char **newmsg, char **todisplay, const char *message,
                         const char *recipient, otr4_client_t *client);
 
 int otr4_client_disconnect(char **newmsg, const char *recipient,
                            otr4_client_t *client);
 
+/* Closes every conversation with the recipient. newmsgs gets a disconnect
+ * message for each instance that needs one, to be sent separately. */
+int otr4_client_disconnect_all(otr4_message_to_send_t *newmsgs,
+                               const char *recipient, otr4_client_t *client);
+
+int otr4_client_disconnect_instance(char **newmsg, const char *recipient,
+                                    uint32_t their_instance_tag,
+                                    otr4_client_t *client);
+
 otr4_conversation_t *otr4_client_get_conversation(int force,
                                                   const char *recipient,
                                                   otr4_client_t *client);
 
+/* The conversation with one of the recipient's instances, if any */
+otr4_conversation_t *
+otr4_client_get_instance_conversation(uint32_t their_instance_tag,
+                                      const char *recipient,
+                                      otr4_client_t *client);
+
 int otr4_conversation_is_encrypted(otr4_conversation_t *conv);
 
 int otr4_conversation_is_finished(otr4_conversation_t *conv);
@@ -2,8 +2,10 @@
 
 #include <libotr/privkey.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "deserialize.h"
+#include "otrv3.h"
 #include "str.h"
 
 otr4_client_state_t *otr4_client_state_new(void *client_id) {
@@ -18,10 +20,34 @@ otr4_client_state_t *otr4_client_state_new(void *client_id) {
   state->keypair = NULL;
   state->callbacks = NULL;
 
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&state->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  otr4_profile_manager_t *manager = state->profiles;
+  manager->current = NULL;
+  manager->versions = NULL;
+  manager->lifetime = 0;
+  manager->renew_before = 0;
+  manager->running = false;
+  pthread_mutex_init(&manager->lock, NULL);
+  pthread_cond_init(&manager->wakeup, NULL);
+
+  otrv4_padding_policy_t padding = OTRV4_PADDING_POLICY_DEFAULT;
+  state->padding = padding;
+
   return state;
 }
 
 void otr4_client_state_free(otr4_client_state_t *state) {
+  otr4_client_state_stop_profile_renewal(state);
+  pthread_cond_destroy(&state->profiles->wakeup);
+  pthread_mutex_destroy(&state->profiles->lock);
+
+  pthread_mutex_destroy(&state->lock);
+
   state->client_id = NULL;
   state->userstate = NULL;
 
@@ -43,8 +69,12 @@ void otr4_client_state_free(otr4_client_state_t *state) {
 // We might want to extract otrl_privkey_generate_finish_FILEp into 2 functions.
 int otr4_client_state_private_key_v3_generate_FILEp(
     const otr4_client_state_t *state, FILE *privf) {
-  return otrl_privkey_generate_FILEp(state->userstate, privf,
-                                     state->account_name, state->protocol_name);
+  otrv3_lock();
+  int err = otrl_privkey_generate_FILEp(
+      state->userstate, privf, state->account_name, state->protocol_name);
+  otrv3_unlock();
+
+  return err;
 }
 
 otrv4_keypair_t *
@@ -52,10 +82,14 @@ otr4_client_state_get_private_key_v4(otr4_client_state_t *state) {
   if (!state)
     return NULL;
 
+  pthread_mutex_lock(&state->lock);
   if (!state->keypair && state->callbacks && state->callbacks->create_privkey)
     state->callbacks->create_privkey(state->client_id);
 
-  return state->keypair;
+  otrv4_keypair_t *keypair = state->keypair;
+  pthread_mutex_unlock(&state->lock);
+
+  return keypair;
 }
 
 int otr4_client_state_add_private_key_v4(
@@ -63,15 +97,24 @@ int otr4_client_state_add_private_key_v4(
   if (!state)
     return 1;
 
-  if (state->keypair)
-    return 0;
-
-  state->keypair = otrv4_keypair_new();
-  if (!state->keypair)
-    return 2;
+  int err = 0;
+  pthread_mutex_lock(&state->lock);
+  do {
+    if (state->keypair)
+      continue;
+
+    otrv4_keypair_t *keypair = otrv4_keypair_new();
+    if (!keypair) {
+      err = 2;
+      continue;
+    }
+
+    otrv4_keypair_generate(keypair, sym);
+    state->keypair = keypair;
+  } while (0);
+  pthread_mutex_unlock(&state->lock);
 
-  otrv4_keypair_generate(state->keypair, sym);
-  return 0;
+  return err;
 }
 
 int otr4_client_state_private_key_v4_write_FILEp(otr4_client_state_t *state,
@@ -79,10 +122,6 @@ int otr4_client_state_private_key_v4_write_FILEp(otr4_client_state_t *state,
   if (!state->protocol_name || !state->account_name)
     return 1;
 
-  char *key =
-      malloc(strlen(state->protocol_name) + strlen(state->account_name) + 2);
-  sprintf(key, "%s:%s", state->protocol_name, state->account_name);
-
   char *buff = NULL;
   size_t s = 0;
   int err = 0;
@@ -90,33 +129,49 @@ int otr4_client_state_private_key_v4_write_FILEp(otr4_client_state_t *state,
   if (!privf)
     return -1;
 
+  pthread_mutex_lock(&state->lock);
   if (!state->keypair)
-    return -2;
+    err = -2;
+  else
+    err = otrv4_symmetric_key_serialize(&buff, &s, state->keypair->sym);
+  pthread_mutex_unlock(&state->lock);
 
-  err = otrv4_symmetric_key_serialize(&buff, &s, state->keypair->sym);
   if (err)
     return err;
 
-  err = fputs(key, privf);
-  free(key);
-
-  if (EOF == err)
+  char *key =
+      malloc(strlen(state->protocol_name) + strlen(state->account_name) + 2);
+  if (!key) {
+    free(buff);
     return -3;
+  }
 
-  if (EOF == fputs("\n", privf))
-    return -3;
+  sprintf(key, "%s:%s", state->protocol_name, state->account_name);
 
-  if (1 != fwrite(buff, s, 1, privf))
-    return -3;
+  do {
+    err = -3;
+    if (EOF == fputs(key, privf))
+      continue;
 
-  if (EOF == fputs("\n", privf))
-    return -3;
+    if (EOF == fputs("\n", privf))
+      continue;
 
-  return 0;
+    if (1 != fwrite(buff, s, 1, privf))
+      continue;
+
+    if (EOF == fputs("\n", privf))
+      continue;
+
+    err = 0;
+  } while (0);
+
+  free(key);
+  free(buff);
+
+  return err;
 }
 
-int otr4_client_state_private_key_v4_read_FILEp(otr4_client_state_t *state,
-                                                FILE *privf) {
+static int read_private_key_v4(otr4_client_state_t *state, FILE *privf) {
   char *line = NULL;
   size_t cap = 0;
   int len = 0;
@@ -151,6 +206,174 @@ int otr4_client_state_private_key_v4_read_FILEp(otr4_client_state_t *state,
   return err;
 }
 
+int otr4_client_state_private_key_v4_read_FILEp(otr4_client_state_t *state,
+                                                FILE *privf) {
+  pthread_mutex_lock(&state->lock);
+  int err = read_private_key_v4(state, privf);
+  pthread_mutex_unlock(&state->lock);
+
+  return err;
+}
+
+/* Seconds to wait before trying again when signing fails */
+#define PROFILE_RETRY_SECONDS 60
+
+static user_profile_t *sign_next_profile(otr4_client_state_t *state) {
+  otr4_profile_manager_t *manager = state->profiles;
+  return user_profile_build_expiring(manager->versions, state->keypair,
+                                     time(NULL) + manager->lifetime);
+}
+
+static void *renew_profiles(void *data) {
+  otr4_client_state_t *state = data;
+  otr4_profile_manager_t *manager = state->profiles;
+
+  pthread_mutex_lock(&manager->lock);
+  while (manager->running) {
+    struct timespec renew_at = {
+        .tv_sec = manager->current->expires - manager->renew_before,
+    };
+
+    if (time(NULL) < renew_at.tv_sec) {
+      pthread_cond_timedwait(&manager->wakeup, &manager->lock, &renew_at);
+      continue;
+    }
+
+    /* Handshakes keep using the current profile while this one is signed */
+    pthread_mutex_unlock(&manager->lock);
+    user_profile_t *renewed = sign_next_profile(state);
+    pthread_mutex_lock(&manager->lock);
+
+    if (!renewed) {
+      struct timespec retry_at = {.tv_sec = time(NULL) + PROFILE_RETRY_SECONDS};
+      pthread_cond_timedwait(&manager->wakeup, &manager->lock, &retry_at);
+      continue;
+    }
+
+    user_profile_free(manager->current);
+    manager->current = renewed;
+  }
+  pthread_mutex_unlock(&manager->lock);
+
+  return NULL;
+}
+
+otr4_err_t otr4_client_state_start_profile_renewal(otr4_client_state_t *state,
+                                                   const char *versions,
+                                                   uint64_t lifetime,
+                                                   uint64_t renew_before) {
+  otr4_profile_manager_t *manager = state->profiles;
+
+  if (!versions || renew_before >= lifetime ||
+      !otr4_client_state_get_private_key_v4(state))
+    return OTR4_ERROR;
+
+  pthread_mutex_lock(&manager->lock);
+  otr4_err_t err = OTR4_ERROR;
+  do {
+    if (manager->running)
+      continue;
+
+    manager->versions = otrv4_strdup(versions);
+    manager->lifetime = lifetime;
+    manager->renew_before = renew_before;
+    manager->current = sign_next_profile(state);
+    if (!manager->current)
+      continue;
+
+    manager->running = true;
+    if (pthread_create(&manager->worker, NULL, renew_profiles, state)) {
+      manager->running = false;
+      continue;
+    }
+
+    err = OTR4_SUCCESS;
+  } while (0);
+
+  if (err && !manager->running) {
+    user_profile_free(manager->current);
+    manager->current = NULL;
+    free(manager->versions);
+    manager->versions = NULL;
+  }
+  pthread_mutex_unlock(&manager->lock);
+
+  return err;
+}
+
+void otr4_client_state_stop_profile_renewal(otr4_client_state_t *state) {
+  otr4_profile_manager_t *manager = state->profiles;
+
+  pthread_mutex_lock(&manager->lock);
+  if (!manager->running) {
+    pthread_mutex_unlock(&manager->lock);
+    return;
+  }
+
+  manager->running = false;
+  pthread_cond_signal(&manager->wakeup);
+  pthread_mutex_unlock(&manager->lock);
+
+  pthread_join(manager->worker, NULL);
+
+  pthread_mutex_lock(&manager->lock);
+  user_profile_free(manager->current);
+  manager->current = NULL;
+  free(manager->versions);
+  manager->versions = NULL;
+  pthread_mutex_unlock(&manager->lock);
+}
+
+uint64_t otr4_client_state_profile_expires(otr4_client_state_t *state) {
+  otr4_profile_manager_t *manager = state->profiles;
+
+  pthread_mutex_lock(&manager->lock);
+  uint64_t expires = manager->current ? manager->current->expires : 0;
+  pthread_mutex_unlock(&manager->lock);
+
+  return expires;
+}
+
+user_profile_t *otr4_client_state_get_profile(otr4_client_state_t *state,
+                                              const char *versions,
+                                              uint64_t expiring_after) {
+  otr4_profile_manager_t *manager = state->profiles;
+  user_profile_t *profile = NULL;
+
+  pthread_mutex_lock(&manager->lock);
+  const user_profile_t *current = manager->current;
+  if (current && current->expires > expiring_after &&
+      !strcmp(current->versions, versions)) {
+    profile = malloc(sizeof(user_profile_t));
+    if (profile)
+      user_profile_copy(profile, current);
+  }
+  pthread_mutex_unlock(&manager->lock);
+
+  return profile;
+}
+
+otr4_err_t otr4_client_state_set_padding(otr4_client_state_t *state,
+                                         const otrv4_padding_policy_t *policy) {
+  if (!otrv4_padding_policy_valid(policy))
+    return OTR4_ERROR;
+
+  pthread_mutex_lock(&state->lock);
+  state->padding = *policy;
+  pthread_mutex_unlock(&state->lock);
+
+  return OTR4_SUCCESS;
+}
+
+otrv4_padding_policy_t
+otr4_client_state_get_padding(otr4_client_state_t *state) {
+  pthread_mutex_lock(&state->lock);
+  otrv4_padding_policy_t policy = state->padding;
+  pthread_mutex_unlock(&state->lock);
+
+  return policy;
+}
+
 static OtrlInsTag *otrl_instance_tag_new(const char *protocol,
                                          const char *account,
                                          unsigned int instag) {
@@ -186,7 +409,10 @@ int otr4_client_state_add_instance_tag(otr4_client_state_t *state,
   if (!p)
     return -1;
 
+  otrv3_lock();
   otrl_userstate_instance_tag_add(state->userstate, p);
+  otrv3_unlock();
+
   return 0;
 }
 
@@ -194,12 +420,13 @@ unsigned int otr4_client_state_get_instance_tag(otr4_client_state_t *state) {
   if (!state->userstate)
     return 0;
 
+  otrv3_lock();
   OtrlInsTag *instag = otrl_instag_find(state->userstate, state->account_name,
                                         state->protocol_name);
-  if (!instag)
-    return 0;
+  unsigned int value = instag ? instag->instag : 0;
+  otrv3_unlock();
 
-  return instag->instag;
+  return value;
 }
 
 int otr4_client_state_instance_tag_read_FILEp(otr4_client_state_t *state,
@@ -207,5 +434,9 @@ int otr4_client_state_instance_tag_read_FILEp(otr4_client_state_t *state,
   if (!state->userstate)
     return 1;
 
-  return otrl_instag_read_FILEp(state->userstate, instag);
+  otrv3_lock();
+  int err = otrl_instag_read_FILEp(state->userstate, instag);
+  otrv3_unlock();
+
+  return err;
 }
@@ -2,12 +2,30 @@
 #define _OTR4_CLIENT_STATE_H
 
 #include <gcrypt.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 #include <libotr/userstate.h>
 
 #include "client_callbacks.h"
 #include "instance_tag.h"
 #include "keys.h"
+#include "tlv.h"
+#include "user_profile.h"
+
+/* Keeps a signed user profile, and signs its replacement on a background
+ * thread before it expires. */
+typedef struct {
+  user_profile_t *current;
+  char *versions;
+  uint64_t lifetime;     /* Seconds each profile is valid for */
+  uint64_t renew_before; /* Seconds before expiry to sign the next one */
+
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  bool running;
+} otr4_profile_manager_t;
 
 typedef struct otr4_client_state_t {
   void *client_id; /* Data in the messaging application context that represents
@@ -27,6 +45,14 @@ typedef struct otr4_client_state_t {
   OtrlUserState userstate;
   otrv4_keypair_t *keypair;
 
+  /* Recursive, as creating a missing keypair calls back into the app */
+  pthread_mutex_t lock;
+
+  otr4_profile_manager_t profiles[1];
+
+  /* For the messages sent in every conversation of this client */
+  otrv4_padding_policy_t padding;
+
   // OtrlPrivKey *privkeyv3; // ???
   // otrv4_instag_t *instag; // TODO: Store the instance tag here rather than
   // use OTR3 User State as a store for instance tags
@@ -55,6 +81,32 @@ int otr4_client_state_add_instance_tag(otr4_client_state_t *state,
 
 unsigned int otr4_client_state_get_instance_tag(otr4_client_state_t *state);
 
+/* Signs a profile for versions now, then keeps renewing it. Use
+ * USER_PROFILE_EXPIRATION_SECONDS and USER_PROFILE_RENEWAL_SECONDS unless
+ * there is a reason not to. */
+otr4_err_t otr4_client_state_start_profile_renewal(otr4_client_state_t *state,
+                                                   const char *versions,
+                                                   uint64_t lifetime,
+                                                   uint64_t renew_before);
+
+void otr4_client_state_stop_profile_renewal(otr4_client_state_t *state);
+
+/* When the current profile expires, or 0 if profiles are not renewed */
+uint64_t otr4_client_state_profile_expires(otr4_client_state_t *state);
+
+/* A copy of the current profile, if it is for versions and expires after
+ * expiring_after, or NULL */
+user_profile_t *otr4_client_state_get_profile(otr4_client_state_t *state,
+                                              const char *versions,
+                                              uint64_t expiring_after);
+
+/* Fails, keeping the current one, if policy is not valid */
+otr4_err_t otr4_client_state_set_padding(otr4_client_state_t *state,
+                                         const otrv4_padding_policy_t *policy);
+
+otrv4_padding_policy_t
+otr4_client_state_get_padding(otr4_client_state_t *state);
+
 int otr4_client_state_instance_tag_read_FILEp(otr4_client_state_t *state,
                                               FILE *instag);
 
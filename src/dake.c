@@ -51,18 +51,15 @@ otr4_err_t dake_identity_message_asprintf(
     uint8_t **dst, size_t *nbytes,
     const dake_identity_message_t *identity_message) {
   size_t profile_len = 0;
-  uint8_t *profile = NULL;
-  if (user_profile_asprintf(&profile, &profile_len,
-                            identity_message->profile)) {
+  const uint8_t *profile =
+      user_profile_serialized(identity_message->profile, &profile_len);
+  if (!profile)
     return OTR4_ERROR;
-  }
 
   size_t s = PRE_KEY_MIN_BYTES + profile_len;
   uint8_t *buff = malloc(s);
-  if (!buff) {
-    free(profile);
+  if (!buff)
     return OTR4_ERROR;
-  }
 
   uint8_t *cursor = buff;
   cursor += serialize_uint16(cursor, OTR_VERSION);
@@ -71,7 +68,6 @@ otr4_err_t dake_identity_message_asprintf(
   cursor += serialize_uint32(cursor, identity_message->receiver_instance_tag);
   cursor += serialize_bytes_array(cursor, profile, profile_len);
   if (serialize_ec_point(cursor, identity_message->Y)) {
-    free(profile);
     free(buff);
     return OTR4_ERROR;
   }
@@ -79,7 +75,6 @@ otr4_err_t dake_identity_message_asprintf(
   size_t len = 0;
   otr4_err_t err = serialize_dh_public_key(cursor, &len, identity_message->B);
   if (err) {
-    free(profile);
     free(buff);
     return OTR4_ERROR;
   }
@@ -91,7 +86,6 @@ otr4_err_t dake_identity_message_asprintf(
   if (nbytes)
     *nbytes = cursor - buff;
 
-  free(profile);
   return OTR4_SUCCESS;
 }
 
@@ -219,20 +213,16 @@ bool valid_received_values(const ec_point_t their_ecdh, const dh_mpi_t their_dh,
 otr4_err_t dake_auth_r_asprintf(uint8_t **dst, size_t *nbytes,
                                 const dake_auth_r_t *dre_auth) {
   size_t our_profile_len = 0;
-  uint8_t *our_profile = NULL;
-
-  if (user_profile_asprintf(&our_profile, &our_profile_len,
-                            dre_auth->profile)) {
+  const uint8_t *our_profile =
+      user_profile_serialized(dre_auth->profile, &our_profile_len);
+  if (!our_profile)
     return OTR4_ERROR;
-  }
 
   size_t s = AUTH_R_MIN_BYTES + our_profile_len;
 
   uint8_t *buff = malloc(s);
-  if (!buff) {
-    free(our_profile);
+  if (!buff)
     return OTR4_ERROR;
-  }
 
   uint8_t *cursor = buff;
   cursor += serialize_uint16(cursor, OTR_VERSION);
@@ -241,7 +231,6 @@ otr4_err_t dake_auth_r_asprintf(uint8_t **dst, size_t *nbytes,
   cursor += serialize_uint32(cursor, dre_auth->receiver_instance_tag);
   cursor += serialize_bytes_array(cursor, our_profile, our_profile_len);
   if (serialize_ec_point(cursor, dre_auth->X)) {
-    free(our_profile);
     free(buff);
     return OTR4_ERROR;
   }
@@ -251,7 +240,6 @@ otr4_err_t dake_auth_r_asprintf(uint8_t **dst, size_t *nbytes,
 
   otr4_err_t err = serialize_dh_public_key(cursor, &len, dre_auth->A);
   if (err) {
-    free(our_profile);
     free(buff);
     return OTR4_ERROR;
   }
@@ -265,7 +253,6 @@ otr4_err_t dake_auth_r_asprintf(uint8_t **dst, size_t *nbytes,
   if (nbytes)
     *nbytes = cursor - buff;
 
-  free(our_profile);
   return OTR4_SUCCESS;
 }
 
@@ -0,0 +1,169 @@
+#include "dake_pool.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static otr4_err_t set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return OTR4_ERROR;
+
+  return OTR4_SUCCESS;
+}
+
+otr4_dake_pool_t *otr4_dake_pool_new(otr4_userstate_t *state, size_t workers) {
+  otr4_dake_pool_t *pool = malloc(sizeof(otr4_dake_pool_t));
+  if (!pool)
+    return NULL;
+
+  pool->first = NULL;
+  pool->last = NULL;
+
+  if (pipe(pool->ready)) {
+    free(pool);
+    return NULL;
+  }
+
+  if (set_nonblocking(pool->ready[0]) || set_nonblocking(pool->ready[1])) {
+    close(pool->ready[0]);
+    close(pool->ready[1]);
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+
+  pool->shards = otr4_shards_new(state, workers);
+  if (!pool->shards) {
+    otr4_dake_pool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+void otr4_dake_pool_free(otr4_dake_pool_t *pool) {
+  if (!pool)
+    return;
+
+  otr4_shards_free(pool->shards);
+  pool->shards = NULL;
+
+  otr4_dake_result_t *result = NULL;
+  while ((result = otr4_dake_pool_next(pool)))
+    otr4_dake_result_free(result);
+
+  close(pool->ready[0]);
+  close(pool->ready[1]);
+  pthread_mutex_destroy(&pool->lock);
+
+  free(pool);
+}
+
+int otr4_dake_pool_fd(const otr4_dake_pool_t *pool) { return pool->ready[0]; }
+
+/* Runs on the worker threads */
+static void complete(int result, char *to_send, char *to_display, void *data) {
+  otr4_dake_result_t *completed = data;
+  otr4_dake_pool_t *pool = completed->pool;
+
+  completed->result = result;
+  completed->to_send = to_send;
+  completed->to_display = to_display;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->last) {
+    pool->last->next = completed;
+  } else {
+    pool->first = completed;
+    /* The pipe holds a single byte, however many results are waiting */
+    ssize_t written = write(pool->ready[1], "", 1);
+    (void)written;
+  }
+
+  pool->last = completed;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static otr4_dake_result_t *result_new(otr4_dake_pool_t *pool, void *data) {
+  otr4_dake_result_t *result = malloc(sizeof(otr4_dake_result_t));
+  if (!result)
+    return NULL;
+
+  result->result = 1;
+  result->to_send = NULL;
+  result->to_display = NULL;
+  result->data = data;
+  result->pool = pool;
+  result->next = NULL;
+
+  return result;
+}
+
+otr4_err_t otr4_dake_pool_receive(otr4_dake_pool_t *pool, void *client_id,
+                                  const char *recipient, const char *message,
+                                  void *data) {
+  otr4_dake_result_t *result = result_new(pool, data);
+  if (!result)
+    return OTR4_ERROR;
+
+  if (otr4_shards_receive(pool->shards, client_id, recipient, message,
+                          complete, result)) {
+    otr4_dake_result_free(result);
+    return OTR4_ERROR;
+  }
+
+  return OTR4_SUCCESS;
+}
+
+otr4_err_t otr4_dake_pool_send(otr4_dake_pool_t *pool, void *client_id,
+                               const char *recipient, const char *message,
+                               void *data) {
+  otr4_dake_result_t *result = result_new(pool, data);
+  if (!result)
+    return OTR4_ERROR;
+
+  if (otr4_shards_send(pool->shards, client_id, recipient, message, complete,
+                       result)) {
+    otr4_dake_result_free(result);
+    return OTR4_ERROR;
+  }
+
+  return OTR4_SUCCESS;
+}
+
+otr4_dake_result_t *otr4_dake_pool_next(otr4_dake_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  otr4_dake_result_t *result = pool->first;
+  if (result) {
+    pool->first = result->next;
+    result->next = NULL;
+  }
+
+  if (result && !pool->first) {
+    pool->last = NULL;
+    char drained;
+    ssize_t read_bytes = read(pool->ready[0], &drained, 1);
+    (void)read_bytes;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return result;
+}
+
+void otr4_dake_result_free(otr4_dake_result_t *result) {
+  if (!result)
+    return;
+
+  free(result->to_send);
+  result->to_send = NULL;
+
+  free(result->to_display);
+  result->to_display = NULL;
+
+  result->data = NULL;
+  result->pool = NULL;
+
+  free(result);
+}
@@ -0,0 +1,57 @@
+#ifndef OTR4_DAKE_POOL_H
+#define OTR4_DAKE_POOL_H
+
+#include <pthread.h>
+
+#include "error.h"
+#include "messaging.h"
+#include "shard.h"
+
+typedef struct otr4_dake_pool_t otr4_dake_pool_t;
+
+typedef struct otr4_dake_result_t {
+  int result; /* As returned by otr4_client_receive or otr4_client_send */
+  char *to_send;
+  char *to_display;
+  void *data; /* As given when the message was submitted */
+
+  otr4_dake_pool_t *pool;
+  struct otr4_dake_result_t *next;
+} otr4_dake_result_t;
+
+/* Processes messages, and with them the DH, ECDH and SNIZKPK work of the
+ * DAKE, on worker threads. Results are queued for the submitting thread,
+ * and otr4_dake_pool_fd becomes readable while any are waiting, so an event
+ * loop can poll for them and never block on a handshake. To get results on
+ * the worker threads instead, use otr4_shards_t directly. */
+struct otr4_dake_pool_t {
+  otr4_shards_t *shards;
+
+  pthread_mutex_t lock;
+  otr4_dake_result_t *first;
+  otr4_dake_result_t *last;
+  int ready[2]; /* Holds a byte while results are waiting */
+};
+
+otr4_dake_pool_t *otr4_dake_pool_new(otr4_userstate_t *state, size_t workers);
+
+/* Waits for the messages already submitted, and frees any results not yet
+ * taken. */
+void otr4_dake_pool_free(otr4_dake_pool_t *pool);
+
+int otr4_dake_pool_fd(const otr4_dake_pool_t *pool);
+
+otr4_err_t otr4_dake_pool_receive(otr4_dake_pool_t *pool, void *client_id,
+                                  const char *recipient, const char *message,
+                                  void *data);
+
+otr4_err_t otr4_dake_pool_send(otr4_dake_pool_t *pool, void *client_id,
+                               const char *recipient, const char *message,
+                               void *data);
+
+/* The next result, in completion order, or NULL if none is ready yet. */
+otr4_dake_result_t *otr4_dake_pool_next(otr4_dake_pool_t *pool);
+
+void otr4_dake_result_free(otr4_dake_result_t *result);
+
+#endif
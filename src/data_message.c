@@ -1,5 +1,6 @@
 #include <string.h>
 
+#include "b64.h"
 #include "constants.h"
 #include "data_message.h"
 #include "deserialize.h"
@@ -14,6 +15,8 @@ data_message_t *data_message_new() {
   ret->flags = 0;
   ret->enc_msg = NULL;
   ret->enc_msg_len = 0;
+  ret->body = NULL;
+  ret->body_len = 0;
 
   memset(ret->nonce, 0, sizeof ret->nonce);
   memset(ret->mac, 0, sizeof ret->mac);
@@ -33,6 +36,9 @@ void data_message_destroy(data_message_t *data_msg) {
   data_msg->enc_msg = NULL;
 
   sodium_memzero(data_msg->mac, sizeof data_msg->mac);
+
+  data_msg->body = NULL;
+  data_msg->body_len = 0;
 }
 
 void data_message_free(data_message_t *data_msg) {
@@ -44,13 +50,8 @@ void data_message_free(data_message_t *data_msg) {
   free(data_msg);
 }
 
-otr4_err_t data_message_body_asprintf(uint8_t **body, size_t *bodylen,
-                                      const data_message_t *data_msg) {
-  size_t s = DATA_MESSAGE_MIN_BYTES + DH_MPI_BYTES + 4 + data_msg->enc_msg_len;
-  uint8_t *dst = malloc(s);
-  if (!dst)
-    return OTR4_ERROR;
-
+static otr4_err_t serialize_data_message_header(uint8_t *dst, size_t *written,
+                                                const data_message_t *data_msg) {
   uint8_t *cursor = dst;
   cursor += serialize_uint16(cursor, OTR_VERSION);
   cursor += serialize_uint8(cursor, OTR_DATA_MSG_TYPE);
@@ -58,20 +59,37 @@ otr4_err_t data_message_body_asprintf(uint8_t **body, size_t *bodylen,
   cursor += serialize_uint32(cursor, data_msg->receiver_instance_tag);
   cursor += serialize_uint8(cursor, data_msg->flags);
   cursor += serialize_uint32(cursor, data_msg->message_id);
-  if (serialize_ec_point(cursor, data_msg->ecdh)) {
-    free(dst);
+  if (serialize_ec_point(cursor, data_msg->ecdh))
     return OTR4_ERROR;
-  }
+
   cursor += ED448_POINT_BYTES;
   // TODO: This could be NULL. We need to test.
   size_t len = 0;
-  if (serialize_dh_public_key(cursor, &len, data_msg->dh)) {
-    free(dst);
+  if (serialize_dh_public_key(cursor, &len, data_msg->dh))
     return OTR4_ERROR;
-  }
+
   cursor += len;
   cursor +=
       serialize_bytes_array(cursor, data_msg->nonce, DATA_MSG_NONCE_BYTES);
+
+  *written = cursor - dst;
+  return OTR4_SUCCESS;
+}
+
+otr4_err_t data_message_body_asprintf(uint8_t **body, size_t *bodylen,
+                                      const data_message_t *data_msg) {
+  size_t s = DATA_MESSAGE_MIN_BYTES + DH_MPI_BYTES + 4 + data_msg->enc_msg_len;
+  uint8_t *dst = malloc(s);
+  if (!dst)
+    return OTR4_ERROR;
+
+  size_t len = 0;
+  if (serialize_data_message_header(dst, &len, data_msg)) {
+    free(dst);
+    return OTR4_ERROR;
+  }
+
+  uint8_t *cursor = dst + len;
   cursor += serialize_data(cursor, data_msg->enc_msg, data_msg->enc_msg_len);
 
   if (body)
@@ -83,6 +101,98 @@ otr4_err_t data_message_body_asprintf(uint8_t **body, size_t *bodylen,
   return OTR4_SUCCESS;
 }
 
+static otr4_err_t data_message_serialized_len(size_t *len,
+                                              const data_message_t *data_msg,
+                                              size_t message_len,
+                                              size_t mac_keys_len) {
+  /* Asks gcrypt for the length only, which does not allocate */
+  size_t dh_len = 0;
+  if (dh_mpi_serialize(NULL, 0, &dh_len, data_msg->dh))
+    return OTR4_ERROR;
+
+  *len = DATA_MESSAGE_MIN_BYTES + 4 + dh_len + 4 + message_len +
+         DATA_MSG_MAC_BYTES + mac_keys_len;
+  return OTR4_SUCCESS;
+}
+
+size_t data_message_encoded_size(const data_message_t *data_msg,
+                                 size_t message_len, size_t mac_keys_len) {
+  size_t serlen = 0;
+  if (data_message_serialized_len(&serlen, data_msg, message_len,
+                                  mac_keys_len))
+    return 0;
+
+  return OTRL_B64_OTR_ENCODED_SIZE(serlen);
+}
+
+otr4_err_t data_message_encode_into(string_t dst, size_t dstlen,
+                                    const data_message_t *data_msg,
+                                    const uint8_t *message, size_t message_len,
+                                    const m_enc_key_t enc_key,
+                                    const m_mac_key_t mac_key,
+                                    const uint8_t *mac_keys,
+                                    size_t mac_keys_len) {
+  size_t serlen = 0;
+  if (data_message_serialized_len(&serlen, data_msg, message_len,
+                                  mac_keys_len))
+    return OTR4_ERROR;
+
+  size_t encoded_size = OTRL_B64_OTR_ENCODED_SIZE(serlen);
+  if (dstlen < encoded_size)
+    return OTR4_ERROR;
+
+  /* Serialize to the end of dst, and base64-encode it in place from there */
+  uint8_t *ser = (uint8_t *)dst + encoded_size - serlen;
+  uint8_t *cursor = ser;
+
+  size_t len = 0;
+  if (serialize_data_message_header(cursor, &len, data_msg))
+    return OTR4_ERROR;
+
+  cursor += len;
+  cursor += serialize_uint32(cursor, message_len);
+
+  // TODO: message is an UTF-8 string. Is there any problem to cast
+  // it to (unsigned char *)
+  if (crypto_stream_xor(cursor, message, message_len, data_msg->nonce,
+                        enc_key))
+    return OTR4_ERROR;
+
+  cursor += message_len;
+
+  shake_256_mac(cursor, DATA_MSG_MAC_BYTES, mac_key, sizeof(m_mac_key_t), ser,
+                cursor - ser);
+  cursor += DATA_MSG_MAC_BYTES;
+  serialize_bytes_array(cursor, mac_keys, mac_keys_len);
+
+  otrl_base64_otr_encode_into(dst, ser, serlen);
+
+  return OTR4_SUCCESS;
+}
+
+otr4_err_t data_message_encode(string_t *dst, const data_message_t *data_msg,
+                               const uint8_t *message, size_t message_len,
+                               const m_enc_key_t enc_key,
+                               const m_mac_key_t mac_key,
+                               const uint8_t *mac_keys, size_t mac_keys_len) {
+  size_t size = data_message_encoded_size(data_msg, message_len, mac_keys_len);
+  if (!size)
+    return OTR4_ERROR;
+
+  string_t encoded = malloc(size);
+  if (!encoded)
+    return OTR4_ERROR;
+
+  if (data_message_encode_into(encoded, size, data_msg, message, message_len,
+                               enc_key, mac_key, mac_keys, mac_keys_len)) {
+    free(encoded);
+    return OTR4_ERROR;
+  }
+
+  *dst = encoded;
+  return OTR4_SUCCESS;
+}
+
 otr4_err_t data_message_deserialize(data_message_t *dst, const uint8_t *buff,
                                     size_t bufflen) {
   const uint8_t *cursor = buff;
@@ -181,16 +291,24 @@ otr4_err_t data_message_deserialize(data_message_t *dst, const uint8_t *buff,
   cursor += read;
   len -= read;
 
+  dst->body = buff;
+  dst->body_len = cursor - buff;
+
   return deserialize_bytes_array((uint8_t *)&dst->mac, DATA_MSG_MAC_BYTES,
                                  cursor, len);
 }
 
 bool valid_data_message(m_mac_key_t mac_key, const data_message_t *data_msg) {
-  uint8_t *body = NULL;
-  size_t bodylen = 0;
+  uint8_t *serialized = NULL;
+  const uint8_t *body = data_msg->body;
+  size_t bodylen = data_msg->body_len;
 
-  if (data_message_body_asprintf(&body, &bodylen, data_msg)) {
-    return false;
+  /* A received message is authenticated over the bytes we received */
+  if (!body) {
+    if (data_message_body_asprintf(&serialized, &bodylen, data_msg))
+      return false;
+
+    body = serialized;
   }
 
   uint8_t mac_tag[DATA_MSG_MAC_BYTES];
@@ -199,7 +317,7 @@ bool valid_data_message(m_mac_key_t mac_key, const data_message_t *data_msg) {
   shake_256_mac(mac_tag, sizeof mac_tag, mac_key, sizeof(m_mac_key_t), body,
                 bodylen);
 
-  free(body);
+  free(serialized);
 
   /* Note that this is not a lexicographic comparator.
    Check: https://download.libsodium.org/doc/helpers/ */
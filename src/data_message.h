@@ -9,6 +9,7 @@
 #include "dh.h"
 #include "ed448.h"
 #include "key_management.h"
+#include "str.h"
 
 typedef struct {
   uint32_t sender_instance_tag;
@@ -21,6 +22,11 @@ typedef struct {
   uint8_t *enc_msg;
   size_t enc_msg_len;
   uint8_t mac[DATA_MSG_MAC_BYTES];
+
+  /* Authenticated bytes of a received message, pointing into the buffer
+   * given to data_message_deserialize. Only valid as long as that buffer. */
+  const uint8_t *body;
+  size_t body_len;
 } data_message_t;
 
 data_message_t *data_message_new();
@@ -32,6 +38,29 @@ void data_message_destroy(data_message_t *data_msg);
 otr4_err_t data_message_body_asprintf(uint8_t **body, size_t *bodylen,
                                       const data_message_t *data_msg);
 
+/* Size of the buffer data_message_encode_into needs, including the NUL.
+ * Returns 0 on error. */
+size_t data_message_encoded_size(const data_message_t *data_msg,
+                                 size_t message_len, size_t mac_keys_len);
+
+/* Encrypts message, MACs the message and appends the revealed mac_keys,
+ * writing the base64 "?OTR:...." encoding straight into dst. Does not
+ * allocate. */
+otr4_err_t data_message_encode_into(string_t dst, size_t dstlen,
+                                    const data_message_t *data_msg,
+                                    const uint8_t *message, size_t message_len,
+                                    const m_enc_key_t enc_key,
+                                    const m_mac_key_t mac_key,
+                                    const uint8_t *mac_keys,
+                                    size_t mac_keys_len);
+
+/* Same as data_message_encode_into, into a single new allocation. */
+otr4_err_t data_message_encode(string_t *dst, const data_message_t *data_msg,
+                               const uint8_t *message, size_t message_len,
+                               const m_enc_key_t enc_key,
+                               const m_mac_key_t mac_key,
+                               const uint8_t *mac_keys, size_t mac_keys_len);
+
 otr4_err_t data_message_deserialize(data_message_t *data_msg,
                                     const uint8_t *buff, size_t bufflen);
 
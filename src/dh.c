@@ -1,3 +1,9 @@
+#include <pthread.h>
+#include <sodium.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "dh.h"
 #include "random.h"
 
@@ -25,13 +31,81 @@ static gcry_mpi_t DH3072_MODULUS_MINUS_2 = NULL;
 static const char *DH3072_GENERATOR_S = "0x02";
 static gcry_mpi_t DH3072_GENERATOR = NULL;
 
+/* The tables above are written only by dh_init and dh_free, under this
+ * lock, and are read-only in between. */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 static int dh_initialized = 0;
 
+/* Fixed-base table for the generator: FIXED_BASE[i][d] = g^(d*2^(w*i)) mod p,
+ * with w = FIXED_BASE_WINDOW_BITS, covering DH_KEY_SIZE-byte exponents. The
+ * entries are big-endian and DH3072_MOD_LEN_BYTES long, so they can be
+ * selected without branching on the digit. NULL if it could not be built. */
+#define FIXED_BASE_WINDOW_BITS 4
+#define FIXED_BASE_DIGITS (1 << FIXED_BASE_WINDOW_BITS)
+#define FIXED_BASE_WINDOWS                                                     \
+  ((DH_KEY_SIZE * 8 + FIXED_BASE_WINDOW_BITS - 1) / FIXED_BASE_WINDOW_BITS)
+
+typedef uint8_t fixed_base_entry_t[DH3072_MOD_LEN_BYTES];
+static fixed_base_entry_t (*FIXED_BASE)[FIXED_BASE_DIGITS] = NULL;
+
+/* Keypairs generated ahead of time by a background worker. The worker fills
+ * the pool up to high_watermark and goes to sleep until consumers bring it
+ * down to low_watermark. */
+typedef struct {
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t refill;
+  dh_keypair_t *keypairs;
+  size_t count;
+  size_t low_watermark;
+  size_t high_watermark;
+  bool running;
+} dh_keypair_pool_t;
+
+static dh_keypair_pool_t pool[1] = {{
+    .lock = PTHREAD_MUTEX_INITIALIZER, .refill = PTHREAD_COND_INITIALIZER,
+}};
+
+static otr4_err_t print_fixed_base_entry(fixed_base_entry_t entry,
+                                         const gcry_mpi_t value) {
+  size_t written = 0;
+  if (gcry_mpi_print(GCRYMPI_FMT_USG, entry, sizeof(fixed_base_entry_t),
+                     &written, value))
+    return OTR4_ERROR;
+
+  /* Right-align it */
+  memmove(entry + sizeof(fixed_base_entry_t) - written, entry, written);
+  memset(entry, 0, sizeof(fixed_base_entry_t) - written);
+  return OTR4_SUCCESS;
+}
+
+static otr4_err_t build_fixed_base(void) {
+  otr4_err_t err = OTR4_SUCCESS;
+  gcry_mpi_t base = gcry_mpi_copy(DH3072_GENERATOR);
+  gcry_mpi_t entry = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+
+  for (int i = 0; i < FIXED_BASE_WINDOWS && !err; i++) {
+    gcry_mpi_set_ui(entry, 1);
+    for (int d = 0; d < FIXED_BASE_DIGITS && !err; d++) {
+      err = print_fixed_base_entry(FIXED_BASE[i][d], entry);
+      gcry_mpi_mulm(entry, entry, base, DH3072_MODULUS);
+    }
+
+    /* entry is now base^FIXED_BASE_DIGITS, the next window's base */
+    gcry_mpi_swap(base, entry);
+  }
+
+  gcry_mpi_release(base);
+  gcry_mpi_release(entry);
+  return err;
+}
+
 void dh_init(void) {
-  if (dh_initialized)
+  pthread_mutex_lock(&init_lock);
+  if (dh_initialized) {
+    pthread_mutex_unlock(&init_lock);
     return;
-
-  dh_initialized = 1;
+  }
 
   gcry_mpi_scan(&DH3072_MODULUS, GCRYMPI_FMT_HEX,
                 (const unsigned char *)DH3072_MODULUS_S, 0, NULL);
@@ -41,9 +115,22 @@ void dh_init(void) {
 
   DH3072_MODULUS_MINUS_2 = gcry_mpi_new(DH3072_MOD_LEN_BITS);
   gcry_mpi_sub_ui(DH3072_MODULUS_MINUS_2, DH3072_MODULUS, 2);
+
+  FIXED_BASE = malloc(FIXED_BASE_WINDOWS * sizeof(*FIXED_BASE));
+  if (FIXED_BASE && build_fixed_base()) {
+    free(FIXED_BASE);
+    FIXED_BASE = NULL;
+  }
+
+  dh_initialized = 1;
+  pthread_mutex_unlock(&init_lock);
 }
 
 void dh_free(void) {
+  dh_keypair_pool_stop();
+
+  pthread_mutex_lock(&init_lock);
+
   gcry_mpi_release(DH3072_MODULUS);
   DH3072_MODULUS = NULL;
 
@@ -53,10 +140,80 @@ void dh_free(void) {
   gcry_mpi_release(DH3072_MODULUS_MINUS_2);
   DH3072_MODULUS_MINUS_2 = NULL;
 
+  free(FIXED_BASE);
+  FIXED_BASE = NULL;
+
   dh_initialized = 0;
+  pthread_mutex_unlock(&init_lock);
 }
 
-otr4_err_t dh_keypair_generate(dh_keypair_t keypair) {
+static unsigned int exponent_window(const uint8_t *exp, size_t exp_len,
+                                    int window) {
+  unsigned int digit = 0;
+  for (int j = FIXED_BASE_WINDOW_BITS - 1; j >= 0; j--) {
+    size_t bit = window * FIXED_BASE_WINDOW_BITS + j;
+    if (bit >= exp_len * 8)
+      continue;
+
+    digit = (digit << 1) | ((exp[exp_len - 1 - bit / 8] >> (bit % 8)) & 1);
+  }
+
+  return digit;
+}
+
+/* Copies FIXED_BASE[window][digit] into dst, reading every entry of the
+ * window so that neither timing nor memory access depend on the digit. */
+static void select_fixed_base_entry(fixed_base_entry_t dst, int window,
+                                    unsigned int digit) {
+  memset(dst, 0, sizeof(fixed_base_entry_t));
+  for (unsigned int d = 0; d < FIXED_BASE_DIGITS; d++) {
+    /* All ones when d == digit, zero otherwise */
+    uint8_t mask = ((((d ^ digit) - 1) >> 8) & 0xff);
+    for (size_t k = 0; k < sizeof(fixed_base_entry_t); k++)
+      dst[k] |= FIXED_BASE[window][d][k] & mask;
+  }
+}
+
+/* Computes g^exp mod p for a big-endian exponent of at most DH_KEY_SIZE bytes
+ * using the precomputed table (the fixed-base windowing method of Brickell,
+ * Gordon, McCurley and Wilson). It does one multiplication per window,
+ * including for zero digits, and no squarings, against the ~640 squarings of
+ * a generic exponentiation.
+ *
+ * Only the table lookup is constant time. Scanning the selected entry and
+ * multiplying by it go through gcrypt's MPIs, whose timing may depend on
+ * the entry's value, as it does for the exponent in gcry_mpi_powm. */
+static otr4_err_t fixed_base_powm(gcry_mpi_t dst, const uint8_t *exp,
+                                  size_t exp_len) {
+  fixed_base_entry_t selected;
+  gcry_mpi_t acc = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  gcry_mpi_t factor = NULL;
+  otr4_err_t err = OTR4_SUCCESS;
+
+  gcry_mpi_set_ui(acc, 1);
+  for (int i = 0; i < FIXED_BASE_WINDOWS && !err; i++) {
+    unsigned int digit = exponent_window(exp, exp_len, i);
+    select_fixed_base_entry(selected, i, digit);
+
+    if (gcry_mpi_scan(&factor, GCRYMPI_FMT_USG, selected, sizeof(selected),
+                      NULL)) {
+      err = OTR4_ERROR;
+      continue;
+    }
+
+    gcry_mpi_mulm(acc, acc, factor, DH3072_MODULUS);
+    gcry_mpi_release(factor);
+    factor = NULL;
+  }
+
+  gcry_mpi_set(dst, acc);
+  gcry_mpi_release(acc);
+  sodium_memzero(selected, sizeof(selected));
+
+  return err;
+}
+
+static otr4_err_t generate_keypair(dh_keypair_t keypair) {
   uint8_t *secbuf = malloc(DH_KEY_SIZE);
   if (secbuf == NULL) {
     return OTR4_ERROR;
@@ -65,18 +222,164 @@ otr4_err_t dh_keypair_generate(dh_keypair_t keypair) {
   random_bytes(secbuf, DH_KEY_SIZE);
   gcry_error_t err =
       gcry_mpi_scan(&keypair->priv, GCRYMPI_FMT_USG, secbuf, DH_KEY_SIZE, NULL);
-  free(secbuf);
 
   if (err) {
+    free(secbuf);
     return OTR4_ERROR;
   }
 
   keypair->pub = gcry_mpi_new(DH3072_MOD_LEN_BITS);
-  gcry_mpi_powm(keypair->pub, DH3072_GENERATOR, keypair->priv, DH3072_MODULUS);
+  otr4_err_t ret = OTR4_SUCCESS;
+  if (FIXED_BASE)
+    ret = fixed_base_powm(keypair->pub, secbuf, DH_KEY_SIZE);
+  else
+    gcry_mpi_powm(keypair->pub, DH3072_GENERATOR, keypair->priv,
+                  DH3072_MODULUS);
+
+  sodium_memzero(secbuf, DH_KEY_SIZE);
+  free(secbuf);
+
+  if (ret)
+    dh_keypair_destroy(keypair);
+
+  return ret;
+}
+
+static bool take_from_pool(dh_keypair_t keypair) {
+  bool taken = false;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count > 0) {
+    pool->count--;
+    keypair->priv = pool->keypairs[pool->count]->priv;
+    keypair->pub = pool->keypairs[pool->count]->pub;
+    pool->keypairs[pool->count]->priv = NULL;
+    pool->keypairs[pool->count]->pub = NULL;
+    taken = true;
+  }
+
+  if (pool->running && pool->count <= pool->low_watermark)
+    pthread_cond_signal(&pool->refill);
+  pthread_mutex_unlock(&pool->lock);
+
+  return taken;
+}
+
+otr4_err_t dh_keypair_generate(dh_keypair_t keypair) {
+  /* Never wait for the worker: if the pool is empty, pay for it now. */
+  if (take_from_pool(keypair))
+    return OTR4_SUCCESS;
+
+  return generate_keypair(keypair);
+}
+
+/* Seconds to wait before trying again when generating a keypair fails */
+#define POOL_RETRY_SECONDS 1
+
+static void *refill_pool(void *unused) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running) {
+    if (pool->count >= pool->high_watermark) {
+      while (pool->running && pool->count > pool->low_watermark)
+        pthread_cond_wait(&pool->refill, &pool->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    dh_keypair_t keypair;
+    otr4_err_t err = generate_keypair(keypair);
+    pthread_mutex_lock(&pool->lock);
+
+    /* Keep the pool alive, and try again later */
+    if (err) {
+      struct timespec retry_at = {.tv_sec = time(NULL) + POOL_RETRY_SECONDS};
+      if (pool->running)
+        pthread_cond_timedwait(&pool->refill, &pool->lock, &retry_at);
+      continue;
+    }
+
+    if (!pool->running || pool->count >= pool->high_watermark) {
+      dh_keypair_destroy(keypair);
+      continue;
+    }
+
+    pool->keypairs[pool->count]->priv = keypair->priv;
+    pool->keypairs[pool->count]->pub = keypair->pub;
+    pool->count++;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+otr4_err_t dh_keypair_pool_start(size_t low_watermark, size_t high_watermark) {
+  pthread_mutex_lock(&init_lock);
+  int initialized = dh_initialized;
+  pthread_mutex_unlock(&init_lock);
+
+  if (!initialized || high_watermark == 0 || low_watermark >= high_watermark)
+    return OTR4_ERROR;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->running || pool->keypairs) {
+    pthread_mutex_unlock(&pool->lock);
+    return OTR4_ERROR;
+  }
+
+  pool->keypairs = calloc(high_watermark, sizeof(dh_keypair_t));
+  if (!pool->keypairs) {
+    pthread_mutex_unlock(&pool->lock);
+    return OTR4_ERROR;
+  }
+
+  pool->count = 0;
+  pool->low_watermark = low_watermark;
+  pool->high_watermark = high_watermark;
+  pool->running = true;
+
+  if (pthread_create(&pool->worker, NULL, refill_pool, NULL)) {
+    pool->running = false;
+    free(pool->keypairs);
+    pool->keypairs = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return OTR4_ERROR;
+  }
+  pthread_mutex_unlock(&pool->lock);
 
   return OTR4_SUCCESS;
 }
 
+void dh_keypair_pool_stop(void) {
+  pthread_mutex_lock(&pool->lock);
+  if (!pool->running) {
+    pthread_mutex_unlock(&pool->lock);
+    return;
+  }
+
+  pool->running = false;
+  pthread_cond_signal(&pool->refill);
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_join(pool->worker, NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  for (size_t i = 0; i < pool->count; i++)
+    dh_keypair_destroy(pool->keypairs[i]);
+
+  free(pool->keypairs);
+  pool->keypairs = NULL;
+  pool->count = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+size_t dh_keypair_pool_available(void) {
+  pthread_mutex_lock(&pool->lock);
+  size_t count = pool->count;
+  pthread_mutex_unlock(&pool->lock);
+
+  return count;
+}
+
 void dh_pub_key_destroy(dh_keypair_t keypair) {
   gcry_mpi_release(keypair->pub);
   keypair->pub = NULL;
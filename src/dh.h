@@ -20,6 +20,8 @@ typedef struct {
   dh_private_key_t pub;
 } dh_keypair_t[1];
 
+/* Both may be called from any thread, but dh_free must not run while other
+ * threads still use DH keys. */
 void dh_init(void);
 
 void dh_free(void);
@@ -30,6 +32,16 @@ static inline dh_mpi_t dh_mpi_new() {
 
 otr4_err_t dh_keypair_generate(dh_keypair_t keypair);
 
+/* Opt-in pool of precomputed keypairs. Once started, dh_keypair_generate
+ * takes keypairs from the pool and only computes one inline when the pool is
+ * empty. A background thread refills the pool up to high_watermark whenever
+ * it drops to low_watermark. The pool is stopped by dh_free. */
+otr4_err_t dh_keypair_pool_start(size_t low_watermark, size_t high_watermark);
+
+void dh_keypair_pool_stop(void);
+
+size_t dh_keypair_pool_available(void);
+
 void dh_pub_key_destroy(dh_keypair_t keypair);
 
 void dh_priv_key_destroy(dh_keypair_t keypair);
@@ -5,7 +5,9 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define FRAGMENT_FORMAT "?OTR|%08x|%08x,%05x,%05x,%s,"
+#include "random.h"
+
+#define FRAGMENT_FORMAT "?OTR|%08x|%08x|%08x,%05x,%05x,"
 
 otr4_message_to_send_t *otr4_message_new() {
   otr4_message_to_send_t *msg = malloc(sizeof(otr4_message_to_send_t));
@@ -22,10 +24,7 @@ void otr4_message_free(otr4_message_to_send_t *message) {
   if (!message)
     return;
 
-  int i;
-  for (i = 0; i < message->total; i++)
-    free(message->pieces[i]);
-
+  /* The pieces live in the same allocation as their index */
   free(message->pieces);
   message->pieces = NULL;
 
@@ -36,21 +35,42 @@ void otr4_message_free(otr4_message_to_send_t *message) {
 
 fragment_context_t *fragment_context_new(void) {
   fragment_context_t *context = malloc(sizeof(fragment_context_t));
-  context->N = 0;
-  context->K = 0;
-  context->fragment = otrv4_strdup("");
-  context->fragment_len = 0;
+  if (!context)
+    return NULL;
+
+  memset(context->slots, 0, sizeof context->slots);
+  context->count = 0;
+  context->buffered = 0;
   context->status = OTR4_FRAGMENT_UNFRAGMENTED;
 
   return context;
 }
 
+static void forget_slot(fragment_context_t *context, int i) {
+  fragment_slot_t *slot = &context->slots[i];
+  for (unsigned int k = 0; k < slot->N; k++)
+    free(slot->pieces[k]);
+
+  free(slot->pieces);
+  free(slot->received);
+  context->buffered -= slot->buffered;
+  context->count--;
+
+  /* Keep the slots in use at the front */
+  if (i != context->count)
+    context->slots[i] = context->slots[context->count];
+
+  memset(&context->slots[context->count], 0, sizeof(fragment_slot_t));
+}
+
 void fragment_context_free(fragment_context_t *context) {
-  context->N = 0;
-  context->K = 0;
+  if (!context)
+    return;
+
+  while (context->count > 0)
+    forget_slot(context, context->count - 1);
+
   context->status = OTR4_FRAGMENT_UNFRAGMENTED;
-  free(context->fragment);
-  context->fragment = NULL;
   free(context);
 }
 
@@ -58,114 +78,176 @@ otr4_err_t otr4_fragment_message(int max_size,
                                  otr4_message_to_send_t *fragments,
                                  int our_instance, int their_instance,
                                  const string_t message) {
+  if (max_size <= FRAGMENT_HEADER_LEN)
+    return OTR4_ERROR;
+
   size_t msg_len = strlen(message);
   size_t limit_piece = max_size - FRAGMENT_HEADER_LEN;
-  string_t *pieces;
-  int piece_len = 0;
-
-  fragments->total = ((msg_len - 1) / (max_size - FRAGMENT_HEADER_LEN)) + 1;
-  if (fragments->total > 65535)
+  size_t total = msg_len ? (msg_len + limit_piece - 1) / limit_piece : 1;
+  if (total > 65535)
     return OTR4_ERROR;
 
-  size_t pieces_len = fragments->total * sizeof(string_t);
-  pieces = malloc(pieces_len);
+  /* The pieces index, followed by every fragment. Each one has its piece
+   * between a header and a ",", and a NUL: FRAGMENT_HEADER_LEN bytes on
+   * top of the piece. */
+  size_t index_len = total * sizeof(string_t);
+  size_t arena_len = total * FRAGMENT_HEADER_LEN + msg_len;
+  string_t *pieces = malloc(index_len + arena_len);
   if (!pieces)
     return OTR4_ERROR;
 
-  int current_frag;
-  for (current_frag = 1; current_frag <= fragments->total; current_frag++) {
-    int index_len = 0;
-    string_t piece = NULL;
-    string_t piece_data = NULL;
+  uint32_t identifier;
+  random_bytes(&identifier, sizeof identifier);
 
-    if (msg_len - index_len < limit_piece)
-      piece_len = msg_len - index_len;
-    else
+  char *cursor = (char *)(pieces + total);
+  const char *piece_data = message;
+  for (size_t k = 0; k < total; k++) {
+    size_t piece_len = msg_len - (piece_data - message);
+    if (piece_len > limit_piece)
       piece_len = limit_piece;
 
-    piece_data = malloc(piece_len + 1);
-    if (!piece_data) {
-      int i;
-      for (i = 0; i < fragments->total; i++) {
-        free(pieces[i]);
-      }
-
-      free(pieces);
-      pieces = NULL;
-      return OTR4_ERROR;
-    }
-
-    strncpy(piece_data, message, piece_len);
-    piece_data[piece_len] = 0;
-
-    piece = malloc(piece_len + FRAGMENT_HEADER_LEN + 1);
-    if (!piece) {
-      int i;
-      for (i = 0; i < fragments->total; i++) {
-        free(pieces[i]);
-      }
-
-      free(piece_data);
-      free(pieces);
-      pieces = NULL;
-
-      return OTR4_ERROR;
-    }
-
-    snprintf(piece, piece_len + FRAGMENT_HEADER_LEN, FRAGMENT_FORMAT,
-             our_instance, their_instance, current_frag, fragments->total,
-             piece_data);
-    piece[piece_len + FRAGMENT_HEADER_LEN] = 0;
-
-    pieces[current_frag - 1] = piece;
-
-    free(piece_data);
-    index_len += piece_len;
-    message += piece_len;
+    pieces[k] = cursor;
+    cursor += snprintf(cursor, FRAGMENT_HEADER_LEN - 1, FRAGMENT_FORMAT,
+                       identifier, our_instance, their_instance, (int)k + 1,
+                       (int)total);
+    memcpy(cursor, piece_data, piece_len);
+    cursor += piece_len;
+    piece_data += piece_len;
+    *cursor++ = ',';
+    *cursor++ = '\0';
   }
 
   fragments->pieces = pieces;
+  fragments->total = total;
 
   return OTR4_SUCCESS;
 }
 
-static void initialize_fragment_context(fragment_context_t *context) {
-  free(context->fragment);
-  context->fragment = otrv4_strdup("");
-  context->fragment_len = 0;
+static void forget_stale_slots(fragment_context_t *context, time_t now) {
+  /* Backwards, as forgetting a slot moves the last one into its place */
+  for (int i = context->count - 1; i >= 0; i--)
+    if (now - context->slots[i].last_seen > FRAGMENT_TIMEOUT)
+      forget_slot(context, i);
+}
 
-  context->N = 0;
-  context->K = 0;
-  context->status = OTR4_FRAGMENT_UNFRAGMENTED;
+static int find_slot(const fragment_context_t *context, uint32_t sender_tag,
+                     uint32_t identifier) {
+  for (int i = 0; i < context->count; i++)
+    if (context->slots[i].sender_tag == sender_tag &&
+        context->slots[i].identifier == identifier)
+      return i;
+
+  return -1;
+}
+
+static int oldest_slot(const fragment_context_t *context, int except) {
+  int oldest = -1;
+  for (int i = 0; i < context->count; i++) {
+    if (i == except)
+      continue;
+
+    if (oldest < 0 ||
+        context->slots[i].last_seen < context->slots[oldest].last_seen)
+      oldest = i;
+  }
+
+  return oldest;
+}
+
+/* Forgets the least recently seen messages, other than *keep, until len
+ * more bytes fit. */
+static bool make_room(fragment_context_t *context, size_t len, int *keep) {
+  while (context->buffered + len > FRAGMENT_MAX_BUFFERED) {
+    int oldest = oldest_slot(context, *keep);
+    if (oldest < 0)
+      return false;
+
+    forget_slot(context, oldest);
+    if (*keep == context->count)
+      *keep = oldest;
+  }
+
+  return true;
+}
+
+static int new_slot(fragment_context_t *context, uint32_t sender_tag,
+                    uint32_t identifier, unsigned int n, time_t now) {
+  size_t bitmap_len = (n + 31) / 32 * sizeof(uint32_t);
+  size_t bookkeeping = n * sizeof(string_t) + bitmap_len;
+  if (bookkeeping > FRAGMENT_MAX_BUFFERED)
+    return -1;
+
+  int none = -1;
+  if (context->count == FRAGMENT_MAX_PENDING)
+    forget_slot(context, oldest_slot(context, none));
+
+  if (!make_room(context, bookkeeping, &none))
+    return -1;
+
+  fragment_slot_t *slot = &context->slots[context->count];
+  slot->pieces = calloc(n, sizeof(string_t));
+  slot->received = calloc(1, bitmap_len);
+  if (!slot->pieces || !slot->received) {
+    free(slot->pieces);
+    free(slot->received);
+    slot->pieces = NULL;
+    slot->received = NULL;
+    return -1;
+  }
+
+  slot->sender_tag = sender_tag;
+  slot->identifier = identifier;
+  slot->N = n;
+  slot->K = 0;
+  slot->buffered = bookkeeping;
+  slot->last_seen = now;
+  context->buffered += bookkeeping;
+
+  return context->count++;
 }
 
-static otr4_err_t add_first_fragment(const char *msg, int msg_len,
-                                     fragment_context_t *ctx) {
-  char *buff = malloc(msg_len + 1);
-  if (!buff)
+static otr4_err_t add_fragment(fragment_context_t *context, int i,
+                               unsigned int k, const char *msg,
+                               size_t msg_len) {
+  fragment_slot_t *slot = &context->slots[i];
+  uint32_t bit = 1u << ((k - 1) % 32);
+
+  /* A repeated fragment changes nothing */
+  if (slot->received[(k - 1) / 32] & bit)
+    return OTR4_SUCCESS;
+
+  string_t piece = otrv4_strndup(msg, msg_len);
+  if (!piece)
     return OTR4_ERROR;
 
-  memmove(buff, msg, msg_len);
-  buff[msg_len] = '\0';
-  ctx->fragment_len += msg_len;
-  free(ctx->fragment);
-  ctx->fragment = buff;
+  slot->pieces[k - 1] = piece;
+  slot->received[(k - 1) / 32] |= bit;
+  slot->K++;
+  slot->buffered += msg_len;
+  context->buffered += msg_len;
 
   return OTR4_SUCCESS;
 }
 
-static otr4_err_t append_fragment(const char *msg, int msg_len,
-                                  fragment_context_t *ctx) {
-  size_t new_buff_len = ctx->fragment_len + msg_len + 1;
-  char *buff = realloc(ctx->fragment, new_buff_len);
-  if (!buff)
+static otr4_err_t join_fragments(char **unfrag_msg,
+                                 const fragment_slot_t *slot) {
+  size_t len = 0;
+  for (unsigned int k = 0; k < slot->N; k++)
+    len += strlen(slot->pieces[k]);
+
+  char *joined = malloc(len + 1);
+  if (!joined)
     return OTR4_ERROR;
 
-  memmove(buff + ctx->fragment_len, msg, msg_len);
-  ctx->fragment_len += msg_len;
-  buff[ctx->fragment_len] = '\0';
-  ctx->fragment = buff;
+  char *cursor = joined;
+  for (unsigned int k = 0; k < slot->N; k++) {
+    size_t piece_len = strlen(slot->pieces[k]);
+    memcpy(cursor, slot->pieces[k], piece_len);
+    cursor += piece_len;
+  }
+  *cursor = '\0';
 
+  *unfrag_msg = joined;
   return OTR4_SUCCESS;
 }
 
@@ -179,57 +261,60 @@ otr4_err_t otr4_unfragment_message(char **unfrag_msg,
                                    const int our_instance_tag) {
   if (!is_fragment(message)) {
     *unfrag_msg = otrv4_strdup(message);
-    initialize_fragment_context(context);
+    context->status = OTR4_FRAGMENT_UNFRAGMENTED;
     return OTR4_SUCCESS;
   }
 
-  int sender_tag = 0, receiver_tag = 0, start = 0, end = 0;
-  int k = 0, n = 0;
+  unsigned int identifier = 0, sender_tag = 0, receiver_tag = 0;
+  int start = 0, end = 0;
+  unsigned int k = 0, n = 0;
   context->status = OTR4_FRAGMENT_INCOMPLETE;
 
-  const string_t format = "?OTR|%08x|%08x,%05x,%05x,%n%*[^,],%n";
-  sscanf(message, format, &sender_tag, &receiver_tag, &k, &n, &start, &end);
+  const string_t format = "?OTR|%08x|%08x|%08x,%05x,%05x,%n%*[^,],%n";
+  sscanf(message, format, &identifier, &sender_tag, &receiver_tag, &k, &n,
+         &start, &end);
 
   if (our_instance_tag != receiver_tag && 0 != receiver_tag) {
     context->status = OTR4_FRAGMENT_COMPLETE;
     return OTR4_ERROR;
   }
 
-  if (k == 0 || n == 0 || k > n) {
-    initialize_fragment_context(context);
-    return OTR4_SUCCESS;
-  }
-
-  int msg_len = end - start - 1;
-  if (end <= start)
+  if (k == 0 || n == 0 || k > n || end <= start)
     return OTR4_ERROR;
 
-  otr4_err_t err;
-  if (k == 1) {
-    err = add_first_fragment(message + start, msg_len, context);
-    if (err != OTR4_SUCCESS)
-      return err;
+  size_t msg_len = end - start - 1;
+  time_t now = time(NULL);
+  forget_stale_slots(context, now);
 
-    context->N = n;
-    context->K = k;
+  /* A different number of pieces means a different message */
+  int i = find_slot(context, sender_tag, identifier);
+  if (i >= 0 && context->slots[i].N != n) {
+    forget_slot(context, i);
+    i = -1;
+  }
 
-  } else {
-    if (n == context->N && k == context->K + 1) {
-      err = append_fragment(message + start, msg_len, context);
-      if (err != OTR4_SUCCESS)
-        return err;
+  if (i < 0)
+    i = new_slot(context, sender_tag, identifier, n, now);
 
-      context->K = k;
-    } else
-      initialize_fragment_context(context);
-  }
+  if (i < 0)
+    return OTR4_ERROR;
 
-  if (context->N == context->K) {
-    *unfrag_msg = otrv4_strdup(context->fragment);
-    free(context->fragment);
-    context->fragment = NULL;
-    context->status = OTR4_FRAGMENT_COMPLETE;
+  if (!make_room(context, msg_len, &i) ||
+      add_fragment(context, i, k, message + start, msg_len)) {
+    forget_slot(context, i);
+    return OTR4_ERROR;
   }
 
+  fragment_slot_t *slot = &context->slots[i];
+  slot->last_seen = now;
+  if (slot->K < slot->N)
+    return OTR4_SUCCESS;
+
+  otr4_err_t err = join_fragments(unfrag_msg, slot);
+  forget_slot(context, i);
+  if (err)
+    return err;
+
+  context->status = OTR4_FRAGMENT_COMPLETE;
   return OTR4_SUCCESS;
 }
@@ -1,10 +1,20 @@
 #ifndef FRAGMENT_H
 #define FRAGMENT_H
 
+#include <stdint.h>
+#include <time.h>
+
 #include "error.h"
 #include "str.h"
 
-#define FRAGMENT_HEADER_LEN 37
+/* Bytes a fragment adds to its piece: header, trailing "," and NUL */
+#define FRAGMENT_HEADER_LEN 46
+
+/* Messages being reassembled at once, bytes they may hold in total, and
+ * seconds a partial message waits for its next fragment */
+#define FRAGMENT_MAX_PENDING 8
+#define FRAGMENT_MAX_BUFFERED (1024 * 1024)
+#define FRAGMENT_TIMEOUT 120
 
 typedef struct {
   string_t *pieces;
@@ -17,10 +27,22 @@ typedef enum {
   OTR4_FRAGMENT_COMPLETE
 } fragment_status;
 
+/* A partially received message, with a bit set in received for every
+ * piece it has so far */
+typedef struct {
+  uint32_t sender_tag;
+  uint32_t identifier;
+  unsigned int N, K;
+  string_t *pieces;
+  uint32_t *received;
+  size_t buffered;
+  time_t last_seen;
+} fragment_slot_t;
+
 typedef struct {
-  unsigned int K, N;
-  string_t fragment;
-  size_t fragment_len;
+  fragment_slot_t slots[FRAGMENT_MAX_PENDING];
+  int count;
+  size_t buffered;
   fragment_status status;
 } fragment_context_t;
 
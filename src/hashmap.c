@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <sodium.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+
+#define INITIAL_CAPACITY 16
+
+hashmap_t *hashmap_new(hashmap_hash_fn hash, hashmap_eq_fn eq) {
+  hashmap_t *map = malloc(sizeof(hashmap_t));
+  if (!map)
+    return NULL;
+
+  map->entries = calloc(INITIAL_CAPACITY, sizeof(hashmap_entry_t));
+  if (!map->entries) {
+    free(map);
+    return NULL;
+  }
+
+  map->capacity = INITIAL_CAPACITY;
+  map->count = 0;
+  map->hash = hash;
+  map->eq = eq;
+
+  return map;
+}
+
+void hashmap_free(hashmap_t *map) {
+  if (!map)
+    return;
+
+  free(map->entries);
+  map->entries = NULL;
+  map->capacity = 0;
+  map->count = 0;
+
+  free(map);
+}
+
+/* Index of key's entry, or of the free entry where it would go */
+static size_t find_entry(const hashmap_t *map, const void *key, size_t hash) {
+  size_t mask = map->capacity - 1;
+  size_t i = hash & mask;
+
+  while (map->entries[i].value) {
+    if (map->entries[i].hash == hash && map->eq(map->entries[i].key, key))
+      return i;
+
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+static otr4_err_t grow(hashmap_t *map) {
+  size_t capacity = map->capacity * 2;
+  hashmap_entry_t *entries = calloc(capacity, sizeof(hashmap_entry_t));
+  if (!entries)
+    return OTR4_ERROR;
+
+  for (size_t j = 0; j < map->capacity; j++) {
+    const hashmap_entry_t *entry = &map->entries[j];
+    if (!entry->value)
+      continue;
+
+    size_t i = entry->hash & (capacity - 1);
+    while (entries[i].value)
+      i = (i + 1) & (capacity - 1);
+
+    entries[i] = *entry;
+  }
+
+  free(map->entries);
+  map->entries = entries;
+  map->capacity = capacity;
+
+  return OTR4_SUCCESS;
+}
+
+void *hashmap_get(const hashmap_t *map, const void *key) {
+  size_t i = find_entry(map, key, map->hash(key));
+  return map->entries[i].value;
+}
+
+otr4_err_t hashmap_put(hashmap_t *map, const void *key, void *value) {
+  if (!value)
+    return OTR4_ERROR;
+
+  /* Keep at most 3/4 of the entries in use */
+  if (4 * (map->count + 1) > 3 * map->capacity && grow(map))
+    return OTR4_ERROR;
+
+  size_t hash = map->hash(key);
+  size_t i = find_entry(map, key, hash);
+  if (!map->entries[i].value)
+    map->count++;
+
+  map->entries[i].key = key;
+  map->entries[i].value = value;
+  map->entries[i].hash = hash;
+
+  return OTR4_SUCCESS;
+}
+
+void *hashmap_remove(hashmap_t *map, const void *key) {
+  size_t mask = map->capacity - 1;
+  size_t i = find_entry(map, key, map->hash(key));
+  if (!map->entries[i].value)
+    return NULL;
+
+  void *value = map->entries[i].value;
+  map->count--;
+
+  /* Shift back the entries after it that would not be found past the
+   * hole, so no tombstones are needed */
+  size_t j = i;
+  for (;;) {
+    map->entries[i].key = NULL;
+    map->entries[i].value = NULL;
+
+    do {
+      j = (j + 1) & mask;
+      if (!map->entries[j].value)
+        return value;
+    } while (((j - (map->entries[j].hash & mask)) & mask) <
+             ((j - i) & mask));
+
+    map->entries[i] = map->entries[j];
+    i = j;
+  }
+}
+
+size_t hashmap_pointer_hash(const void *key) {
+  uintptr_t pointer = (uintptr_t)key;
+  return hashmap_hash_bytes(HASHMAP_HASH_INIT, &pointer, sizeof pointer);
+}
+
+int hashmap_pointer_eq(const void *a, const void *b) { return a == b; }
+
+/* Random for each process, so that peers choosing recipient names can not
+ * make them collide on purpose */
+static unsigned char hash_key[crypto_shorthash_KEYBYTES];
+static pthread_once_t hash_key_once = PTHREAD_ONCE_INIT;
+
+static void generate_hash_key(void) {
+  /* Can be called more than once, and must be before randombytes_buf */
+  if (sodium_init() < 0)
+    abort();
+
+  randombytes_buf(hash_key, sizeof hash_key);
+}
+
+size_t hashmap_hash_bytes(size_t hash, const void *data, size_t len) {
+  pthread_once(&hash_key_once, generate_hash_key);
+
+  /* Chains by keying each call with the previous hash */
+  unsigned char key[crypto_shorthash_KEYBYTES];
+  memcpy(key, hash_key, sizeof key);
+  for (size_t i = 0; i < sizeof hash; i++)
+    key[i] ^= (unsigned char)(hash >> (8 * i));
+
+  unsigned char out[crypto_shorthash_BYTES];
+  crypto_shorthash(out, data, len, key);
+
+  uint64_t result = 0;
+  for (size_t i = 0; i < sizeof out; i++)
+    result |= (uint64_t)out[i] << (8 * i);
+
+  return (size_t)result;
+}
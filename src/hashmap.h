@@ -0,0 +1,50 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+
+typedef size_t (*hashmap_hash_fn)(const void *key);
+typedef int (*hashmap_eq_fn)(const void *a, const void *b);
+
+typedef struct {
+  const void *key;
+  void *value; /* NULL for a free entry */
+  size_t hash;
+} hashmap_entry_t;
+
+/* An open-addressing hash map from keys to non-NULL values, neither of
+ * which it owns. Keys must stay valid while they are in the map. */
+typedef struct {
+  hashmap_entry_t *entries;
+  size_t capacity;
+  size_t count;
+  hashmap_hash_fn hash;
+  hashmap_eq_fn eq;
+} hashmap_t;
+
+hashmap_t *hashmap_new(hashmap_hash_fn hash, hashmap_eq_fn eq);
+
+void hashmap_free(hashmap_t *map);
+
+void *hashmap_get(const hashmap_t *map, const void *key);
+
+// Adds key, or replaces the value of an equal key already there
+otr4_err_t hashmap_put(hashmap_t *map, const void *key, void *value);
+
+// Returns the value key had, or NULL
+void *hashmap_remove(hashmap_t *map, const void *key);
+
+// For maps keyed by the pointers themselves
+size_t hashmap_pointer_hash(const void *key);
+int hashmap_pointer_eq(const void *a, const void *b);
+
+// SipHash under a random per-process key, for building hash functions.
+// Start from HASHMAP_HASH_INIT and pass each result on to hash more data.
+size_t hashmap_hash_bytes(size_t hash, const void *data, size_t len);
+
+#define HASHMAP_HASH_INIT ((size_t)0)
+
+#endif
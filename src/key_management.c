@@ -10,19 +10,6 @@
 #include "random.h"
 #include "shake.h"
 
-void chain_link_free(chain_link_t *head) {
-  chain_link_t *current = head;
-  chain_link_t *next = NULL;
-  while (current) {
-    next = current->next;
-
-    sodium_memzero(current->key, sizeof(chain_key_t));
-    free(current);
-
-    current = next;
-  }
-}
-
 ratchet_t *ratchet_new() {
   ratchet_t *ratchet = malloc(sizeof(ratchet_t));
   if (!ratchet)
@@ -32,11 +19,9 @@ ratchet_t *ratchet_new() {
 
   ratchet->chain_a->id = 0;
   memset(ratchet->chain_a->key, 0, sizeof(chain_key_t));
-  ratchet->chain_a->next = NULL;
 
   ratchet->chain_b->id = 0;
   memset(ratchet->chain_b->key, 0, sizeof(chain_key_t));
-  ratchet->chain_b->next = NULL;
 
   return ratchet;
 }
@@ -45,19 +30,120 @@ void ratchet_free(ratchet_t *ratchet) {
   if (!ratchet)
     return;
 
-  sodium_memzero(ratchet->root_key, sizeof(root_key_t));
+  sodium_memzero(ratchet, sizeof(ratchet_t));
+  free(ratchet);
+}
 
-  chain_link_free(ratchet->chain_a->next);
-  ratchet->chain_a->next = NULL;
+static void skipped_keys_forget(skipped_keys_t *skipped) {
+  if (skipped->count == 0)
+    return;
 
-  chain_link_free(ratchet->chain_b->next);
-  ratchet->chain_b->next = NULL;
+  for (int i = 0; i < skipped->capacity; i++) {
+    sodium_memzero(skipped->keys[i].key, sizeof(chain_key_t));
+    skipped->keys[i].id = -1;
+  }
 
-  free(ratchet);
+  skipped->count = 0;
+}
+
+static void skipped_keys_free(skipped_keys_t *skipped) {
+  skipped_keys_forget(skipped);
+  free(skipped->keys);
+  skipped->keys = NULL;
+  skipped->capacity = 0;
+}
+
+/* All stored ids are less than capacity apart, so they stay in distinct
+ * slots of a larger ring. */
+static otr4_err_t skipped_keys_grow(skipped_keys_t *skipped, int capacity) {
+  chain_link_t *keys = malloc(capacity * sizeof(chain_link_t));
+  if (!keys)
+    return OTR4_ERROR;
+
+  for (int i = 0; i < capacity; i++)
+    keys[i].id = -1;
+
+  for (int i = 0; i < skipped->capacity; i++) {
+    const chain_link_t *old = &skipped->keys[i];
+    if (old->id >= 0)
+      memcpy(&keys[old->id % capacity], old, sizeof(chain_link_t));
+  }
+
+  if (skipped->keys) {
+    sodium_memzero(skipped->keys, skipped->capacity * sizeof(chain_link_t));
+    free(skipped->keys);
+  }
+
+  skipped->keys = keys;
+  skipped->capacity = capacity;
+
+  return OTR4_SUCCESS;
+}
+
+static otr4_err_t store_skipped_key(const chain_link_t *link,
+                                    key_manager_t *manager) {
+  skipped_keys_t *skipped = manager->skipped_keys;
+  if (manager->max_skip <= 0)
+    return OTR4_SUCCESS;
+
+  if (!skipped->capacity) {
+    int capacity = manager->max_skip < 4 ? manager->max_skip : 4;
+    if (skipped_keys_grow(skipped, capacity))
+      return OTR4_ERROR;
+  }
+
+  chain_link_t *slot = &skipped->keys[link->id % skipped->capacity];
+  while (slot->id >= 0 && skipped->capacity < manager->max_skip) {
+    int capacity = 2 * skipped->capacity;
+    if (capacity > manager->max_skip)
+      capacity = manager->max_skip;
+
+    if (skipped_keys_grow(skipped, capacity))
+      return OTR4_ERROR;
+
+    slot = &skipped->keys[link->id % skipped->capacity];
+  }
+
+  if (slot->id >= 0)
+    skipped->count--; /* Too old, forget it */
+
+  slot->id = link->id;
+  memcpy(slot->key, link->key, sizeof(chain_key_t));
+  skipped->count++;
+
+  return OTR4_SUCCESS;
+}
+
+static chain_link_t *find_skipped_key(int message_id,
+                                      const key_manager_t *manager) {
+  const skipped_keys_t *skipped = manager->skipped_keys;
+  if (!skipped->count)
+    return NULL;
+
+  chain_link_t *slot = &skipped->keys[message_id % skipped->capacity];
+  if (slot->id != message_id)
+    return NULL;
+
+  return slot;
+}
+
+static otr4_err_t forget_skipped_key(int message_id, key_manager_t *manager) {
+  chain_link_t *slot = find_skipped_key(message_id, manager);
+  if (!slot)
+    return OTR4_ERROR;
+
+  sodium_memzero(slot->key, sizeof(chain_key_t));
+  slot->id = -1;
+  manager->skipped_keys->count--;
+
+  return OTR4_SUCCESS;
 }
 
 void key_manager_init(key_manager_t *manager) // make like ratchet_new?
 {
+  memset(manager->our_ecdh, 0, sizeof(manager->our_ecdh));
+  memset(manager->their_ecdh, 0, sizeof(manager->their_ecdh));
+
   manager->our_dh->pub = gcry_mpi_new(DH3072_MOD_LEN_BITS);
   manager->our_dh->priv = gcry_mpi_new(DH_KEY_SIZE);
 
@@ -67,11 +153,21 @@ void key_manager_init(key_manager_t *manager) // make like ratchet_new?
   manager->j = 0;
 
   manager->current = ratchet_new();
+  manager->chain->sending = NULL;
+  manager->chain->receiving = NULL;
+
+  manager->skipped_keys->keys = NULL;
+  manager->skipped_keys->capacity = 0;
+  manager->skipped_keys->count = 0;
+  manager->max_skip = DEFAULT_MAX_SKIP;
 
   memset(manager->brace_key, 0, sizeof(manager->brace_key));
   memset(manager->ssid, 0, sizeof(manager->ssid));
 
-  manager->old_mac_keys = NULL;
+  manager->old_mac_keys->keys = NULL;
+  manager->old_mac_keys->count = 0;
+  manager->old_mac_keys->capacity = 0;
+  manager->max_old_mac_keys = DEFAULT_MAX_OLD_MAC_KEYS;
 }
 
 void key_manager_destroy(key_manager_t *manager) {
@@ -85,18 +181,18 @@ void key_manager_destroy(key_manager_t *manager) {
 
   ratchet_free(manager->current);
   manager->current = NULL;
+  manager->chain->sending = NULL;
+  manager->chain->receiving = NULL;
+
+  skipped_keys_free(manager->skipped_keys);
 
   sodium_memzero(manager->brace_key, sizeof(manager->brace_key));
   sodium_memzero(manager->ssid, sizeof(manager->ssid));
 
-  list_element_t *el;
-  for (el = manager->old_mac_keys; el; el = el->next) {
-    free((uint8_t *)el->data);
-    el->data = NULL;
-  }
-
-  list_free_full(manager->old_mac_keys);
-  manager->old_mac_keys = NULL;
+  key_manager_forget_old_mac_keys(manager);
+  free(manager->old_mac_keys->keys);
+  manager->old_mac_keys->keys = NULL;
+  manager->old_mac_keys->capacity = 0;
 }
 
 otr4_err_t key_manager_generate_ephemeral_keys(key_manager_t *manager) {
@@ -149,6 +245,23 @@ void derive_chain_key_b(chain_key_t chain_key, const shared_secret_t shared) {
   derive_key_from_shared_secret(chain_key, sizeof(chain_key_t), magic, shared);
 }
 
+/* Whoever has the greater ECDH public key sends on chain A. Both keys are
+ * fixed for the lifetime of a ratchet, so this is decided once per ratchet. */
+static void decide_between_chain_keys(key_manager_t *manager) {
+  manager->chain->sending = NULL;
+  manager->chain->receiving = NULL;
+
+  int cmp = memcmp(manager->our_ecdh->pub, manager->their_ecdh,
+                   sizeof(ec_public_key_t));
+  if (cmp > 0) {
+    manager->chain->sending = manager->current->chain_a;
+    manager->chain->receiving = manager->current->chain_b;
+  } else if (cmp < 0) {
+    manager->chain->sending = manager->current->chain_b;
+    manager->chain->receiving = manager->current->chain_a;
+  }
+}
+
 otr4_err_t key_manager_new_ratchet(key_manager_t *manager,
                                    const shared_secret_t shared) {
   ratchet_t *ratchet = ratchet_new();
@@ -156,143 +269,103 @@ otr4_err_t key_manager_new_ratchet(key_manager_t *manager,
     return OTR4_ERROR;
   }
 
-  derive_root_key(ratchet->root_key, shared);
-  derive_chain_key_a(ratchet->chain_a->key, shared);
-  derive_chain_key_b(ratchet->chain_b->key, shared);
+  /* Same as derive_root_key, derive_chain_key_a and derive_chain_key_b */
+  shake_kdf_lane_t keys[3] = {
+      {ratchet->root_key, sizeof(root_key_t), 0x1},
+      {ratchet->chain_a->key, sizeof(chain_key_t), 0x2},
+      {ratchet->chain_b->key, sizeof(chain_key_t), 0x3},
+  };
+  shake_256_kdf_lanes(keys, 3, shared, sizeof(shared_secret_t));
 
   ratchet_free(manager->current);
   manager->current = ratchet;
+  decide_between_chain_keys(manager);
+
+  /* Skipped keys belong to the receiving chain of the previous ratchet */
+  skipped_keys_forget(manager->skipped_keys);
 
   return OTR4_SUCCESS;
 }
 
-const chain_link_t *chain_get_last(const chain_link_t *head) {
-  const chain_link_t *cursor = head;
-  while (cursor->next)
-    cursor = cursor->next;
+int key_manager_get_sending_chain_key(chain_key_t sending,
+                                      const key_manager_t *manager) {
+  const chain_link_t *link = manager->chain->sending;
+  memcpy(sending, link->key, sizeof(chain_key_t));
 
-  return cursor;
+  return link->id;
 }
 
-const chain_link_t *chain_get_by_id(int message_id, const chain_link_t *head) {
-  const chain_link_t *cursor = head;
-  while (cursor->next && cursor->id != message_id)
-    cursor = cursor->next;
+static void derive_next_chain_key(chain_link_t *link) {
+  chain_key_t next;
+  hash_hash(next, sizeof(chain_key_t), link->key, sizeof(chain_key_t));
+  memcpy(link->key, next, sizeof(chain_key_t));
+  sodium_memzero(next, sizeof(chain_key_t));
 
-  if (cursor->id == message_id) {
-    return cursor;
-  }
-
-  return NULL;
+  link->id++;
 }
 
-message_chain_t *decide_between_chain_keys(const ratchet_t *ratchet,
-                                           const ec_point_t our,
-                                           const ec_point_t their) {
-  message_chain_t *ret = malloc(sizeof(message_chain_t));
-  if (ret == NULL)
-    return NULL;
-
-  ret->sending = NULL;
-  ret->receiving = NULL;
+/* The receiving chain always holds the key for the next message we expect.
+ * Keys for messages skipped on the way to message_id are kept until they
+ * arrive. Looking a key up changes nothing, so a forged message can not use
+ * one up: that is left to key_manager_consume_receiving_chain_key. */
+otr4_err_t key_manager_get_receiving_chain_key(chain_key_t receiving,
+                                               int message_id,
+                                               const key_manager_t *manager) {
+  if (message_id < 0)
+    return OTR4_ERROR;
 
-  gcry_mpi_t our_mpi = NULL;
-  gcry_mpi_t their_mpi = NULL;
-  if (gcry_mpi_scan(&our_mpi, GCRYMPI_FMT_USG, our, sizeof(ec_public_key_t),
-                    NULL)) {
-    gcry_mpi_release(our_mpi);
-    gcry_mpi_release(their_mpi);
-    return false;
-  }
+  const chain_link_t *link = manager->chain->receiving;
+  if (!link)
+    return OTR4_ERROR;
 
-  if (gcry_mpi_scan(&their_mpi, GCRYMPI_FMT_USG, their, sizeof(ec_public_key_t),
-                    NULL)) {
-    gcry_mpi_release(our_mpi);
-    gcry_mpi_release(their_mpi);
-    return false;
-  }
+  if (message_id < link->id) {
+    const chain_link_t *skipped = find_skipped_key(message_id, manager);
+    if (!skipped)
+      return OTR4_ERROR;
 
-  int cmp = gcry_mpi_cmp(our_mpi, their_mpi);
-  if (cmp > 0) {
-    ret->sending = ratchet->chain_a;
-    ret->receiving = ratchet->chain_b;
-  } else if (cmp < 0) {
-    ret->sending = ratchet->chain_b;
-    ret->receiving = ratchet->chain_a;
+    memcpy(receiving, skipped->key, sizeof(chain_key_t));
+    return OTR4_SUCCESS;
   }
 
-  gcry_mpi_release(our_mpi);
-  gcry_mpi_release(their_mpi);
-  return ret;
-}
-
-int key_manager_get_sending_chain_key(chain_key_t sending,
-                                      const key_manager_t *manager) {
-  message_chain_t *chain = decide_between_chain_keys(
-      manager->current, manager->our_ecdh->pub, manager->their_ecdh);
-  const chain_link_t *last = chain_get_last(chain->sending);
-  memcpy(sending, last->key, sizeof(chain_key_t));
-  free(chain);
-
-  return last->id;
-}
-
-chain_link_t *chain_link_new() {
-  chain_link_t *l = malloc(sizeof(chain_link_t));
-  if (l == NULL)
-    return NULL;
+  if (message_id - link->id > manager->max_skip)
+    return OTR4_ERROR;
 
-  l->id = 0;
-  l->next = NULL;
+  chain_key_t next;
+  memcpy(receiving, link->key, sizeof(chain_key_t));
+  for (int id = link->id; id < message_id; id++) {
+    hash_hash(next, sizeof(chain_key_t), receiving, sizeof(chain_key_t));
+    memcpy(receiving, next, sizeof(chain_key_t));
+  }
 
-  return l;
+  sodium_memzero(next, sizeof(chain_key_t));
+  return OTR4_SUCCESS;
 }
 
-chain_link_t *derive_next_chain_link(chain_link_t *previous) {
-  chain_link_t *l = chain_link_new();
-  if (l == NULL)
-    return NULL;
-
-  hash_hash(l->key, sizeof(chain_key_t), previous->key, sizeof(chain_key_t));
-
-  sodium_memzero(previous->key, CHAIN_KEY_BYTES);
-
-  l->id = previous->id + 1;
-  previous->next = l;
-  return l;
-}
+/* Once message_id has been authenticated, its key is never handed out again.
+ * The keys skipped on the way to it are kept. */
+otr4_err_t key_manager_consume_receiving_chain_key(int message_id,
+                                                   key_manager_t *manager) {
+  if (message_id < 0)
+    return OTR4_ERROR;
 
-bool rebuild_chain_keys_up_to(int message_id, const chain_link_t *head) {
-  chain_link_t *last = (chain_link_t *)chain_get_last(head);
+  chain_link_t *link = manager->chain->receiving;
+  if (!link)
+    return OTR4_ERROR;
 
-  int j = 0;
-  for (j = last->id; j < message_id; j++) {
-    last = derive_next_chain_link(last);
-    if (last == NULL)
-      return false;
-  }
+  if (message_id < link->id)
+    return forget_skipped_key(message_id, manager);
 
-  return true;
-}
+  if (message_id - link->id > manager->max_skip)
+    return OTR4_ERROR;
 
-otr4_err_t key_manager_get_receiving_chain_key(chain_key_t receiving,
-                                               int message_id,
-                                               const key_manager_t *manager) {
+  while (link->id < message_id) {
+    if (store_skipped_key(link, manager))
+      return OTR4_ERROR;
 
-  message_chain_t *chain = decide_between_chain_keys(
-      manager->current, manager->our_ecdh->pub, manager->their_ecdh);
-  if (!rebuild_chain_keys_up_to(message_id, chain->receiving)) {
-    free(chain);
-    return OTR4_ERROR;
+    derive_next_chain_key(link);
   }
 
-  const chain_link_t *link = chain_get_by_id(message_id, chain->receiving);
-  free(chain);
-  if (link == NULL)
-    return OTR4_ERROR; /* message id not found. Should have been generated at
-                        rebuild_chain_keys_up_to */
-
-  memcpy(receiving, link->key, sizeof(chain_key_t));
+  derive_next_chain_key(link);
 
   return OTR4_SUCCESS;
 }
@@ -310,16 +383,12 @@ void calculate_shared_secret(shared_secret_t dst, const k_ecdh_t k_ecdh,
 }
 
 static otr4_err_t derive_sending_chain_key(key_manager_t *manager) {
-  message_chain_t *chain = decide_between_chain_keys(
-      manager->current, manager->our_ecdh->pub, manager->their_ecdh);
-  chain_link_t *last = (chain_link_t *)chain_get_last(chain->sending);
-  free(chain);
-
-  chain_link_t *l = derive_next_chain_link(last);
-  if (l == NULL)
+  if (!manager->chain->sending)
     return OTR4_ERROR;
 
-  // TODO: assert l->id == manager->j
+  derive_next_chain_key(manager->chain->sending);
+
+  // TODO: assert id == manager->j
   return OTR4_SUCCESS;
 }
 
@@ -431,13 +500,12 @@ bool key_manager_ensure_on_ratchet(key_manager_t *manager) {
 static void derive_encryption_and_mac_keys(m_enc_key_t enc_key,
                                            m_mac_key_t mac_key,
                                            const chain_key_t chain_key) {
-  uint8_t magic1[1] = {0x1};
-  uint8_t magic2[1] = {0x2};
+  shake_kdf_lane_t keys[2] = {
+      {enc_key, sizeof(m_enc_key_t), 0x1},
+      {mac_key, sizeof(m_mac_key_t), 0x2},
+  };
 
-  shake_256_kdf(enc_key, sizeof(m_enc_key_t), magic1, chain_key,
-                sizeof(chain_key_t));
-  shake_256_kdf(mac_key, sizeof(m_mac_key_t), magic2, chain_key,
-                sizeof(chain_key_t));
+  shake_256_kdf_lanes(keys, 2, chain_key, sizeof(chain_key_t));
 }
 
 otr4_err_t
@@ -450,6 +518,7 @@ key_manager_retrieve_receiving_message_keys(m_enc_key_t enc_key,
     return OTR4_ERROR;
 
   derive_encryption_and_mac_keys(enc_key, mac_key, receiving);
+  sodium_memzero(receiving, sizeof(chain_key_t));
 
   return OTR4_SUCCESS;
 }
@@ -486,26 +555,52 @@ otr4_err_t key_manager_retrieve_sending_message_keys(
   return OTR4_ERROR;
 }
 
-uint8_t *key_manager_old_mac_keys_serialize(list_element_t *old_mac_keys) {
-  uint num_mac_keys = list_len(old_mac_keys);
-  size_t serlen = num_mac_keys * MAC_KEY_BYTES;
-  if (serlen == 0) {
-    return NULL;
-  }
+static otr4_err_t old_mac_keys_grow(old_mac_keys_t *old, size_t capacity) {
+  uint8_t *keys = malloc(capacity * MAC_KEY_BYTES);
+  if (!keys)
+    return OTR4_ERROR;
 
-  uint8_t *ser_mac_keys = malloc(serlen);
-  if (!ser_mac_keys) {
-    return NULL;
+  if (old->keys) {
+    memcpy(keys, old->keys, old->count * MAC_KEY_BYTES);
+    sodium_memzero(old->keys, old->capacity * MAC_KEY_BYTES);
+    free(old->keys);
   }
 
-  for (int i = 0; i < num_mac_keys; i++) {
-    list_element_t *last = list_get_last(old_mac_keys);
-    memcpy(ser_mac_keys + i * MAC_KEY_BYTES, last->data, MAC_KEY_BYTES);
-    old_mac_keys = list_remove_element(last, old_mac_keys);
-    list_free_full(last);
+  old->keys = keys;
+  old->capacity = capacity;
+
+  return OTR4_SUCCESS;
+}
+
+otr4_err_t key_manager_store_old_mac_key(const m_mac_key_t mac_key,
+                                        key_manager_t *manager) {
+  old_mac_keys_t *old = manager->old_mac_keys;
+  if (old->count == old->capacity) {
+    size_t capacity = old->capacity ? 2 * old->capacity : 4;
+    if (old_mac_keys_grow(old, capacity))
+      return OTR4_ERROR;
   }
 
-  list_free_nodes(old_mac_keys);
+  memcpy(old->keys + old->count * MAC_KEY_BYTES, mac_key, MAC_KEY_BYTES);
+  old->count++;
+
+  return OTR4_SUCCESS;
+}
+
+void key_manager_forget_old_mac_keys(key_manager_t *manager) {
+  old_mac_keys_t *old = manager->old_mac_keys;
+  size_t revealed = key_manager_old_mac_keys_len(manager);
+  size_t waiting = old->count * MAC_KEY_BYTES - revealed;
+  if (!revealed)
+    return;
+
+  /* The ones still waiting move to the front */
+  memmove(old->keys, old->keys + revealed, waiting);
+  sodium_memzero(old->keys + waiting, revealed);
+  old->count -= revealed / MAC_KEY_BYTES;
+}
 
-  return ser_mac_keys;
+void key_manager_set_max_old_mac_keys(size_t max_old_mac_keys,
+                                      key_manager_t *manager) {
+  manager->max_old_mac_keys = max_old_mac_keys;
 }
@@ -16,10 +16,16 @@ typedef uint8_t chain_key_t[CHAIN_KEY_BYTES];
 typedef uint8_t m_enc_key_t[32];
 typedef uint8_t m_mac_key_t[MAC_KEY_BYTES];
 
-typedef struct _chain_link {
+/* Default upper bound on how many receiving chain keys are kept for messages
+ * that have not arrived yet. */
+#define DEFAULT_MAX_SKIP 1000
+
+/* Default upper bound on how many MAC keys our next data message reveals */
+#define DEFAULT_MAX_OLD_MAC_KEYS 256
+
+typedef struct {
   int id;
   chain_key_t key;
-  struct _chain_link *next;
 } chain_link_t;
 
 typedef struct {
@@ -28,6 +34,29 @@ typedef struct {
   chain_link_t chain_b[1];
 } ratchet_t;
 
+typedef struct {
+  chain_link_t *sending, *receiving;
+} message_chain_t;
+
+/* Receiving chain keys for the messages skipped in the current ratchet. It is
+ * a ring indexed by message id, so looking a key up is O(1). It grows on
+ * demand up to max_skip entries, and older keys are forgotten after that. */
+typedef struct {
+  chain_link_t *keys;
+  int capacity;
+  int count;
+} skipped_keys_t;
+
+/* MAC keys of the messages we received, to be revealed in the next ones we
+ * send. They are kept back to back in the order they were used, so they can
+ * be copied straight into a message. Each message reveals at most
+ * max_old_mac_keys of them, and the rest wait for the following ones. */
+typedef struct {
+  uint8_t *keys;
+  size_t count;
+  size_t capacity;
+} old_mac_keys_t;
+
 typedef struct {
   /* AKE context */
   ecdh_keypair_t our_ecdh[1];
@@ -40,22 +69,31 @@ typedef struct {
   int i, j; // TODO: We need to add k (maybe), but why dont we need to add a
             // receiving_ratchet_id
   ratchet_t *current;
+  message_chain_t chain[1]; /* Which chains of current we send and receive on */
+
+  skipped_keys_t skipped_keys[1];
+  int max_skip;
 
   brace_key_t brace_key;
 
   uint8_t ssid[8];
 
-  list_element_t *old_mac_keys;
+  old_mac_keys_t old_mac_keys[1];
+  size_t max_old_mac_keys;
 } key_manager_t;
 
-typedef struct {
-  const chain_link_t *sending, *receiving;
-} message_chain_t;
-
 void key_manager_init(key_manager_t *manager);
 
 void key_manager_destroy(key_manager_t *manager);
 
+static inline void key_manager_set_max_skip(int max_skip,
+                                            key_manager_t *manager) {
+  manager->max_skip = max_skip;
+}
+
+void key_manager_set_max_old_mac_keys(size_t max_old_mac_keys,
+                                      key_manager_t *manager);
+
 static inline void key_manager_set_their_ecdh(ec_point_t their,
                                               key_manager_t *manager) {
   ec_point_copy(manager->their_ecdh, their);
@@ -99,9 +137,13 @@ otr4_err_t key_manager_get_receiving_chain_key(chain_key_t receiving,
                                                int message_id,
                                                const key_manager_t *manager);
 
+otr4_err_t key_manager_consume_receiving_chain_key(int message_id,
+                                                   key_manager_t *manager);
+
 void calculate_shared_secret(shared_secret_t dst, const k_ecdh_t k_ecdh,
                              const brace_key_t brace_key);
 
+/* Only looks the keys up. Consume them once the message is authenticated. */
 otr4_err_t
 key_manager_retrieve_receiving_message_keys(m_enc_key_t enc_key,
                                             m_mac_key_t mac_key, int message_id,
@@ -111,6 +153,20 @@ otr4_err_t key_manager_prepare_next_chain_key(key_manager_t *manager);
 
 otr4_err_t key_manager_retrieve_sending_message_keys(
     m_enc_key_t enc_key, m_mac_key_t mac_key, const key_manager_t *manager);
-uint8_t *key_manager_old_mac_keys_serialize(list_element_t *old_mac_keys);
+otr4_err_t key_manager_store_old_mac_key(const m_mac_key_t mac_key,
+                                        key_manager_t *manager);
+
+/* Of the keys the next message reveals, from the start of old_mac_keys */
+static inline size_t
+key_manager_old_mac_keys_len(const key_manager_t *manager) {
+  size_t count = manager->old_mac_keys->count;
+  if (count > manager->max_old_mac_keys)
+    count = manager->max_old_mac_keys;
+
+  return count * MAC_KEY_BYTES;
+}
+
+/* Once a message has revealed them */
+void key_manager_forget_old_mac_keys(key_manager_t *manager);
 
 #endif
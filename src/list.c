@@ -131,3 +131,60 @@ size_t list_len(list_element_t *head) {
 
   return size;
 }
+
+void list_init(list_t *list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->len = 0;
+}
+
+list_element_t *list_append(list_t *list, void *data) {
+  list_element_t *n = list_new();
+  if (!n)
+    return NULL;
+
+  n->data = data;
+
+  if (list->tail)
+    list->tail->next = n;
+  else
+    list->head = n;
+
+  list->tail = n;
+  list->len++;
+
+  return n;
+}
+
+void list_unlink(list_t *list, list_element_t *element) {
+  if (!element)
+    return;
+
+  list_element_t *previous = NULL;
+  list_element_t *cursor = list->head;
+  while (cursor && cursor != element) {
+    previous = cursor;
+    cursor = cursor->next;
+  }
+
+  if (!cursor)
+    return;
+
+  if (previous)
+    previous->next = element->next;
+  else
+    list->head = element->next;
+
+  if (list->tail == element)
+    list->tail = previous;
+
+  element->next = NULL;
+  list->len--;
+}
+
+void list_clear(list_t *list, void (*fn)(void *data)) {
+  list_free(list->head, fn);
+  list_init(list);
+}
+
+size_t list_size(const list_t *list) { return list->len; }
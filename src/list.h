@@ -37,4 +37,25 @@ list_element_t *list_remove_element(const list_element_t *wanted,
 
 size_t list_len(list_element_t *head);
 
+/* A list that keeps its last element and length, so appending and counting
+ * take constant time. Walk it from head, as any other list. */
+typedef struct {
+  list_element_t *head;
+  list_element_t *tail;
+  size_t len;
+} list_t;
+
+void list_init(list_t *list);
+
+// Returns the new element, or NULL if it could not be allocated
+list_element_t *list_append(list_t *list, void *data);
+
+// Takes element out of the list, without freeing it
+void list_unlink(list_t *list, list_element_t *element);
+
+// Empty the list and invoke fn, if any, to free the nodes' data
+void list_clear(list_t *list, void (*fn)(void *data));
+
+size_t list_size(const list_t *list);
+
 #endif
@@ -1,5 +1,6 @@
 #include "messaging.h"
 #include "keys.h"
+#include "otrv3.h"
 
 #include <libotr/privkey.h>
 
@@ -8,11 +9,23 @@ otr4_userstate_t *otr4_user_state_new(const otrv4_client_callbacks_t *cb) {
   if (!state)
     return NULL;
 
-  state->states = NULL;
-  state->clients = NULL;
+  list_init(state->states);
+  list_init(state->clients);
   state->callbacks = cb;
 
+  state->states_by_client_id =
+      hashmap_new(hashmap_pointer_hash, hashmap_pointer_eq);
+  state->clients_by_client_id =
+      hashmap_new(hashmap_pointer_hash, hashmap_pointer_eq);
+  if (!state->states_by_client_id || !state->clients_by_client_id) {
+    hashmap_free(state->states_by_client_id);
+    hashmap_free(state->clients_by_client_id);
+    free(state);
+    return NULL;
+  }
+
   state->userstate_v3 = otrl_userstate_create();
+  pthread_mutex_init(&state->lock, NULL);
 
   return state;
 }
@@ -25,81 +38,105 @@ void otr4_user_state_free(otr4_userstate_t *state) {
   if (!state)
     return;
 
-  list_free(state->states, free_client_state);
-  state->states = NULL;
+  list_clear(state->states, free_client_state);
+  list_clear(state->clients, free_client);
 
-  list_free(state->clients, free_client);
-  state->clients = NULL;
+  hashmap_free(state->states_by_client_id);
+  state->states_by_client_id = NULL;
+
+  hashmap_free(state->clients_by_client_id);
+  state->clients_by_client_id = NULL;
 
   state->callbacks = NULL;
 
   otrl_userstate_free(state->userstate_v3);
   state->userstate_v3 = NULL;
 
+  pthread_mutex_destroy(&state->lock);
   free(state);
 }
 
-static int find_state_by_client_id(const void *current, const void *wanted) {
-  const otr4_client_state_t *s = current;
-  return s->client_id == wanted;
-}
-
-static otr4_client_state_t *get_client_state(otr4_userstate_t *state,
-                                             void *client_id) {
-  list_element_t *el =
-      list_get(client_id, state->states, find_state_by_client_id);
-  if (el)
-    return el->data;
+/* Must be called with the user state locked */
+static otr4_client_state_t *
+find_or_add_client_state(otr4_userstate_t *state, void *client_id) {
+  otr4_client_state_t *s = hashmap_get(state->states_by_client_id, client_id);
+  if (s)
+    return s;
 
-  otr4_client_state_t *s = otr4_client_state_new(client_id);
+  s = otr4_client_state_new(client_id);
   if (!s)
     return NULL;
 
   s->callbacks = state->callbacks;
   s->userstate = state->userstate_v3;
 
-  state->states = list_add(s, state->states);
+  if (hashmap_put(state->states_by_client_id, client_id, s)) {
+    otr4_client_state_free(s);
+    return NULL;
+  }
+
+  if (!list_append(state->states, s)) {
+    hashmap_remove(state->states_by_client_id, client_id);
+    otr4_client_state_free(s);
+    return NULL;
+  }
+
   return s;
 }
 
-static int find_client_by_client_id(const void *current, const void *wanted) {
-  const otr4_client_t *s = current;
-  return s && s->state && s->state->client_id == wanted;
+static otr4_client_state_t *get_client_state(otr4_userstate_t *state,
+                                             void *client_id) {
+  pthread_mutex_lock(&state->lock);
+  otr4_client_state_t *s = find_or_add_client_state(state, client_id);
+  pthread_mutex_unlock(&state->lock);
+
+  return s;
 }
 
-otr4_messaging_client_t *otr4_messaging_client_new(otr4_userstate_t *state,
-                                                   void *client_id) {
-  if (!client_id) {
+/* Must be called with the user state locked */
+static otr4_client_t *find_or_add_client(otr4_userstate_t *state,
+                                         void *client_id) {
+  otr4_client_t *c = hashmap_get(state->clients_by_client_id, client_id);
+  if (c)
+    return c;
+
+  otr4_client_state_t *s = find_or_add_client_state(state, client_id);
+  if (!s)
     return NULL;
-  }
 
-  list_element_t *e =
-      list_get(client_id, state->clients, find_client_by_client_id);
+  c = otr4_client_new(s);
+  if (!c)
+    return NULL;
 
-  if (e) {
-    return e->data;
-  } else {
-    otr4_client_state_t *s = get_client_state(state, client_id);
-    if (!s)
-      return NULL;
+  if (hashmap_put(state->clients_by_client_id, client_id, c)) {
+    otr4_client_free(c);
+    return NULL;
+  }
 
-    otr4_client_t *c = otr4_client_new(s);
-    if (!c)
-      return NULL;
+  if (!list_append(state->clients, c)) {
+    hashmap_remove(state->clients_by_client_id, client_id);
+    otr4_client_free(c);
+    return NULL;
+  }
 
-    state->clients = list_add(c, state->clients);
+  return c;
+}
 
-    return c;
+otr4_messaging_client_t *otr4_messaging_client_new(otr4_userstate_t *state,
+                                                   void *client_id) {
+  if (!client_id) {
+    return NULL;
   }
+
+  pthread_mutex_lock(&state->lock);
+  otr4_client_t *c = find_or_add_client(state, client_id);
+  pthread_mutex_unlock(&state->lock);
+
+  return c;
 }
 
 otr4_messaging_client_t *otr4_messaging_client_get(otr4_userstate_t *state,
                                                    void *client_id) {
-  list_element_t *el =
-      list_get(client_id, state->clients, find_client_by_client_id);
-  if (el)
-    return el->data;
-
   return otr4_messaging_client_new(state, client_id);
 }
 
@@ -112,7 +149,11 @@ int otr4_user_state_private_key_v3_generate_FILEp(otr4_userstate_t *state,
 
 int otr4_user_state_private_key_v3_read_FILEp(otr4_userstate_t *state,
                                               FILE *keys) {
-  return otrl_privkey_read_FILEp(state->userstate_v3, keys);
+  otrv3_lock();
+  int err = otrl_privkey_read_FILEp(state->userstate_v3, keys);
+  otrv3_unlock();
+
+  return err;
 }
 
 int otr4_user_state_add_private_key_v4(otr4_userstate_t *state, void *clientop,
@@ -134,10 +175,24 @@ otrv4_keypair_t *otr4_user_state_get_private_key_v4(otr4_userstate_t *state,
       get_client_state(state, client_id));
 }
 
-static void add_private_key_v4_to_FILEp(list_element_t *node, void *context) {
-  FILE *privf = context;
-  otr4_client_state_t *state = node->data;
-  otr4_client_state_private_key_v4_write_FILEp(state, privf);
+/* The client states, copied under the lock so that it is released before
+ * calling into them. They are only freed with the userstate. */
+static otr4_client_state_t **copy_client_states(size_t *count,
+                                                const otr4_userstate_t *state) {
+  pthread_mutex_t *lock = (pthread_mutex_t *)&state->lock;
+  pthread_mutex_lock(lock);
+
+  *count = list_size(state->states);
+  otr4_client_state_t **states = malloc(*count * sizeof(*states));
+  if (states) {
+    size_t i = 0;
+    for (list_element_t *el = state->states->head; el; el = el->next)
+      states[i++] = el->data;
+  }
+
+  pthread_mutex_unlock(lock);
+
+  return states;
 }
 
 int otr4_user_state_private_key_v4_write_FILEp(const otr4_userstate_t *state,
@@ -145,7 +200,16 @@ int otr4_user_state_private_key_v4_write_FILEp(const otr4_userstate_t *state,
   if (!privf)
     return -1;
 
-  list_foreach(state->states, add_private_key_v4_to_FILEp, privf);
+  size_t count = 0;
+  otr4_client_state_t **states = copy_client_states(&count, state);
+  if (!states && count)
+    return -2;
+
+  for (size_t i = 0; i < count; i++)
+    otr4_client_state_private_key_v4_write_FILEp(states[i], privf);
+
+  free(states);
+
   return 0;
 }
 
@@ -185,5 +249,9 @@ unsigned int otr4_user_state_get_instance_tag(otr4_userstate_t *state,
 int otr4_user_state_instance_tags_read_FILEp(otr4_userstate_t *state,
                                              FILE *instag) {
   // We use OTR3 userstate also for OTR4 instance tags, for now.
-  return otrl_instag_read_FILEp(state->userstate_v3, instag);
+  otrv3_lock();
+  int err = otrl_instag_read_FILEp(state->userstate_v3, instag);
+  otrv3_unlock();
+
+  return err;
 }
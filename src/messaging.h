@@ -22,15 +22,26 @@
  * otr4_messaging_client_receiving(client, alice_talking_to_bob);
  */
 
+#include <pthread.h>
+
 #include "client.h"
+#include "hashmap.h"
 #include "list.h"
 
 // TODO: Remove?
 typedef otr4_client_t otr4_messaging_client_t;
 
 typedef struct {
-  list_element_t *states;
-  list_element_t *clients;
+  list_t states[1];
+  list_t clients[1];
+
+  /* Both keyed by client_id */
+  hashmap_t *states_by_client_id;
+  hashmap_t *clients_by_client_id;
+
+  /* For the states and clients above. It is never held while calling into
+   * a client state, so that app callbacks can use this API. */
+  pthread_mutex_t lock;
 
   const otrv4_client_callbacks_t *callbacks;
   void *userstate_v3; /* OtrlUserState */
@@ -1,6 +1,26 @@
+#include <pthread.h>
+
 #include "otrv3.h"
 #include "otrv4.h"
 
+static pthread_once_t otrl_lock_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t otrl_lock;
+
+static void otrl_lock_init(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&otrl_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void otrv3_lock(void) {
+  pthread_once(&otrl_lock_once, otrl_lock_init);
+  pthread_mutex_lock(&otrl_lock);
+}
+
+void otrv3_unlock(void) { pthread_mutex_unlock(&otrl_lock); }
+
 static void create_privkey_cb(const otr4_conversation_state_t *otr) {
   if (!otr || !otr->client)
     return;
@@ -72,7 +92,8 @@ static OtrlPolicy op_policy(void *opdata, ConnContext *context) {
   return OTRL_POLICY_ALLOW_V3 | OTRL_POLICY_WHITESPACE_START_AKE;
 }
 
-static char *injected_to_send = NULL;
+/* Set by op_inject and consumed right after, on the same thread */
+static __thread char *injected_to_send = NULL;
 
 static void from_injected_to_send(char **to_send) {
   if (!to_send || !injected_to_send)
@@ -432,11 +453,13 @@ otr4_err_t otrv3_send_message(char **newmessage, const char *message,
   if (!conn)
     return OTR4_ERROR;
 
+  otrv3_lock();
   int err = otrl_message_sending(
       conn->state->userstate, conn->ops, conn->opdata,
       conn->state->account_name, conn->state->protocol_name, conn->peer,
       OTRL_INSTAG_RECENT, message, tlvsv3, newmessage, OTRL_FRAGMENT_SEND_SKIP,
       &conn->ctx, NULL, NULL);
+  otrv3_unlock();
 
   if (!err)
     return OTR4_SUCCESS;
@@ -455,10 +478,12 @@ otr4_err_t otrv3_receive_message(string_t *to_send, string_t *to_display,
     return OTR4_ERROR;
 
   char *newmessage = NULL;
+  otrv3_lock();
   ignore_message = otrl_message_receiving(
       conn->state->userstate, conn->ops, conn->opdata,
       conn->state->account_name, conn->state->protocol_name, conn->peer,
       message, &newmessage, &tlvsv3, &conn->ctx, NULL, NULL);
+  otrv3_unlock();
 
   (void)ignore_message;
 
@@ -477,9 +502,11 @@ otr4_err_t otrv3_receive_message(string_t *to_send, string_t *to_display,
 }
 
 void otrv3_close(string_t *to_send, otr3_conn_t *conn) {
+  otrv3_lock();
   otrl_message_disconnect_all_instances(conn->state->userstate, conn->ops,
                                         conn->opdata, conn->state->account_name,
                                         conn->state->protocol_name, conn->peer);
+  otrv3_unlock();
 
   from_injected_to_send(to_send);
 }
@@ -487,12 +514,14 @@ void otrv3_close(string_t *to_send, otr3_conn_t *conn) {
 otr4_err_t otrv3_smp_start(string_t *to_send, const char *question,
                            const uint8_t *secret, size_t secretlen,
                            otr3_conn_t *conn) {
+  otrv3_lock();
   if (question)
     otrl_message_initiate_smp_q(conn->state->userstate, conn->ops, conn->opdata,
                                 conn->ctx, question, secret, secretlen);
   else
     otrl_message_initiate_smp(conn->state->userstate, conn->ops, conn->opdata,
                               conn->ctx, secret, secretlen);
+  otrv3_unlock();
 
   from_injected_to_send(to_send);
   return OTR4_SUCCESS;
@@ -500,8 +529,10 @@ otr4_err_t otrv3_smp_start(string_t *to_send, const char *question,
 
 otr4_err_t otrv3_smp_continue(string_t *to_send, const uint8_t *secret,
                               const size_t secretlen, otr3_conn_t *conn) {
+  otrv3_lock();
   otrl_message_respond_smp(conn->state->userstate, conn->ops, conn->opdata,
                            conn->ctx, secret, secretlen);
+  otrv3_unlock();
 
   from_injected_to_send(to_send);
   return OTR4_SUCCESS;
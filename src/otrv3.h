@@ -22,6 +22,11 @@ typedef struct {
   ConnContext *ctx;
 } otr3_conn_t;
 
+/* libotr is not thread-safe. Every use of an OtrlUserState, including from
+ * its callbacks, happens while holding this recursive lock. */
+void otrv3_lock(void);
+void otrv3_unlock(void);
+
 otr3_conn_t *otr3_conn_new(otr4_client_state_t *state, const char *peer);
 
 void otr3_conn_free(otr3_conn_t *conn);
@@ -43,14 +43,6 @@ static const char tag_version_v3[] = {'\x20', '\x20', '\x09', '\x09', '\x20',
 static const string_t query_header = "?OTRv";
 static const string_t otr_header = "?OTR:";
 
-static void create_privkey_cb(const otr4_conversation_state_t *conv) {
-  if (!conv || !conv->client || !conv->client->callbacks)
-    return;
-
-  // TODO: Change to receive conv->client
-  conv->client->callbacks->create_privkey(conv->client->client_id);
-}
-
 static void gone_secure_cb(const otr4_conversation_state_t *conv) {
   if (!conv || !conv->client || !conv->client->callbacks)
     return;
@@ -101,9 +93,10 @@ static void handle_smp_event_cb(const otr4_smp_event_t event,
   }
 }
 
+/* Conversations of the same client may run on different threads, so the
+ * client state serializes creating its keypair. */
 static void maybe_create_keys(const otr4_conversation_state_t *conv) {
-  if (!conv->client->keypair)
-    create_privkey_cb(conv);
+  otr4_client_state_get_private_key_v4(conv->client);
 }
 
 static int allow_version(const otrv4_t *otr, otrv4_supported_version version) {
@@ -122,11 +115,24 @@ static void allowed_versions(string_t dst, const otrv4_t *otr) {
 }
 
 static const user_profile_t *get_my_user_profile(otrv4_t *otr) {
+  char versions[3] = {0};
+  allowed_versions(versions, otr);
+
+  /* Pick up a renewed profile, but never in the middle of a DAKE */
+  if (otr->state != OTRV4_STATE_WAITING_AUTH_I &&
+      otr->state != OTRV4_STATE_WAITING_AUTH_R) {
+    user_profile_t *renewed = otr4_client_state_get_profile(
+        otr->conversation->client, versions,
+        otr->profile ? otr->profile->expires : 0);
+    if (renewed) {
+      user_profile_free(otr->profile);
+      otr->profile = renewed;
+    }
+  }
+
   if (otr->profile)
     return otr->profile;
 
-  char versions[3] = {0};
-  allowed_versions(versions, otr);
   maybe_create_keys(otr->conversation);
   otr->profile =
       user_profile_build(versions, otr->conversation->client->keypair);
@@ -518,102 +524,70 @@ static otr4_err_t double_ratcheting_init(int j, otrv4_t *otr) {
   return OTR4_SUCCESS;
 }
 
-static otr4_err_t build_auth_message(uint8_t **msg, size_t *msg_len,
-                                     const uint8_t type,
+/* t = type || H(I profile) || H(R profile) || I ECDH || R ECDH || I DH || R
+ * DH, kept in parts and hashed straight into the SNIZKPK challenge. */
+#define AUTH_MESSAGE_PARTS 7
+
+typedef struct {
+  uint8_t type;
+  uint8_t i_profile[HASH_BYTES], r_profile[HASH_BYTES];
+  uint8_t i_ecdh[ED448_POINT_BYTES], r_ecdh[ED448_POINT_BYTES];
+  uint8_t i_dh[DH_MPI_BYTES], r_dh[DH_MPI_BYTES];
+
+  snizkpk_msg_part_t parts[AUTH_MESSAGE_PARTS];
+} auth_message_t;
+
+static void auth_message_destroy(auth_message_t *t) {
+  sodium_memzero(t, sizeof(auth_message_t));
+}
+
+static otr4_err_t build_auth_message(auth_message_t *t, const uint8_t type,
                                      const user_profile_t *i_profile,
                                      const user_profile_t *r_profile,
                                      const ec_point_t i_ecdh,
                                      const ec_point_t r_ecdh,
                                      const dh_mpi_t i_dh, const dh_mpi_t r_dh) {
-  uint8_t *ser_i_profile = NULL, *ser_r_profile = NULL;
-  size_t ser_i_profile_len, ser_r_profile_len = 0;
-  uint8_t ser_i_ecdh[ED448_POINT_BYTES], ser_r_ecdh[ED448_POINT_BYTES];
-
-  if (serialize_ec_point(ser_i_ecdh, i_ecdh)) {
-    return OTR4_ERROR;
-  }
-  if (serialize_ec_point(ser_r_ecdh, r_ecdh)) {
-    return OTR4_ERROR;
-  }
-
-  uint8_t ser_i_dh[DH3072_MOD_LEN_BYTES], ser_r_dh[DH3072_MOD_LEN_BYTES];
-  size_t ser_i_dh_len = 0, ser_r_dh_len = 0;
-
-  if (serialize_dh_public_key(ser_i_dh, &ser_i_dh_len, i_dh)) {
-    return OTR4_ERROR;
-  }
-  if (serialize_dh_public_key(ser_r_dh, &ser_r_dh_len, r_dh)) {
-    return OTR4_ERROR;
-  }
+  size_t i_dh_len = 0, r_dh_len = 0;
+  t->type = type;
 
   otr4_err_t err = OTR4_ERROR;
-
   do {
-    if (user_profile_asprintf(&ser_i_profile, &ser_i_profile_len, i_profile))
+    if (serialize_ec_point(t->i_ecdh, i_ecdh))
       continue;
 
-    if (user_profile_asprintf(&ser_r_profile, &ser_r_profile_len, r_profile))
+    if (serialize_ec_point(t->r_ecdh, r_ecdh))
       continue;
 
-    uint8_t hash_ser_i_profile[HASH_BYTES];
-    decaf_shake256_ctx_t hd_i;
-    hash_init_with_dom(hd_i);
-    hash_update(hd_i, ser_i_profile, ser_i_profile_len);
-
-    hash_final(hd_i, hash_ser_i_profile, sizeof(hash_ser_i_profile));
-    hash_destroy(hd_i);
-
-    uint8_t hash_ser_r_profile[HASH_BYTES];
-    decaf_shake256_ctx_t hd_r;
-    hash_init_with_dom(hd_r);
-    hash_update(hd_r, ser_r_profile, ser_r_profile_len);
-
-    hash_final(hd_r, hash_ser_r_profile, sizeof(hash_ser_r_profile));
-    hash_destroy(hd_r);
-
-    size_t len = 1 + 2 * ED448_POINT_BYTES + HASH_BYTES + HASH_BYTES +
-                 ser_i_dh_len + ser_r_dh_len;
-
-    uint8_t *buff = malloc(len);
-    if (!buff)
+    if (serialize_dh_public_key(t->i_dh, &i_dh_len, i_dh))
       continue;
 
-    uint8_t *cursor = buff;
-    *cursor = type;
-    cursor++;
-
-    memcpy(cursor, hash_ser_i_profile, HASH_BYTES);
-    cursor += HASH_BYTES;
-
-    memcpy(cursor, hash_ser_r_profile, HASH_BYTES);
-    cursor += HASH_BYTES;
-
-    memcpy(cursor, ser_i_ecdh, ED448_POINT_BYTES);
-    cursor += ED448_POINT_BYTES;
-
-    memcpy(cursor, ser_r_ecdh, ED448_POINT_BYTES);
-    cursor += ED448_POINT_BYTES;
+    if (serialize_dh_public_key(t->r_dh, &r_dh_len, r_dh))
+      continue;
 
-    memcpy(cursor, ser_i_dh, ser_i_dh_len);
-    cursor += ser_i_dh_len;
+    if (user_profile_hash(t->i_profile, i_profile))
+      continue;
 
-    memcpy(cursor, ser_r_dh, ser_r_dh_len);
-    cursor += ser_r_dh_len;
+    if (user_profile_hash(t->r_profile, r_profile))
+      continue;
 
-    *msg = buff;
-    *msg_len = len;
     err = OTR4_SUCCESS;
   } while (0);
 
-  free(ser_i_profile);
-  free(ser_r_profile);
+  if (err) {
+    auth_message_destroy(t);
+    return err;
+  }
 
-  sodium_memzero(ser_i_ecdh, ED448_POINT_BYTES);
-  sodium_memzero(ser_r_ecdh, ED448_POINT_BYTES);
-  sodium_memzero(ser_i_dh, DH3072_MOD_LEN_BYTES);
-  sodium_memzero(ser_r_dh, DH3072_MOD_LEN_BYTES);
+  snizkpk_msg_part_t *part = t->parts;
+  *part++ = (snizkpk_msg_part_t){&t->type, 1};
+  *part++ = (snizkpk_msg_part_t){t->i_profile, HASH_BYTES};
+  *part++ = (snizkpk_msg_part_t){t->r_profile, HASH_BYTES};
+  *part++ = (snizkpk_msg_part_t){t->i_ecdh, ED448_POINT_BYTES};
+  *part++ = (snizkpk_msg_part_t){t->r_ecdh, ED448_POINT_BYTES};
+  *part++ = (snizkpk_msg_part_t){t->i_dh, i_dh_len};
+  *part++ = (snizkpk_msg_part_t){t->r_dh, r_dh_len};
 
-  return err;
+  return OTR4_SUCCESS;
 }
 
 static otr4_err_t serialize_and_encode_auth_r(string_t *dst,
@@ -635,34 +609,35 @@ static otr4_err_t reply_with_auth_r_msg(string_t *dst, otrv4_t *otr) {
   msg->sender_instance_tag = otr->our_instance_tag;
   msg->receiver_instance_tag = otr->their_instance_tag;
 
-  user_profile_copy(msg->profile, get_my_user_profile(otr));
+  /* Fetched once, as a renewal in between would make the profile sent
+   * differ from the one sigma covers */
+  const user_profile_t *our_profile = get_my_user_profile(otr);
+  if (!our_profile)
+    return OTR4_ERROR;
+
+  user_profile_copy(msg->profile, our_profile);
 
   ec_point_copy(msg->X, OUR_ECDH(otr));
   msg->A = dh_mpi_copy(OUR_DH(otr));
 
-  unsigned char *t = NULL;
-  size_t t_len = 0;
-  if (build_auth_message(&t, &t_len, 0, otr->their_profile,
-                         get_my_user_profile(otr), THEIR_ECDH(otr),
+  auth_message_t t[1];
+  if (build_auth_message(t, 0, otr->their_profile, our_profile, THEIR_ECDH(otr),
                          OUR_ECDH(otr), THEIR_DH(otr), OUR_DH(otr)))
     return OTR4_ERROR;
 
   /* sigma = Auth(g^R, R, {g^I, g^R, g^i}, msg) */
-  otr4_err_t err = snizkpk_authenticate(
+  otr4_err_t err = snizkpk_authenticate_parts(
       msg->sigma, otr->conversation->client->keypair, /* g^R and R */
       otr->their_profile->pub_key,                    /* g^I */
       THEIR_ECDH(otr),                                /* g^i -- Y */
-      t, t_len);
+      t->parts, AUTH_MESSAGE_PARTS);
+  auth_message_destroy(t);
 
   if (err) {
-    free(t);
-    t = NULL;
     dake_auth_r_destroy(msg);
     return OTR4_ERROR;
   }
 
-  free(t);
-  t = NULL;
   err = serialize_and_encode_auth_r(dst, msg);
   dake_auth_r_destroy(msg);
   return err;
@@ -800,18 +775,15 @@ static otr4_err_t reply_with_auth_i_msg(string_t *dst,
   msg->sender_instance_tag = otr->our_instance_tag;
   msg->receiver_instance_tag = otr->their_instance_tag;
 
-  unsigned char *t = NULL;
-  size_t t_len = 0;
-  if (build_auth_message(&t, &t_len, 1, get_my_user_profile(otr), their,
-                         OUR_ECDH(otr), THEIR_ECDH(otr), OUR_DH(otr),
-                         THEIR_DH(otr)))
+  auth_message_t t[1];
+  if (build_auth_message(t, 1, get_my_user_profile(otr), their, OUR_ECDH(otr),
+                         THEIR_ECDH(otr), OUR_DH(otr), THEIR_DH(otr)))
     return OTR4_ERROR;
 
-  otr4_err_t err =
-      snizkpk_authenticate(msg->sigma, otr->conversation->client->keypair,
-                           their->pub_key, THEIR_ECDH(otr), t, t_len);
-  free(t);
-  t = NULL;
+  otr4_err_t err = snizkpk_authenticate_parts(
+      msg->sigma, otr->conversation->client->keypair, their->pub_key,
+      THEIR_ECDH(otr), t->parts, AUTH_MESSAGE_PARTS);
+  auth_message_destroy(t);
 
   if (err == OTR4_ERROR)
     return err;
@@ -822,25 +794,22 @@ static otr4_err_t reply_with_auth_i_msg(string_t *dst,
 }
 
 static bool valid_auth_r_message(const dake_auth_r_t *auth, otrv4_t *otr) {
-  uint8_t *t = NULL;
-  size_t t_len = 0;
+  auth_message_t t[1];
 
   if (!valid_received_values(auth->X, auth->A, auth->profile))
     return false;
 
-  if (build_auth_message(&t, &t_len, 0, get_my_user_profile(otr), auth->profile,
+  if (build_auth_message(t, 0, get_my_user_profile(otr), auth->profile,
                          OUR_ECDH(otr), auth->X, OUR_DH(otr), auth->A))
     return false;
 
   /* Verif({g^I, g^R, g^i}, sigma, msg) */
   otr4_err_t err =
-      snizkpk_verify(auth->sigma, auth->profile->pub_key,     /* g^R */
-                     otr->conversation->client->keypair->pub, /* g^I */
-                     OUR_ECDH(otr),                           /* g^  */
-                     t, t_len);
-
-  free(t);
-  t = NULL;
+      snizkpk_verify_parts(auth->sigma, auth->profile->pub_key,     /* g^R */
+                           otr->conversation->client->keypair->pub, /* g^I */
+                           OUR_ECDH(otr),                           /* g^  */
+                           t->parts, AUTH_MESSAGE_PARTS);
+  auth_message_destroy(t);
 
   return err == OTR4_SUCCESS;
 }
@@ -891,19 +860,18 @@ static otr4_err_t receive_auth_r(string_t *dst, const uint8_t *buff,
 }
 
 static bool valid_auth_i_message(const dake_auth_i_t *auth, otrv4_t *otr) {
-  uint8_t *t = NULL;
-  size_t t_len = 0;
+  auth_message_t t[1];
 
-  if (build_auth_message(&t, &t_len, 1, otr->their_profile,
-                         get_my_user_profile(otr), THEIR_ECDH(otr),
-                         OUR_ECDH(otr), THEIR_DH(otr), OUR_DH(otr)))
+  if (build_auth_message(t, 1, otr->their_profile, get_my_user_profile(otr),
+                         THEIR_ECDH(otr), OUR_ECDH(otr), THEIR_DH(otr),
+                         OUR_DH(otr)))
     return false;
 
-  otr4_err_t err = snizkpk_verify(auth->sigma, otr->their_profile->pub_key,
-                                  otr->conversation->client->keypair->pub,
-                                  OUR_ECDH(otr), t, t_len);
-  free(t);
-  t = NULL;
+  otr4_err_t err = snizkpk_verify_parts(
+      auth->sigma, otr->their_profile->pub_key,
+      otr->conversation->client->keypair->pub, OUR_ECDH(otr),
+      t->parts, AUTH_MESSAGE_PARTS);
+  auth_message_destroy(t);
 
   return err == OTR4_SUCCESS;
 }
@@ -936,19 +904,33 @@ static otr4_err_t receive_auth_i(string_t *dst, const uint8_t *buff,
   return double_ratcheting_init(1, otr);
 }
 
+/* The TLVs follow the NUL that ends the message */
+static const uint8_t *find_tlvs(size_t *tlvs_len, const uint8_t *src,
+                                size_t len) {
+  const uint8_t *tlvs_start = memchr(src, 0, len);
+  if (!tlvs_start)
+    return NULL;
+
+  *tlvs_len = len - (tlvs_start + 1 - src);
+  return tlvs_start + 1;
+}
+
+/* Copies the TLVs for the response. Padding only hides the message's
+ * length, so it is left out. */
 static void extract_tlvs(tlv_t **tlvs, const uint8_t *src, size_t len) {
   if (!tlvs)
     return;
 
-  uint8_t *tlvs_start = memchr(src, 0, len);
+  size_t tlvs_len = 0;
+  const uint8_t *tlvs_start = find_tlvs(&tlvs_len, src, len);
   if (!tlvs_start)
     return;
 
-  size_t tlvs_len = len - (tlvs_start + 1 - src);
-  *tlvs = otrv4_parse_tlvs(tlvs_start + 1, tlvs_len);
+  *tlvs = otrv4_parse_tlvs_unpadded(tlvs_start, tlvs_len);
 }
 
-static otr4_err_t decrypt_data_msg(otrv4_response_t *response,
+/* Leaves the plaintext in plain, for the TLVs to be read from */
+static otr4_err_t decrypt_data_msg(uint8_t **plain, otrv4_response_t *response,
                                    const m_enc_key_t enc_key,
                                    const data_message_t *msg) {
   string_t *dst = &response->to_display;
@@ -962,19 +944,17 @@ static otr4_err_t decrypt_data_msg(otrv4_response_t *response,
   otrv4_memdump(msg->nonce, DATA_MSG_NONCE_BYTES);
 #endif
 
-  uint8_t *plain = malloc(msg->enc_msg_len);
-  if (!plain)
+  *plain = malloc(msg->enc_msg_len);
+  if (!*plain)
     return OTR4_ERROR;
 
-  int err = crypto_stream_xor(plain, msg->enc_msg, msg->enc_msg_len, msg->nonce,
-                              enc_key);
+  int err = crypto_stream_xor(*plain, msg->enc_msg, msg->enc_msg_len,
+                              msg->nonce, enc_key);
 
-  if (strnlen((string_t)plain, msg->enc_msg_len))
-    *dst = otrv4_strndup((char *)plain, msg->enc_msg_len);
+  if (strnlen((string_t)*plain, msg->enc_msg_len))
+    *dst = otrv4_strndup((char *)*plain, msg->enc_msg_len);
 
-  extract_tlvs(tlvs, plain, msg->enc_msg_len);
-
-  free(plain);
+  extract_tlvs(tlvs, *plain, msg->enc_msg_len);
 
   if (err == 0) {
     return OTR4_SUCCESS;
@@ -982,11 +962,12 @@ static otr4_err_t decrypt_data_msg(otrv4_response_t *response,
 
   // TODO: correctly free
   otrv4_tlv_free(*tlvs);
+  *tlvs = NULL;
   return OTR4_ERROR;
 }
 
 static tlv_t *otrv4_process_smp(otr4_smp_event_t event, smp_context_t smp,
-                                const tlv_t *tlv) {
+                                const tlv_view_t *tlv) {
   event = OTRV4_SMPEVENT_NONE;
   tlv_t *to_send = NULL;
 
@@ -1029,7 +1010,7 @@ static tlv_t *otrv4_process_smp(otr4_smp_event_t event, smp_context_t smp,
   return to_send;
 }
 
-static tlv_t *process_tlv(const tlv_t *tlv, otrv4_t *otr) {
+static tlv_t *process_tlv(const tlv_view_t *tlv, otrv4_t *otr) {
   if (tlv->type == OTRV4_TLV_NONE) {
     return NULL;
   }
@@ -1054,14 +1035,22 @@ static tlv_t *process_tlv(const tlv_t *tlv, otrv4_t *otr) {
   return out;
 }
 
-static otr4_err_t receive_tlvs(tlv_t **to_send, otrv4_response_t *response,
-                               otrv4_t *otr) {
+static otr4_err_t receive_tlvs(tlv_t **to_send, const uint8_t *plain,
+                               size_t plain_len, otrv4_t *otr) {
   tlv_t *cursor = NULL;
+  size_t tlvs_len = 0;
+  const uint8_t *tlvs = find_tlvs(&tlvs_len, plain, plain_len);
+
+  *to_send = NULL;
+  if (!tlvs)
+    return OTR4_SUCCESS;
+
+  tlv_view_t current[1];
+  tlv_iter_t it[1];
 
-  const tlv_t *current = response->tlvs;
-  while (current) {
+  otrv4_tlv_iter_init(it, tlvs, tlvs_len);
+  while (otrv4_tlv_iter_next(current, it)) {
     tlv_t *ret = process_tlv(current, otr);
-    current = current->next;
 
     if (!ret)
       continue;
@@ -1099,34 +1088,26 @@ static otr4_err_t otrv4_receive_data_message(otrv4_response_t *response,
   memset(enc_key, 0, sizeof(m_enc_key_t));
   memset(mac_key, 0, sizeof(m_mac_key_t));
 
-  uint8_t *to_store_mac = malloc(MAC_KEY_BYTES);
-  if (to_store_mac == NULL) {
-    data_message_free(msg);
-    return OTR4_ERROR;
-  }
-
   // TODO: warn the user and send an error message with a code.
   if (otr->state != OTRV4_STATE_ENCRYPTED_MESSAGES) {
     data_message_free(msg);
-    free(to_store_mac);
     return OTR4_ERROR;
   }
 
   if (data_message_deserialize(msg, buff, buflen)) {
     data_message_free(msg);
-    free(to_store_mac);
     return OTR4_ERROR;
   }
 
   key_manager_set_their_keys(msg->ecdh, msg->dh, otr->keys);
 
   tlv_t *reply_tlv = NULL;
+  uint8_t *plain = NULL;
 
   do {
     if (msg->receiver_instance_tag != otr->our_instance_tag) {
       response->to_display = NULL;
       data_message_free(msg);
-      free(to_store_mac);
 
       return OTR4_SUCCESS;
     }
@@ -1137,22 +1118,26 @@ static otr4_err_t otrv4_receive_data_message(otrv4_response_t *response,
     if (!valid_data_message(mac_key, msg))
       continue;
 
-    if (decrypt_data_msg(response, enc_key, msg))
+    if (key_manager_consume_receiving_chain_key(msg->message_id, otr->keys))
       continue;
 
-    // TODO: Securely delete receiving chain keys older than message_id-1.
+    if (decrypt_data_msg(&plain, response, enc_key, msg))
+      continue;
 
-    if (receive_tlvs(&reply_tlv, response, otr))
+    if (receive_tlvs(&reply_tlv, plain, msg->enc_msg_len, otr))
       continue;
 
+    free(plain);
+    plain = NULL;
+
     key_manager_prepare_to_ratchet(otr->keys);
 
     if (reply_tlv)
       if (otrv4_prepare_to_send_message(&response->to_send, "", reply_tlv, otr))
         continue;
 
-    memcpy(to_store_mac, mac_key, MAC_KEY_BYTES);
-    otr->keys->old_mac_keys = list_add(to_store_mac, otr->keys->old_mac_keys);
+    if (key_manager_store_old_mac_key(mac_key, otr->keys))
+      continue;
 
     sodium_memzero(enc_key, sizeof(enc_key));
     sodium_memzero(mac_key, sizeof(mac_key));
@@ -1162,9 +1147,7 @@ static otr4_err_t otrv4_receive_data_message(otrv4_response_t *response,
     return OTR4_SUCCESS;
   } while (0);
 
-  free(to_store_mac);
-  to_store_mac = NULL;
-
+  free(plain);
   data_message_free(msg);
   otrv4_tlv_free(reply_tlv);
 
@@ -1302,97 +1285,17 @@ static data_message_t *generate_data_msg(const otrv4_t *otr) {
   data_msg->message_id = otr->keys->j;
   ec_point_copy(data_msg->ecdh, OUR_ECDH(otr));
   data_msg->dh = dh_mpi_copy(OUR_DH(otr));
-
-  return data_msg;
-}
-
-static otr4_err_t encrypt_data_message(data_message_t *data_msg,
-                                       const uint8_t *message,
-                                       size_t message_len,
-                                       const m_enc_key_t enc_key) {
-  int err = 0;
-  uint8_t *c = NULL;
-
   random_bytes(data_msg->nonce, sizeof(data_msg->nonce));
 
-  c = malloc(message_len);
-  if (!c)
-    return OTR4_ERROR;
-
-  // TODO: message is an UTF-8 string. Is there any problem to cast
-  // it to (unsigned char *)
-  err = crypto_stream_xor(c, message, message_len, data_msg->nonce, enc_key);
-  if (err) {
-    free(c);
-    return OTR4_ERROR;
-  }
-
-  data_msg->enc_msg_len = message_len;
-
-  data_msg->enc_msg = malloc(data_msg->enc_msg_len);
-  if (!data_msg->enc_msg)
-    return OTR4_ERROR;
-
-  data_msg->enc_msg = c;
-
-#ifdef DEBUG
-  printf("nonce = ");
-  otrv4_memdump(data_msg->nonce, DATA_MSG_NONCE_BYTES);
-  printf("msg = ");
-  otrv4_memdump(message, message_len);
-  printf("cipher = ");
-  otrv4_memdump(c, message_len);
-#endif
-
-  return OTR4_SUCCESS;
-}
-
-static otr4_err_t serialize_and_encode_data_msg(
-    string_t *dst, const m_mac_key_t mac_key, uint8_t *to_reveal_mac_keys,
-    size_t to_reveal_mac_keys_len, const data_message_t *data_msg) {
-  uint8_t *body = NULL;
-  size_t bodylen = 0;
-
-  if (data_message_body_asprintf(&body, &bodylen, data_msg))
-    return OTR4_ERROR;
-
-  size_t serlen = bodylen + MAC_KEY_BYTES + to_reveal_mac_keys_len;
-  uint8_t *ser = malloc(serlen);
-  if (!ser) {
-    free(body);
-    return OTR4_ERROR;
-  }
-
-  memcpy(ser, body, bodylen);
-  free(body);
-
-  shake_256_mac(ser + bodylen, MAC_KEY_BYTES, mac_key, sizeof(m_mac_key_t), ser,
-                bodylen);
-
-  serialize_bytes_array(ser + bodylen + DATA_MSG_MAC_BYTES, to_reveal_mac_keys,
-                        to_reveal_mac_keys_len);
-
-  *dst = otrl_base64_otr_encode(ser, serlen);
-  free(ser);
-
-  return OTR4_SUCCESS;
+  return data_msg;
 }
 
 static otr4_err_t send_data_message(string_t *to_send, const uint8_t *message,
                                     size_t message_len, otrv4_t *otr) {
   data_message_t *data_msg = NULL;
 
-
-  size_t serlen = list_len(otr->keys->old_mac_keys) * MAC_KEY_BYTES;
-
-  uint8_t *ser_mac_keys =
-      key_manager_old_mac_keys_serialize(otr->keys->old_mac_keys);
-  otr->keys->old_mac_keys = NULL;
-
-  if (key_manager_prepare_next_chain_key(otr->keys)) {
-    free(ser_mac_keys);
+  if (key_manager_prepare_next_chain_key(otr->keys))
     return OTR4_ERROR;
-  }
 
   m_enc_key_t enc_key;
   m_mac_key_t mac_key;
@@ -1400,7 +1303,6 @@ static otr4_err_t send_data_message(string_t *to_send, const uint8_t *message,
   memset(mac_key, 0, sizeof(m_mac_key_t));
 
   if (key_manager_retrieve_sending_message_keys(enc_key, mac_key, otr->keys)) {
-    free(ser_mac_keys);
     sodium_memzero(enc_key, sizeof(m_enc_key_t));
     sodium_memzero(mac_key, sizeof(m_mac_key_t));
     return OTR4_ERROR;
@@ -1410,78 +1312,67 @@ static otr4_err_t send_data_message(string_t *to_send, const uint8_t *message,
   if (!data_msg) {
     sodium_memzero(enc_key, sizeof(m_enc_key_t));
     sodium_memzero(mac_key, sizeof(m_mac_key_t));
-    free(ser_mac_keys);
     return OTR4_ERROR;
   }
 
   data_msg->sender_instance_tag = otr->our_instance_tag;
   data_msg->receiver_instance_tag = otr->their_instance_tag;
 
+  /* Reveal the MAC keys of the messages received so far */
   otr4_err_t err = OTR4_ERROR;
-  if (encrypt_data_message(data_msg, message, message_len, enc_key) ==
-          OTR4_SUCCESS &&
-      serialize_and_encode_data_msg(to_send, mac_key, ser_mac_keys, serlen,
-                                    data_msg) == OTR4_SUCCESS) {
+  if (data_message_encode(to_send, data_msg, message, message_len, enc_key,
+                          mac_key, otr->keys->old_mac_keys->keys,
+                          key_manager_old_mac_keys_len(otr->keys)) ==
+      OTR4_SUCCESS) {
     // TODO: Change the spec to say this should be incremented after the message
     // is sent.
     otr->keys->j++;
+    key_manager_forget_old_mac_keys(otr->keys);
     err = OTR4_SUCCESS;
   }
 
   sodium_memzero(enc_key, sizeof(m_enc_key_t));
   sodium_memzero(mac_key, sizeof(m_mac_key_t));
-  free(ser_mac_keys);
   data_message_free(data_msg);
 
   return err;
 }
 
-static otr4_err_t serialize_tlvs(uint8_t **dst, size_t *dstlen,
-                                  const tlv_t *tlvs) {
-  const tlv_t *current = tlvs;
-  uint8_t *cursor = NULL;
-
-  *dst = NULL;
-  *dstlen = 0;
-
-  if (!tlvs)
-    return OTR4_SUCCESS;
+/* Writes the message, its NUL, the TLVs and a zeroed padding TLV in one
+ * pass, into the buffer that will be encrypted. */
+static otr4_err_t build_plaintext(uint8_t **dst, size_t *dstlen,
+                                  const string_t message, const tlv_t *tlvs,
+                                  const otrv4_padding_policy_t *padding) {
+  const tlv_t *current = NULL;
+  size_t message_len = strlen(message);
+  bool padded = padding->mode != OTRV4_PADDING_NONE;
+  uint16_t padding_len = otrv4_padding_len(padding, message_len);
 
-  for (*dstlen = 0; current; current = current->next)
+  *dstlen = message_len + 1 + (padded ? 4 + padding_len : 0);
+  for (current = tlvs; current; current = current->next)
     *dstlen += current->len + 4;
 
   *dst = malloc(*dstlen);
   if (!*dst)
     return OTR4_ERROR;
 
-  cursor = *dst;
+  uint8_t *cursor = *dst;
+  cursor += serialize_bytes_array(cursor, (const uint8_t *)message,
+                                  message_len + 1);
+
   for (current = tlvs; current; current = current->next) {
     cursor += serialize_uint16(cursor, current->type);
     cursor += serialize_uint16(cursor, current->len);
     cursor += serialize_bytes_array(cursor, current->data, current->len);
   }
 
-  return OTR4_SUCCESS;
-}
-
-static otr4_err_t append_tlvs(uint8_t **dst, size_t *dstlen,
-                              const string_t message, const tlv_t *tlvs) {
-  uint8_t *ser = NULL;
-  size_t len = 0;
-
-  if (serialize_tlvs(&ser, &len, tlvs))
-    return OTR4_ERROR;
-
-  *dstlen = strlen(message) + 1 + len;
-  *dst = malloc(*dstlen);
-  if (!*dst) {
-    free(ser);
-    return OTR4_ERROR;
-  }
+  if (!padded)
+    return OTR4_SUCCESS;
 
-  memcpy(stpcpy((char *)*dst, message) + 1, ser, len);
+  cursor += serialize_uint16(cursor, OTRV4_TLV_PADDING);
+  cursor += serialize_uint16(cursor, padding_len);
+  memset(cursor, 0, padding_len);
 
-  free(ser);
   return OTR4_SUCCESS;
 }
 
@@ -1498,7 +1389,9 @@ static otr4_err_t otrv4_prepare_to_send_data_message(string_t *to_send,
   if (otr->state != OTRV4_STATE_ENCRYPTED_MESSAGES)
     return OTR4_STATE_NOT_ENCRYPTED; // TODO: queue message
 
-  if (append_tlvs(&msg, &msg_len, message, tlvs))
+  otrv4_padding_policy_t padding =
+      otr4_client_state_get_padding(otr->conversation->client);
+  if (build_plaintext(&msg, &msg_len, message, tlvs, &padding))
     return OTR4_ERROR;
 
   otr4_err_t err = send_data_message(to_send, msg, msg_len, otr);
@@ -1513,8 +1406,6 @@ otr4_err_t otrv4_prepare_to_send_message(string_t *to_send,
   if (!otr)
     return OTR4_ERROR;
 
-  append_padding_tlv(tlvs, strlen(message));
-
   switch (otr->running_version) {
   case OTRV4_VERSION_3:
     return otrv3_send_message(to_send, message, tlvs, otr->otr3_conn);
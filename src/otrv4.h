@@ -22,6 +22,7 @@
 #define OTR4_FREE                                                              \
   do {                                                                         \
     dh_free();                                                                 \
+    user_profile_cache_clear();                                                \
   } while (0);
 
 static int otrl_initialized = 0;
@@ -62,7 +63,8 @@ typedef struct {
   int allows;
 } otrv4_policy_t;
 
-// TODO: This is a single instance conversation. Make it multi-instance.
+/* A conversation with one of the peer's instances. otr4_client_t routes
+ * the messages from each instance to a connection of its own. */
 typedef struct otr4_conversation_state_t {
   /* void *opdata; // Could have a conversation opdata to point to a, say
    PurpleConversation */
@@ -111,7 +113,7 @@ typedef enum {
 typedef struct {
   string_t to_display;
   string_t to_send;
-  tlv_t *tlvs;
+  tlv_t *tlvs; /* Those received, except padding */
   otrv4_warning_t warning;
 } otrv4_response_t;
 
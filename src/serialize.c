@@ -66,21 +66,15 @@ size_t serialize_ec_scalar(uint8_t *dst, const ec_scalar_t scalar) {
 
 otr4_err_t serialize_dh_public_key(uint8_t *dst, size_t *len,
                                    const dh_public_key_t pub) {
-  /* From gcrypt MPI */
-  uint8_t buf[DH3072_MOD_LEN_BYTES] = {0};
-  memset(buf, 0, DH3072_MOD_LEN_BYTES);
+  /* The gcrypt MPI goes straight after its OTR MPI length prefix */
   size_t written = 0;
-  otr4_err_t err = dh_mpi_serialize(buf, DH3072_MOD_LEN_BYTES, &written, pub);
+  otr4_err_t err =
+      dh_mpi_serialize(dst + 4, DH3072_MOD_LEN_BYTES, &written, pub);
   if (err) {
     return err;
   }
-  // To OTR MPI
-  // TODO: Maybe gcrypt MPI already has some API for this.
-  // gcry_mpi_print with a different format, maybe?
-  otr_mpi_t mpi;
-  otr_mpi_set(mpi, buf, written);
-  *len = serialize_mpi(dst, mpi);
-  otr_mpi_free(mpi);
+
+  *len = serialize_uint32(dst, written) + written;
   return OTR4_SUCCESS;
 }
 
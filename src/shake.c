@@ -0,0 +1,334 @@
+#include "shake.h"
+
+#include <sodium.h>
+
+/*
+** Multi-lane SHAKE-256
+**
+** Up to SHAKE_KDF_LANES sponges absorb inputs of the same length, so they
+** reach every block boundary together. Each state word is stored for all
+** lanes side by side, and the AVX2 kernel permutes all of them with one
+** instruction per step. The scalar kernel permutes the lanes in turn.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHAKE_X86
+#include <immintrin.h>
+#endif
+
+#define SHAKE_256_RATE 136
+#define KECCAK_ROUNDS 24
+
+static const uint64_t round_constants[KECCAK_ROUNDS] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a,
+    0x8000000080008000, 0x000000000000808b, 0x0000000080000001,
+    0x8000000080008081, 0x8000000000008009, 0x000000000000008a,
+    0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089,
+    0x8000000000008003, 0x8000000000008002, 0x8000000000000080,
+    0x000000000000800a, 0x800000008000000a, 0x8000000080008081,
+    0x8000000000008080, 0x0000000080000001, 0x8000000080008008,
+};
+
+/* One Keccak-f[1600] permutation of a[25], in terms of the word operations
+ * XOR, ANDN (~x & y), ROL by a constant and RC (a round constant) */
+#define KECCAK_F1600(word_t, a, XOR, ANDN, ROL, RC)                            \
+  do {                                                                         \
+    word_t b[25], c[5], d[5];                                                  \
+    for (int round = 0; round < KECCAK_ROUNDS; round++) {                      \
+      c[0] = XOR(XOR(XOR(a[0], a[5]), XOR(a[10], a[15])), a[20]);              \
+      c[1] = XOR(XOR(XOR(a[1], a[6]), XOR(a[11], a[16])), a[21]);              \
+      c[2] = XOR(XOR(XOR(a[2], a[7]), XOR(a[12], a[17])), a[22]);              \
+      c[3] = XOR(XOR(XOR(a[3], a[8]), XOR(a[13], a[18])), a[23]);              \
+      c[4] = XOR(XOR(XOR(a[4], a[9]), XOR(a[14], a[19])), a[24]);              \
+      d[0] = XOR(c[4], ROL(c[1], 1));                                          \
+      d[1] = XOR(c[0], ROL(c[2], 1));                                          \
+      d[2] = XOR(c[1], ROL(c[3], 1));                                          \
+      d[3] = XOR(c[2], ROL(c[4], 1));                                          \
+      d[4] = XOR(c[3], ROL(c[0], 1));                                          \
+      b[0] = XOR(a[0], d[0]);                                                  \
+      b[10] = ROL(XOR(a[1], d[1]), 1);                                         \
+      b[20] = ROL(XOR(a[2], d[2]), 62);                                        \
+      b[5] = ROL(XOR(a[3], d[3]), 28);                                         \
+      b[15] = ROL(XOR(a[4], d[4]), 27);                                        \
+      b[16] = ROL(XOR(a[5], d[0]), 36);                                        \
+      b[1] = ROL(XOR(a[6], d[1]), 44);                                         \
+      b[11] = ROL(XOR(a[7], d[2]), 6);                                         \
+      b[21] = ROL(XOR(a[8], d[3]), 55);                                        \
+      b[6] = ROL(XOR(a[9], d[4]), 20);                                         \
+      b[7] = ROL(XOR(a[10], d[0]), 3);                                         \
+      b[17] = ROL(XOR(a[11], d[1]), 10);                                       \
+      b[2] = ROL(XOR(a[12], d[2]), 43);                                        \
+      b[12] = ROL(XOR(a[13], d[3]), 25);                                       \
+      b[22] = ROL(XOR(a[14], d[4]), 39);                                       \
+      b[23] = ROL(XOR(a[15], d[0]), 41);                                       \
+      b[8] = ROL(XOR(a[16], d[1]), 45);                                        \
+      b[18] = ROL(XOR(a[17], d[2]), 15);                                       \
+      b[3] = ROL(XOR(a[18], d[3]), 21);                                        \
+      b[13] = ROL(XOR(a[19], d[4]), 8);                                        \
+      b[14] = ROL(XOR(a[20], d[0]), 18);                                       \
+      b[24] = ROL(XOR(a[21], d[1]), 2);                                        \
+      b[9] = ROL(XOR(a[22], d[2]), 61);                                        \
+      b[19] = ROL(XOR(a[23], d[3]), 56);                                       \
+      b[4] = ROL(XOR(a[24], d[4]), 14);                                        \
+      a[0] = XOR(b[0], ANDN(b[1], b[2]));                                      \
+      a[1] = XOR(b[1], ANDN(b[2], b[3]));                                      \
+      a[2] = XOR(b[2], ANDN(b[3], b[4]));                                      \
+      a[3] = XOR(b[3], ANDN(b[4], b[0]));                                      \
+      a[4] = XOR(b[4], ANDN(b[0], b[1]));                                      \
+      a[5] = XOR(b[5], ANDN(b[6], b[7]));                                      \
+      a[6] = XOR(b[6], ANDN(b[7], b[8]));                                      \
+      a[7] = XOR(b[7], ANDN(b[8], b[9]));                                      \
+      a[8] = XOR(b[8], ANDN(b[9], b[5]));                                      \
+      a[9] = XOR(b[9], ANDN(b[5], b[6]));                                      \
+      a[10] = XOR(b[10], ANDN(b[11], b[12]));                                  \
+      a[11] = XOR(b[11], ANDN(b[12], b[13]));                                  \
+      a[12] = XOR(b[12], ANDN(b[13], b[14]));                                  \
+      a[13] = XOR(b[13], ANDN(b[14], b[10]));                                  \
+      a[14] = XOR(b[14], ANDN(b[10], b[11]));                                  \
+      a[15] = XOR(b[15], ANDN(b[16], b[17]));                                  \
+      a[16] = XOR(b[16], ANDN(b[17], b[18]));                                  \
+      a[17] = XOR(b[17], ANDN(b[18], b[19]));                                  \
+      a[18] = XOR(b[18], ANDN(b[19], b[15]));                                  \
+      a[19] = XOR(b[19], ANDN(b[15], b[16]));                                  \
+      a[20] = XOR(b[20], ANDN(b[21], b[22]));                                  \
+      a[21] = XOR(b[21], ANDN(b[22], b[23]));                                  \
+      a[22] = XOR(b[22], ANDN(b[23], b[24]));                                  \
+      a[23] = XOR(b[23], ANDN(b[24], b[20]));                                  \
+      a[24] = XOR(b[24], ANDN(b[20], b[21]));                                  \
+      a[0] = XOR(a[0], RC(round_constants[round]));                            \
+    }                                                                          \
+  } while (0)
+
+typedef struct {
+  uint64_t state[25][SHAKE_KDF_LANES];
+  size_t lanes;
+  size_t position;
+} sponge_lanes_t;
+
+static int lanes_kernel = -1;
+
+static shake_lanes_kernel_t shake_lanes_supported_kernel(void) {
+#ifdef SHAKE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SHAKE_LANES_AVX2;
+#endif
+  return SHAKE_LANES_SCALAR;
+}
+
+shake_lanes_kernel_t shake_lanes_kernel(void) {
+  if (lanes_kernel < 0)
+    lanes_kernel = shake_lanes_supported_kernel();
+
+  return lanes_kernel;
+}
+
+shake_lanes_kernel_t shake_lanes_set_kernel(shake_lanes_kernel_t kernel) {
+  shake_lanes_kernel_t supported = shake_lanes_supported_kernel();
+  lanes_kernel = kernel < supported ? kernel : supported;
+
+  return lanes_kernel;
+}
+
+#define XOR64(x, y) ((x) ^ (y))
+#define ANDN64(x, y) (~(x) & (y))
+#define ROL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+#define RC64(rc) (rc)
+
+static void keccak_f1600(uint64_t a[25]) {
+  KECCAK_F1600(uint64_t, a, XOR64, ANDN64, ROL64, RC64);
+}
+
+static void scalar_permute(sponge_lanes_t *sponge) {
+  uint64_t a[25];
+
+  for (size_t lane = 0; lane < sponge->lanes; lane++) {
+    for (int i = 0; i < 25; i++)
+      a[i] = sponge->state[i][lane];
+
+    keccak_f1600(a);
+
+    for (int i = 0; i < 25; i++)
+      sponge->state[i][lane] = a[i];
+  }
+
+  sodium_memzero(a, sizeof(a));
+}
+
+#ifdef SHAKE_X86
+
+#define XOR256 _mm256_xor_si256
+#define ANDN256 _mm256_andnot_si256
+#define ROL256(x, n)                                                           \
+  _mm256_or_si256(_mm256_slli_epi64((x), (n)), _mm256_srli_epi64((x), 64 - (n)))
+#define RC256(rc) _mm256_set1_epi64x((long long)(rc))
+
+__attribute__((target("avx2"))) static void
+avx2_permute(sponge_lanes_t *sponge) {
+  __m256i a[25];
+
+  for (int i = 0; i < 25; i++)
+    a[i] = _mm256_loadu_si256((const __m256i *)sponge->state[i]);
+
+  KECCAK_F1600(__m256i, a, XOR256, ANDN256, ROL256, RC256);
+
+  for (int i = 0; i < 25; i++)
+    _mm256_storeu_si256((__m256i *)sponge->state[i], a[i]);
+
+  sodium_memzero(a, sizeof(a));
+}
+
+#endif
+
+static void permute(sponge_lanes_t *sponge) {
+  switch (shake_lanes_kernel()) {
+#ifdef SHAKE_X86
+  case SHAKE_LANES_AVX2:
+    avx2_permute(sponge);
+    return;
+#endif
+  default:
+    scalar_permute(sponge);
+  }
+}
+
+static void sponge_lanes_init(sponge_lanes_t *sponge, size_t lanes) {
+  memset(sponge->state, 0, sizeof(sponge->state));
+  sponge->lanes = lanes;
+  sponge->position = 0;
+}
+
+static inline uint64_t load64_le(const uint8_t *src) {
+  uint64_t word = 0;
+  for (int i = 7; i >= 0; i--)
+    word = (word << 8) | src[i];
+
+  return word;
+}
+
+static inline void store64_le(uint8_t *dst, uint64_t word) {
+  for (int i = 0; i < 8; i++, word >>= 8)
+    dst[i] = word;
+}
+
+/* Moves on by step bytes, permuting at the end of each block */
+static void sponge_lanes_advance(sponge_lanes_t *sponge, size_t step) {
+  sponge->position += step;
+  if (sponge->position == SHAKE_256_RATE) {
+    permute(sponge);
+    sponge->position = 0;
+  }
+}
+
+/* Absorbs len bytes from each of in[0], ..., in[lanes - 1] */
+static void sponge_lanes_absorb(sponge_lanes_t *sponge,
+                                const uint8_t *const *in, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    uint64_t *word = sponge->state[sponge->position / 8];
+    unsigned offset = sponge->position % 8;
+
+    /* The rate is whole words, so a word never straddles two blocks */
+    if (!offset && len - i >= 8) {
+      for (size_t lane = 0; lane < sponge->lanes; lane++)
+        word[lane] ^= load64_le(in[lane] + i);
+
+      i += 8;
+      sponge_lanes_advance(sponge, 8);
+      continue;
+    }
+
+    for (size_t lane = 0; lane < sponge->lanes; lane++)
+      word[lane] ^= (uint64_t)in[lane][i] << (8 * offset);
+
+    i++;
+    sponge_lanes_advance(sponge, 1);
+  }
+}
+
+static void sponge_lanes_pad(sponge_lanes_t *sponge) {
+  const uint8_t last = 0x80;
+  const uint8_t *ends[SHAKE_KDF_LANES] = {&last, &last, &last, &last};
+
+  /* SHAKE domain bits and the first padding bit */
+  for (size_t lane = 0; lane < sponge->lanes; lane++)
+    sponge->state[sponge->position / 8][lane] ^=
+        (uint64_t)0x1f << (8 * (sponge->position % 8));
+
+  sponge->position = SHAKE_256_RATE - 1;
+  sponge_lanes_absorb(sponge, ends, 1);
+}
+
+/* Squeezes len[lane] bytes into each of out[0], ..., out[lanes - 1] */
+static void sponge_lanes_squeeze(sponge_lanes_t *sponge, uint8_t *const *out,
+                                 const size_t *len) {
+  size_t longest = 0;
+  for (size_t lane = 0; lane < sponge->lanes; lane++)
+    if (len[lane] > longest)
+      longest = len[lane];
+
+  size_t i = 0;
+  while (i < longest) {
+    const uint64_t *word = sponge->state[sponge->position / 8];
+    unsigned offset = sponge->position % 8;
+
+    if (!offset && longest - i >= 8) {
+      for (size_t lane = 0; lane < sponge->lanes; lane++)
+        if (i < len[lane] && len[lane] - i >= 8)
+          store64_le(out[lane] + i, word[lane]);
+        else
+          for (size_t j = i; j < len[lane]; j++)
+            out[lane][j] = word[lane] >> (8 * (j - i));
+
+      i += 8;
+      sponge_lanes_advance(sponge, 8);
+      continue;
+    }
+
+    for (size_t lane = 0; lane < sponge->lanes; lane++)
+      if (i < len[lane])
+        out[lane][i] = word[lane] >> (8 * offset);
+
+    i++;
+    sponge_lanes_advance(sponge, 1);
+  }
+}
+
+static void kdf_lanes(const shake_kdf_lane_t *lanes, size_t count,
+                      const uint8_t *secret, size_t secretlen) {
+  const uint8_t *dom = (const uint8_t *)"OTR4";
+  const uint8_t *doms[SHAKE_KDF_LANES], *magics[SHAKE_KDF_LANES],
+      *secrets[SHAKE_KDF_LANES];
+  uint8_t *keys[SHAKE_KDF_LANES];
+  size_t keylens[SHAKE_KDF_LANES];
+
+  for (size_t lane = 0; lane < count; lane++) {
+    doms[lane] = dom;
+    magics[lane] = &lanes[lane].magic;
+    secrets[lane] = secret;
+    keys[lane] = lanes[lane].key;
+    keylens[lane] = lanes[lane].keylen;
+  }
+
+  sponge_lanes_t sponge[1];
+  sponge_lanes_init(sponge, count);
+  sponge_lanes_absorb(sponge, doms, strlen("OTR4"));
+  sponge_lanes_absorb(sponge, magics, 1);
+  sponge_lanes_absorb(sponge, secrets, secretlen);
+  sponge_lanes_pad(sponge);
+  sponge_lanes_squeeze(sponge, keys, keylens);
+
+  sodium_memzero(sponge, sizeof(sponge_lanes_t));
+}
+
+void shake_256_kdf_lanes(const shake_kdf_lane_t *lanes, size_t count,
+                         const uint8_t *secret, size_t secretlen) {
+  while (count) {
+    size_t group = count < SHAKE_KDF_LANES ? count : SHAKE_KDF_LANES;
+    kdf_lanes(lanes, group, secret, secretlen);
+
+    lanes += group;
+    count -= group;
+  }
+}
@@ -1,3 +1,10 @@
+#ifndef SHAKE_H
+#define SHAKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "decaf/shake.h"
 
 #define hash_init decaf_shake256_init
@@ -37,3 +44,32 @@ static inline void shake_256_kdf(uint8_t *key, size_t keylen,
                                  size_t secretlen) {
   shake_kkdf(key, keylen, magic, 1, secret, secretlen);
 }
+
+/* Kernels shake_256_kdf_lanes can use. They give the same results, the
+ * default being the fastest the CPU supports. */
+typedef enum {
+  SHAKE_LANES_SCALAR,
+  SHAKE_LANES_AVX2,
+} shake_lanes_kernel_t;
+
+shake_lanes_kernel_t shake_lanes_kernel(void);
+
+/* Use kernel, or the fastest supported one below it. Returns the kernel in
+ * use. Meant for tests and benchmarks. */
+shake_lanes_kernel_t shake_lanes_set_kernel(shake_lanes_kernel_t kernel);
+
+/* Derivations computed side by side in one Keccak state */
+#define SHAKE_KDF_LANES 4
+
+typedef struct {
+  uint8_t *key;
+  size_t keylen;
+  uint8_t magic;
+} shake_kdf_lane_t;
+
+/* Same as shake_256_kdf into each lane's key, with its magic, from the same
+ * secret, but the lanes are hashed together. */
+void shake_256_kdf_lanes(const shake_kdf_lane_t *lanes, size_t count,
+                         const uint8_t *secret, size_t secretlen);
+
+#endif
@@ -0,0 +1,210 @@
+#include "shard.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+#include "str.h"
+
+typedef enum {
+  SHARD_JOB_RECEIVE,
+  SHARD_JOB_SEND,
+} shard_job_kind_t;
+
+struct otr4_shard_job_t {
+  shard_job_kind_t kind;
+  void *client_id;
+  char *recipient;
+  char *message;
+  otr4_shard_done_fn done;
+  void *data;
+
+  otr4_shard_job_t *next;
+};
+
+static void job_free(otr4_shard_job_t *job) {
+  free(job->recipient);
+  job->recipient = NULL;
+
+  free(job->message);
+  job->message = NULL;
+
+  free(job);
+}
+
+static void run_job(otr4_userstate_t *state, const otr4_shard_job_t *job) {
+  char *to_send = NULL, *to_display = NULL;
+  int result = 1;
+
+  otr4_client_t *client = otr4_messaging_client_get(state, job->client_id);
+  if (client && job->kind == SHARD_JOB_RECEIVE)
+    result = otr4_client_receive(&to_send, &to_display, job->message,
+                                 job->recipient, client);
+  else if (client)
+    result = otr4_client_send(&to_send, job->message, job->recipient, client);
+
+  if (job->done) {
+    job->done(result, to_send, to_display, job->data);
+    return;
+  }
+
+  free(to_send);
+  free(to_display);
+}
+
+static void *process_jobs(void *data) {
+  otr4_shard_t *shard = data;
+
+  pthread_mutex_lock(&shard->lock);
+  while (true) {
+    while (shard->running && !shard->first)
+      pthread_cond_wait(&shard->wakeup, &shard->lock);
+
+    /* Only stop once every submitted job has run */
+    otr4_shard_job_t *job = shard->first;
+    if (!job)
+      break;
+
+    shard->first = job->next;
+    if (!shard->first)
+      shard->last = NULL;
+
+    pthread_mutex_unlock(&shard->lock);
+    run_job(shard->state, job);
+    job_free(job);
+    pthread_mutex_lock(&shard->lock);
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  return NULL;
+}
+
+static otr4_err_t shard_start(otr4_shard_t *shard, otr4_userstate_t *state) {
+  shard->state = state;
+  shard->first = NULL;
+  shard->last = NULL;
+  shard->running = true;
+
+  pthread_mutex_init(&shard->lock, NULL);
+  pthread_cond_init(&shard->wakeup, NULL);
+
+  if (pthread_create(&shard->worker, NULL, process_jobs, shard)) {
+    pthread_cond_destroy(&shard->wakeup);
+    pthread_mutex_destroy(&shard->lock);
+    return OTR4_ERROR;
+  }
+
+  return OTR4_SUCCESS;
+}
+
+static void shard_stop(otr4_shard_t *shard) {
+  pthread_mutex_lock(&shard->lock);
+  shard->running = false;
+  pthread_cond_signal(&shard->wakeup);
+  pthread_mutex_unlock(&shard->lock);
+
+  pthread_join(shard->worker, NULL);
+
+  pthread_cond_destroy(&shard->wakeup);
+  pthread_mutex_destroy(&shard->lock);
+  shard->state = NULL;
+}
+
+otr4_shards_t *otr4_shards_new(otr4_userstate_t *state, size_t count) {
+  if (!state || !count)
+    return NULL;
+
+  otr4_shards_t *shards = malloc(sizeof(otr4_shards_t));
+  if (!shards)
+    return NULL;
+
+  shards->shards = malloc(count * sizeof(otr4_shard_t));
+  if (!shards->shards) {
+    free(shards);
+    return NULL;
+  }
+
+  for (shards->count = 0; shards->count < count; shards->count++)
+    if (shard_start(&shards->shards[shards->count], state)) {
+      otr4_shards_free(shards);
+      return NULL;
+    }
+
+  return shards;
+}
+
+void otr4_shards_free(otr4_shards_t *shards) {
+  if (!shards)
+    return;
+
+  for (size_t i = 0; i < shards->count; i++)
+    shard_stop(&shards->shards[i]);
+
+  free(shards->shards);
+  shards->shards = NULL;
+  shards->count = 0;
+
+  free(shards);
+}
+
+size_t otr4_shards_index(const otr4_shards_t *shards, void *client_id,
+                         const char *recipient) {
+  size_t hash = hashmap_pointer_hash(client_id);
+  hash = hashmap_hash_bytes(hash, recipient, strlen(recipient));
+
+  return hash % shards->count;
+}
+
+static otr4_err_t submit(otr4_shards_t *shards, shard_job_kind_t kind,
+                         void *client_id, const char *recipient,
+                         const char *message, otr4_shard_done_fn done,
+                         void *data) {
+  if (!shards || !recipient || !message)
+    return OTR4_ERROR;
+
+  otr4_shard_job_t *job = malloc(sizeof(otr4_shard_job_t));
+  if (!job)
+    return OTR4_ERROR;
+
+  job->kind = kind;
+  job->client_id = client_id;
+  job->recipient = otrv4_strdup(recipient);
+  job->message = otrv4_strdup(message);
+  job->done = done;
+  job->data = data;
+  job->next = NULL;
+
+  if (!job->recipient || !job->message) {
+    job_free(job);
+    return OTR4_ERROR;
+  }
+
+  otr4_shard_t *shard =
+      &shards->shards[otr4_shards_index(shards, client_id, recipient)];
+
+  pthread_mutex_lock(&shard->lock);
+  if (shard->last)
+    shard->last->next = job;
+  else
+    shard->first = job;
+
+  shard->last = job;
+  pthread_cond_signal(&shard->wakeup);
+  pthread_mutex_unlock(&shard->lock);
+
+  return OTR4_SUCCESS;
+}
+
+otr4_err_t otr4_shards_receive(otr4_shards_t *shards, void *client_id,
+                               const char *recipient, const char *message,
+                               otr4_shard_done_fn done, void *data) {
+  return submit(shards, SHARD_JOB_RECEIVE, client_id, recipient, message,
+                done, data);
+}
+
+otr4_err_t otr4_shards_send(otr4_shards_t *shards, void *client_id,
+                            const char *recipient, const char *message,
+                            otr4_shard_done_fn done, void *data) {
+  return submit(shards, SHARD_JOB_SEND, client_id, recipient, message, done,
+                data);
+}
@@ -0,0 +1,54 @@
+#ifndef OTR4_SHARD_H
+#define OTR4_SHARD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "error.h"
+#include "messaging.h"
+
+/* Called from the shard's thread once a message has been processed, with
+ * what otr4_client_receive or otr4_client_send returned. It owns to_send and
+ * to_display, either of which may be NULL. */
+typedef void (*otr4_shard_done_fn)(int result, char *to_send,
+                                   char *to_display, void *data);
+
+typedef struct otr4_shard_job_t otr4_shard_job_t;
+
+typedef struct {
+  otr4_userstate_t *state;
+
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  otr4_shard_job_t *first;
+  otr4_shard_job_t *last;
+  bool running;
+} otr4_shard_t;
+
+/* Partitions conversations across shards, each with its own worker thread.
+ * All messages to and from a recipient of a client go, in order, to the same
+ * shard, so no conversation is ever used by two threads. Messages may be
+ * submitted from any thread, once OTR4_INIT has run. */
+typedef struct {
+  otr4_shard_t *shards;
+  size_t count;
+} otr4_shards_t;
+
+otr4_shards_t *otr4_shards_new(otr4_userstate_t *state, size_t count);
+
+/* Waits for the messages already submitted, then stops the workers. */
+void otr4_shards_free(otr4_shards_t *shards);
+
+size_t otr4_shards_index(const otr4_shards_t *shards, void *client_id,
+                         const char *recipient);
+
+otr4_err_t otr4_shards_receive(otr4_shards_t *shards, void *client_id,
+                               const char *recipient, const char *message,
+                               otr4_shard_done_fn done, void *data);
+
+otr4_err_t otr4_shards_send(otr4_shards_t *shards, void *client_id,
+                            const char *recipient, const char *message,
+                            otr4_shard_done_fn done, void *data);
+
+#endif
@@ -322,7 +322,7 @@ bool smp_msg_2_aprint(uint8_t **dst, size_t *len, const smp_msg_2_t *msg) {
   return true;
 }
 
-bool smp_msg_1_deserialize(smp_msg_1_t *msg, const tlv_t *tlv) {
+bool smp_msg_1_deserialize(smp_msg_1_t *msg, const tlv_view_t *tlv) {
   const uint8_t *cursor = tlv->data;
   uint16_t len = tlv->len;
   size_t read = 0;
@@ -374,7 +374,7 @@ bool smp_msg_1_validate(smp_msg_1_t *msg) {
   return ec_point_valid(msg->G2a) || !ec_point_valid(msg->G3a);
 }
 
-int smp_msg_2_deserialize(smp_msg_2_t *msg, const tlv_t *tlv) {
+int smp_msg_2_deserialize(smp_msg_2_t *msg, const tlv_view_t *tlv) {
   const uint8_t *cursor = tlv->data;
   uint16_t len = tlv->len;
 
@@ -619,7 +619,7 @@ bool smp_msg_3_aprint(uint8_t **dst, size_t *len, const smp_msg_3_t *msg) {
   return true;
 }
 
-int smp_msg_3_deserialize(smp_msg_3_t *dst, const tlv_t *tlv) {
+int smp_msg_3_deserialize(smp_msg_3_t *dst, const tlv_view_t *tlv) {
   const uint8_t *cursor = tlv->data;
   uint16_t len = tlv->len;
 
@@ -782,8 +782,8 @@ bool smp_msg_4_aprint(uint8_t **dst, size_t *len, smp_msg_4_t *msg) {
   return true;
 }
 
-int smp_msg_4_deserialize(smp_msg_4_t *dst, const tlv_t *tlv) {
-  uint8_t *cursor = tlv->data;
+int smp_msg_4_deserialize(smp_msg_4_t *dst, const tlv_view_t *tlv) {
+  const uint8_t *cursor = tlv->data;
   size_t len = tlv->len;
 
   if (deserialize_ec_point(dst->Rb, cursor))
@@ -848,7 +848,8 @@ static void smp_msg_1_copy(smp_msg_1_t *dst, const smp_msg_1_t *src) {
   ec_scalar_copy(dst->d3, src->d3);
 }
 
-static otr4_smp_event_t receive_smp_msg_1(const tlv_t *tlv, smp_context_t smp) {
+static otr4_smp_event_t receive_smp_msg_1(const tlv_view_t *tlv,
+                                          smp_context_t smp) {
   smp_msg_1_t msg_1[1];
 
   if (SMPSTATE_EXPECT1 != smp->state)
@@ -915,7 +916,8 @@ static otr4_smp_event_t reply_with_smp_msg_2(tlv_t **to_send,
   return OTRV4_SMPEVENT_NONE;
 }
 
-static otr4_smp_event_t receive_smp_msg_2(smp_msg_2_t *msg_2, const tlv_t *tlv,
+static otr4_smp_event_t receive_smp_msg_2(smp_msg_2_t *msg_2,
+                                          const tlv_view_t *tlv,
                                           smp_context_t smp) {
   if (SMPSTATE_EXPECT2 != smp->state)
     return OTRV4_SMPEVENT_ERROR;
@@ -979,7 +981,8 @@ static otr4_smp_event_t reply_with_smp_msg_3(tlv_t **to_send,
   return OTRV4_SMPEVENT_NONE;
 }
 
-static otr4_smp_event_t receive_smp_msg_3(smp_msg_3_t *msg_3, const tlv_t *tlv,
+static otr4_smp_event_t receive_smp_msg_3(smp_msg_3_t *msg_3,
+                                          const tlv_view_t *tlv,
                                           smp_context_t smp) {
   if (SMPSTATE_EXPECT3 != smp->state)
     return OTRV4_SMPEVENT_ERROR;
@@ -1039,7 +1042,8 @@ static bool smp_is_valid_for_msg_4(smp_msg_4_t *msg, smp_context_t smp) {
   return DECAF_TRUE == decaf_448_point_eq(smp->Pa_Pb, Rab);
 }
 
-static otr4_smp_event_t receive_smp_msg_4(smp_msg_4_t *msg_4, const tlv_t *tlv,
+static otr4_smp_event_t receive_smp_msg_4(smp_msg_4_t *msg_4,
+                                          const tlv_view_t *tlv,
                                           smp_context_t smp) {
   if (SMPSTATE_EXPECT4 != smp->state)
     return OTRV4_SMPEVENT_ERROR;
@@ -1061,7 +1065,8 @@ static otr4_smp_event_t receive_smp_msg_4(smp_msg_4_t *msg_4, const tlv_t *tlv,
   return OTRV4_SMPEVENT_SUCCESS;
 }
 
-static otr4_smp_event_t process_smp_msg1(const tlv_t *tlv, smp_context_t smp) {
+static otr4_smp_event_t process_smp_msg1(const tlv_view_t *tlv,
+                                         smp_context_t smp) {
   otr4_smp_event_t event = receive_smp_msg_1(tlv, smp);
 
   if (!event) {
@@ -1072,7 +1077,8 @@ static otr4_smp_event_t process_smp_msg1(const tlv_t *tlv, smp_context_t smp) {
   return event;
 }
 
-static otr4_smp_event_t process_smp_msg2(tlv_t **smp_reply, const tlv_t *tlv,
+static otr4_smp_event_t process_smp_msg2(tlv_t **smp_reply,
+                                         const tlv_view_t *tlv,
                                          smp_context_t smp) {
   smp_msg_2_t msg_2[1];
   otr4_smp_event_t event = receive_smp_msg_2(msg_2, tlv, smp);
@@ -1084,7 +1090,8 @@ static otr4_smp_event_t process_smp_msg2(tlv_t **smp_reply, const tlv_t *tlv,
   return event;
 }
 
-static otr4_smp_event_t process_smp_msg3(tlv_t **smp_reply, const tlv_t *tlv,
+static otr4_smp_event_t process_smp_msg3(tlv_t **smp_reply,
+                                         const tlv_view_t *tlv,
                                          smp_context_t smp) {
   smp_msg_3_t msg_3[1];
   otr4_smp_event_t event = receive_smp_msg_3(msg_3, tlv, smp);
@@ -1096,7 +1103,8 @@ static otr4_smp_event_t process_smp_msg3(tlv_t **smp_reply, const tlv_t *tlv,
   return event;
 }
 
-static otr4_smp_event_t process_smp_msg4(const tlv_t *tlv, smp_context_t smp) {
+static otr4_smp_event_t process_smp_msg4(const tlv_view_t *tlv,
+                                         smp_context_t smp) {
   smp_msg_4_t msg_4[1];
 
   otr4_smp_event_t event = receive_smp_msg_4(msg_4, tlv, smp);
@@ -98,14 +98,14 @@ bool generate_smp_msg_4(smp_msg_4_t *dst, const smp_msg_3_t *msg_3,
                         smp_context_t smp);
 
 // TODO: export only what is needed
-bool smp_msg_1_deserialize(smp_msg_1_t *dst, const tlv_t *tlv);
-int smp_msg_2_deserialize(smp_msg_2_t *dst, const tlv_t *tlv);
+bool smp_msg_1_deserialize(smp_msg_1_t *dst, const tlv_view_t *tlv);
+int smp_msg_2_deserialize(smp_msg_2_t *dst, const tlv_view_t *tlv);
 bool smp_msg_2_aprint(uint8_t **dst, size_t *len, const smp_msg_2_t *msg);
 bool smp_msg_3_aprint(uint8_t **dst, size_t *len, const smp_msg_3_t *msg);
-int smp_msg_3_deserialize(smp_msg_3_t *dst, const tlv_t *tlv);
+int smp_msg_3_deserialize(smp_msg_3_t *dst, const tlv_view_t *tlv);
 bool smp_msg_3_validate_zkp(smp_msg_3_t *msg, const smp_context_t smp);
 bool smp_msg_4_aprint(uint8_t **dst, size_t *len, smp_msg_4_t *msg);
-int smp_msg_4_deserialize(smp_msg_4_t *dst, const tlv_t *tlv);
+int smp_msg_4_deserialize(smp_msg_4_t *dst, const tlv_view_t *tlv);
 bool smp_msg_4_validate_zkp(smp_msg_4_t *msg, const smp_context_t smp);
 
 #endif
@@ -8,18 +8,23 @@
 // clang-format on
 
 #include "test_api.c"
+#include "test_b64.c"
 #include "test_client.c"
 #include "test_dake.c"
+#include "test_dake_pool.c"
 #include "test_data_message.c"
 #include "test_dh.c"
 #include "test_ed448.c"
 #include "test_fragment.c"
+#include "test_hashmap.c"
 #include "test_identity_message.c"
 #include "test_instance_tag.c"
 #include "test_key_management.c"
 #include "test_list.c"
 #include "test_otrv4.c"
 #include "test_serialize.c"
+#include "test_shake.c"
+#include "test_shard.c"
 #include "test_smp.c"
 #include "test_tlv.c"
 #include "test_user_profile.c"
@@ -49,14 +54,21 @@ int main(int argc, char **argv) {
                   ed448_test_scalar_serialization);
 
   g_test_add_func("/dake/snizkpk", test_snizkpk_auth);
+  g_test_add_func("/dake/snizkpk_parts", test_snizkpk_auth_parts);
+  g_test_add_func("/dake/snizkpk_verify_batch", test_snizkpk_verify_batch);
+  g_test_add_func("/hashmap/put_get_remove", test_hashmap_put_get_remove);
+  g_test_add_func("/hashmap/pointer_keys", test_hashmap_pointer_keys);
+
   g_test_add_func("/list/add", test_list_add);
   g_test_add_func("/list/get", test_list_get_last);
   g_test_add_func("/list/length", test_list_len);
   g_test_add_func("/list/empty_size", test_list_empty_size);
+  g_test_add_func("/list/append", test_list_append);
 
   g_test_add_func("/dh/api", dh_test_api);
   g_test_add_func("/dh/serialize", dh_test_serialize);
   g_test_add_func("/dh/destroy", dh_test_keypair_destroy);
+  g_test_add_func("/dh/keypair_pool", dh_test_keypair_pool);
 
   g_test_add_func("/serialize_and_deserialize/uint", test_ser_deser_uint);
   g_test_add_func("/serialize_and_deserialize/data",
@@ -75,6 +87,12 @@ int main(int argc, char **argv) {
   g_test_add_func("/user_profile/sign_and_verifies",
                   test_user_profile_signs_and_verify);
   g_test_add_func("/user_profile/build_user_profile", test_user_profile_build);
+  g_test_add_func("/user_profile/caches_valid_signatures",
+                  test_user_profile_caches_valid_signatures);
+  g_test_add_func("/user_profile/caches_serialized",
+                  test_user_profile_caches_serialized);
+  g_test_add_func("/user_profile/renews_in_background",
+                  test_user_profile_renews_in_background);
 
   WITH_FIXTURE("/dake/identity_message/serializes",
                test_dake_identity_message_serializes,
@@ -85,21 +103,40 @@ int main(int argc, char **argv) {
   WITH_FIXTURE("/dake/identity_message/valid", test_dake_identity_message_valid,
                identity_message_fixture_t, identity_message_fixture);
 
+  g_test_add_func("/b64/kernels_encode", test_b64_kernels_encode);
+  g_test_add_func("/b64/kernels_decode", test_b64_kernels_decode);
+  g_test_add_func("/shake/kdf_lanes", test_shake_kdf_lanes);
+
   g_test_add_func("/data_message/serialize", test_data_message_serializes);
+  g_test_add_func("/data_message/valid_over_received_bytes",
+                  test_data_message_valid_over_received_bytes);
+  g_test_add_func("/data_message/encode", test_data_message_encode);
 
   g_test_add_func("/fragment/create_fragments", test_create_fragments);
+  g_test_add_func("/fragment/create_fragments_exact_sizes",
+                  test_create_fragments_exact_sizes);
   g_test_add_func("/fragment/defragment_message",
                   test_defragment_valid_message);
   g_test_add_func("/fragment/defragment_single_fragment",
                   test_defragment_single_fragment);
   g_test_add_func("/fragment/defragment_fails_without_comma",
                   test_defragment_without_comma_fails);
+  g_test_add_func("/fragment/defragment_out_of_order",
+                  test_defragment_out_of_order);
+  g_test_add_func("/fragment/defragment_interleaved_messages",
+                  test_defragment_interleaved_messages);
+  g_test_add_func("/fragment/defragment_forgets_stale_and_excess_messages",
+                  test_defragment_forgets_stale_and_excess_messages);
   g_test_add_func("/fragment/fails_for_invalid_tag",
                   test_defragment_fails_for_invalid_tag);
 
   g_test_add_func("/key_management/derive_ratchet_keys",
                   test_derive_ratchet_keys);
   g_test_add_func("/key_management/destroy", test_key_manager_destroy);
+  g_test_add_func("/key_management/old_mac_keys",
+                  test_key_manager_old_mac_keys);
+  g_test_add_func("/key_management/skipped_keys",
+                  test_key_manager_skipped_keys);
 
   g_test_add_func("/smp/state_machine", test_smp_state_machine);
   g_test_add_func("/smp/generate_secret", test_generate_smp_secret);
@@ -111,10 +148,12 @@ int main(int argc, char **argv) {
 
   g_test_add_func("/tlv/new", test_tlv_new);
   g_test_add_func("/tlv/parse", test_tlv_parse);
+  g_test_add_func("/tlv/iterate", test_tlv_iterate);
   g_test_add_func("/tlv/new_padding", test_tlv_new_padding);
   g_test_add_func("/tlv/new_disconnected", test_tlv_new_disconnected);
   g_test_add_func("/tlv/create_chain", test_create_tlv_chain);
   g_test_add_func("/tlv/append_padding", test_append_padding_tlv);
+  g_test_add_func("/tlv/padding_policy", test_padding_policy);
 
   // g_test_add_func("/otrv4/starts_protocol", test_otrv4_starts_protocol);
   // g_test_add("/otrv4/version_supports_v34", otrv4_fixture_t, NULL,
@@ -173,7 +212,15 @@ int main(int argc, char **argv) {
   g_test_add_func("/api/conversation/v3", test_api_conversation_v3);
   g_test_add_func("/api/smp", test_api_smp);
   g_test_add_func("/api/messaging", test_api_messaging);
+  g_test_add_func("/api/messaging/client_lookup", test_messaging_client_lookup);
+
+  g_test_add_func("/shards/index", test_shards_index);
+  g_test_add_func("/shards/receive_messages", test_shards_receive_messages);
+  g_test_add_func("/dake_pool/delivers_results",
+                  test_dake_pool_delivers_results);
   g_test_add_func("/api/instance_tag", test_instance_tag_api);
+  g_test_add_func("/api/tampered_data_message",
+                  test_api_tampered_data_message);
   g_test_add_func("/api/dh_key_rotation", test_dh_key_rotation);
 
   g_test_add_func("/client/conversation_api", test_client_conversation_api);
@@ -187,6 +234,8 @@ int main(int argc, char **argv) {
   g_test_add_func("/client/receives_fragments",
                   test_client_receives_fragmented_message);
 
+  g_test_add_func("/client/conversation_with_multiple_instances",
+                  test_conversation_with_multiple_instances);
   g_test_add_func("/client/conversation_data_message_multiple_locations",
                   test_conversation_with_multiple_locations);
   g_test_add_func("/client/identity_message_in_waiting_auth_i",
@@ -203,5 +252,17 @@ int main(int argc, char **argv) {
   // TODO: this can be moved here but no more up
   g_test_add_func("/api/multiple_clients", test_api_multiple_clients);
 
+  if (g_test_perf()) {
+    g_test_add_func("/perf/api/padding_wire_bytes",
+                    test_api_perf_padding_wire_bytes);
+    g_test_add_func("/perf/b64/throughput", test_b64_perf_throughput);
+    g_test_add_func("/perf/dh/keypair_generate", dh_perf_keypair_generate);
+    g_test_add_func("/perf/list/append", test_list_perf_append);
+    g_test_add_func("/perf/key_management/chain_decision",
+                    test_key_manager_perf_chain_decision);
+    g_test_add_func("/perf/shake/kdf_lanes", test_shake_perf_kdf_lanes);
+    g_test_add_func("/perf/shards/scaling", test_shards_perf_scaling);
+  }
+
   return g_test_run();
 }
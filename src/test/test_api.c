@@ -1,5 +1,6 @@
 #include <string.h>
 
+#include "../b64.h"
 #include "../list.h"
 #include "../otrv4.h"
 #include "../str.h"
@@ -44,9 +45,9 @@ void test_api_conversation(void) {
 
   otrv4_policy_t policy = {.allows = OTRV4_ALLOW_V3 | OTRV4_ALLOW_V4};
   otrv4_t *alice = otrv4_new(alice_state, policy);
-  otrv4_assert(!alice->keys->old_mac_keys);
+  otrv4_assert(!alice->keys->old_mac_keys->count);
   otrv4_t *bob = otrv4_new(bob_state, policy);
-  otrv4_assert(!bob->keys->old_mac_keys);
+  otrv4_assert(!bob->keys->old_mac_keys->count);
 
   // AKE HAS FINISHED.
   do_ake_fixture(alice, bob);
@@ -63,7 +64,7 @@ void test_api_conversation(void) {
   for (message_id = 2; message_id < 5; message_id++) {
     err = otrv4_prepare_to_send_message(&to_send, "hi", tlv, alice);
     assert_msg_sent(err, to_send, "hi");
-    otrv4_assert(!alice->keys->old_mac_keys);
+    otrv4_assert(!alice->keys->old_mac_keys->count);
 
     // This is a follow up message.
     g_assert_cmpint(alice->keys->i, ==, 0);
@@ -73,11 +74,11 @@ void test_api_conversation(void) {
     response_to_alice = otrv4_response_new();
     otr4_err_t err = otrv4_receive_message(response_to_alice, to_send, bob);
     assert_rec_msg(err, "hi", response_to_alice);
-    otrv4_assert(bob->keys->old_mac_keys);
+    otrv4_assert(bob->keys->old_mac_keys->count);
 
     free_message_and_response(response_to_alice, &to_send);
 
-    g_assert_cmpint(list_len(bob->keys->old_mac_keys), ==, message_id - 1);
+    g_assert_cmpint(bob->keys->old_mac_keys->count, ==, message_id - 1);
 
     // Next message Bob sends is a new "ratchet"
     g_assert_cmpint(bob->keys->i, ==, 0);
@@ -89,7 +90,7 @@ void test_api_conversation(void) {
     err = otrv4_prepare_to_send_message(&to_send, "hello", tlv, bob);
     assert_msg_sent(err, to_send, "hello");
 
-    g_assert_cmpint(list_len(bob->keys->old_mac_keys), ==, 0);
+    g_assert_cmpint(bob->keys->old_mac_keys->count, ==, 0);
 
     // New ratchet hapenned
     g_assert_cmpint(bob->keys->i, ==, 1);
@@ -99,7 +100,7 @@ void test_api_conversation(void) {
     response_to_bob = otrv4_response_new();
     otr4_err_t err = otrv4_receive_message(response_to_bob, to_send, alice);
     assert_rec_msg(err, "hello", response_to_bob);
-    g_assert_cmpint(list_len(alice->keys->old_mac_keys), ==, message_id);
+    g_assert_cmpint(alice->keys->old_mac_keys->count, ==, message_id);
 
     free_message_and_response(response_to_bob, &to_send);
 
@@ -117,14 +118,14 @@ void test_api_conversation(void) {
   err = otrv4_prepare_to_send_message(&to_send, "hi", tlvs, bob);
   assert_msg_sent(err, to_send, "hello");
 
-  g_assert_cmpint(list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(bob->keys->old_mac_keys->count, ==, 0);
   otrv4_tlv_free(tlvs);
 
   // Alice receives a data message with TLV
   response_to_bob = otrv4_response_new();
   otrv4_assert(otrv4_receive_message(response_to_bob, to_send, alice) ==
                OTR4_SUCCESS);
-  g_assert_cmpint(list_len(alice->keys->old_mac_keys), ==, 4);
+  g_assert_cmpint(alice->keys->old_mac_keys->count, ==, 4);
 
   // Check TLVS
   otrv4_assert(response_to_bob->tlvs);
@@ -132,10 +133,31 @@ void test_api_conversation(void) {
   g_assert_cmpint(response_to_bob->tlvs->len, ==, tlv_len);
   otrv4_assert_cmpmem(response_to_bob->tlvs->data, tlv_data, tlv_len);
 
-  // Check Padding
-  otrv4_assert(response_to_bob->tlvs->next);
-  g_assert_cmpint(response_to_bob->tlvs->next->type, ==, OTRV4_TLV_PADDING);
-  g_assert_cmpint(response_to_bob->tlvs->next->len, ==, 250);
+  // The padding is not copied into the response
+  otrv4_assert(!response_to_bob->tlvs->next);
+
+  free_message_and_response(response_to_bob, &to_send);
+
+  // Messages without TLVs are padded too, to the same length
+  err = otrv4_prepare_to_send_message(&to_send, "hi", NULL, bob);
+  assert_msg_sent(err, to_send, "hi");
+  size_t padded_len = strlen(to_send);
+
+  response_to_bob = otrv4_response_new();
+  otrv4_assert(otrv4_receive_message(response_to_bob, to_send, alice) ==
+               OTR4_SUCCESS);
+  otrv4_assert(!response_to_bob->tlvs);
+
+  free_message_and_response(response_to_bob, &to_send);
+
+  err = otrv4_prepare_to_send_message(&to_send, "hi there", NULL, bob);
+  assert_msg_sent(err, to_send, "hi there");
+  g_assert_cmpuint(strlen(to_send), ==, padded_len);
+
+  response_to_bob = otrv4_response_new();
+  otrv4_assert(otrv4_receive_message(response_to_bob, to_send, alice) ==
+               OTR4_SUCCESS);
+  otrv4_assert(!response_to_bob->tlvs);
 
   free_message_and_response(response_to_bob, &to_send);
 
@@ -150,6 +172,68 @@ void test_api_conversation(void) {
   OTR4_FREE;
 }
 
+/* Flips a bit of the data message, which its MAC no longer matches */
+static string_t tamper_data_message(const string_t message) {
+  uint8_t *decoded = NULL;
+  size_t len = 0;
+  otrv4_assert(!otrl_base64_otr_decode(message, &decoded, &len));
+
+  decoded[len - DATA_MSG_MAC_BYTES - 1] ^= 0x01;
+  string_t tampered = otrl_base64_otr_encode(decoded, len);
+  free(decoded);
+
+  return tampered;
+}
+
+void test_api_tampered_data_message(void) {
+  OTR4_INIT;
+
+  otr4_client_state_t *alice_state = otr4_client_state_new(NULL);
+  otr4_client_state_t *bob_state = otr4_client_state_new(NULL);
+
+  uint8_t alice_sym[ED448_PRIVATE_BYTES] = {1};
+  otr4_client_state_add_private_key_v4(alice_state, alice_sym);
+  uint8_t bob_sym[ED448_PRIVATE_BYTES] = {2};
+  otr4_client_state_add_private_key_v4(bob_state, bob_sym);
+
+  otrv4_policy_t policy = {.allows = OTRV4_ALLOW_V4};
+  otrv4_t *alice = otrv4_new(alice_state, policy);
+  otrv4_t *bob = otrv4_new(bob_state, policy);
+  do_ake_fixture(alice, bob);
+
+  string_t first = NULL;
+  string_t second = NULL;
+  otrv4_assert(otrv4_prepare_to_send_message(&first, "first", NULL, alice) ==
+               OTR4_SUCCESS);
+  otrv4_assert(otrv4_prepare_to_send_message(&second, "second", NULL,
+                                             alice) == OTR4_SUCCESS);
+
+  // Bob rejects a tampered copy of the second message
+  string_t tampered = tamper_data_message(second);
+  otrv4_response_t *response = otrv4_response_new();
+  otrv4_assert(otrv4_receive_message(response, tampered, bob) == OTR4_ERROR);
+  otrv4_response_free(response);
+  free(tampered);
+
+  // It used up neither its key nor the one it skipped
+  response = otrv4_response_new();
+  otr4_err_t err = otrv4_receive_message(response, second, bob);
+  assert_rec_msg(err, "second", response);
+  free_message_and_response(response, &second);
+
+  response = otrv4_response_new();
+  err = otrv4_receive_message(response, first, bob);
+  assert_rec_msg(err, "first", response);
+  free_message_and_response(response, &first);
+
+  otrv4_free(alice);
+  otrv4_free(bob);
+  otr4_client_state_free(alice_state);
+  otr4_client_state_free(bob_state);
+
+  OTR4_FREE;
+}
+
 void test_dh_key_rotation(void) {
   OTR4_INIT;
   tlv_t *tlv = otrv4_tlv_new(OTRV4_TLV_NONE, 0, NULL);
@@ -621,3 +705,73 @@ void test_api_multiple_clients(void) {
 
   OTR4_FREE;
 }
+
+/* Mostly short, like the messages in a typical chat log */
+static const size_t chat_message_lens[] = {
+    2,  3,  4,  5,  6,  8,  10,  12,  14,  16,  19,  22,  25,  28,  32,  36,
+    40, 45, 50, 56, 64, 72, 85,  100, 120, 140, 170, 210, 260, 330, 450, 700};
+
+void test_api_perf_padding_wire_bytes(void) {
+  OTR4_INIT;
+
+  const struct {
+    const char *name;
+    otrv4_padding_policy_t policy;
+  } policies[] = {
+      {"no padding", {OTRV4_PADDING_NONE, 0, 0}},
+      {"256 byte blocks", {OTRV4_PADDING_BLOCK, 256, 0}},
+      {"64 byte blocks", {OTRV4_PADDING_BLOCK, 64, 0}},
+      {"power of two buckets", {OTRV4_PADDING_BUCKETS, 32, 0}},
+      {"power of two buckets, at most 64 bytes",
+       {OTRV4_PADDING_BUCKETS, 32, 64}},
+  };
+
+  const size_t messages = sizeof(chat_message_lens) / sizeof(size_t);
+  char message[701];
+
+  for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    otr4_client_state_t *alice_state = otr4_client_state_new(NULL);
+    otr4_client_state_t *bob_state = otr4_client_state_new(NULL);
+
+    uint8_t alice_sym[ED448_PRIVATE_BYTES] = {1};
+    otr4_client_state_add_private_key_v4(alice_state, alice_sym);
+    uint8_t bob_sym[ED448_PRIVATE_BYTES] = {2};
+    otr4_client_state_add_private_key_v4(bob_state, bob_sym);
+
+    otrv4_assert(otr4_client_state_set_padding(alice_state,
+                                               &policies[i].policy) ==
+                 OTR4_SUCCESS);
+
+    otrv4_policy_t policy = {.allows = OTRV4_ALLOW_V4};
+    otrv4_t *alice = otrv4_new(alice_state, policy);
+    otrv4_t *bob = otrv4_new(bob_state, policy);
+    do_ake_fixture(alice, bob);
+
+    size_t wire_bytes = 0;
+    for (size_t j = 0; j < messages; j++) {
+      memset(message, 'a', chat_message_lens[j]);
+      message[chat_message_lens[j]] = 0;
+
+      string_t to_send = NULL;
+      otr4_err_t err =
+          otrv4_prepare_to_send_message(&to_send, message, NULL, alice);
+      assert_msg_sent(err, to_send, message);
+      wire_bytes += strlen(to_send);
+
+      otrv4_response_t *response = otrv4_response_new();
+      err = otrv4_receive_message(response, to_send, bob);
+      assert_rec_msg(err, message, response);
+      free_message_and_response(response, &to_send);
+    }
+
+    g_test_message("%s: %.1f wire bytes per message", policies[i].name,
+                   (double)wire_bytes / messages);
+
+    otrv4_free(alice);
+    otrv4_free(bob);
+    otr4_client_state_free(alice_state);
+    otr4_client_state_free(bob_state);
+  }
+
+  OTR4_FREE;
+}
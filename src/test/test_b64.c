@@ -0,0 +1,128 @@
+#include "../b64.h"
+
+static const char b64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void fill_random(unsigned char *buf, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    buf[i] = g_test_rand_int_range(0, 256);
+}
+
+void test_b64_kernels_encode() {
+  otrl_b64_kernel_t best = otrl_base64_kernel();
+
+  for (size_t len = 0; len < 300; len++) {
+    unsigned char *raw = malloc(len + 1);
+    fill_random(raw, len);
+
+    otrl_base64_set_kernel(OTRL_B64_SCALAR);
+    char *expected = otrl_base64_otr_encode(raw, len);
+
+    for (int k = OTRL_B64_SSE41; k <= best; k++) {
+      otrl_base64_set_kernel(k);
+      char *encoded = otrl_base64_otr_encode(raw, len);
+      g_assert_cmpstr(encoded, ==, expected);
+      free(encoded);
+
+      // In place, from the end of the output buffer
+      size_t size = OTRL_B64_OTR_ENCODED_SIZE(len);
+      char *buf = malloc(size);
+      memcpy(buf + size - len, raw, len);
+      otrl_base64_otr_encode_into(buf, (unsigned char *)buf + size - len, len);
+      g_assert_cmpstr(buf, ==, expected);
+      free(buf);
+    }
+
+    free(expected);
+    free(raw);
+  }
+
+  otrl_base64_set_kernel(best);
+}
+
+void test_b64_kernels_decode() {
+  otrl_b64_kernel_t best = otrl_base64_kernel();
+
+  for (int i = 0; i < 1000; i++) {
+    size_t len = g_test_rand_int_range(0, 600);
+    char *text = malloc(len + 1);
+
+    // Mostly valid characters, with some to skip and the odd '='
+    for (size_t j = 0; j < len; j++) {
+      int r = g_test_rand_int_range(0, 100);
+      if (i % 2 == 0 || r > 3)
+        text[j] = b64_alphabet[g_test_rand_int_range(0, 64)];
+      else if (r == 3)
+        text[j] = '=';
+      else
+        text[j] = g_test_rand_int_range(0, 256);
+    }
+
+    size_t size = OTRL_B64_MAX_DECODED_SIZE(len);
+    unsigned char *expected = malloc(size + 1);
+    unsigned char *decoded = malloc(size + 1);
+
+    otrl_base64_set_kernel(OTRL_B64_SCALAR);
+    size_t expected_len = otrl_base64_decode(expected, text, len);
+
+    for (int k = OTRL_B64_SSE41; k <= best; k++) {
+      otrl_base64_set_kernel(k);
+      decoded[size] = 0xAB;
+      g_assert_cmpuint(otrl_base64_decode(decoded, text, len), ==,
+                       expected_len);
+      otrv4_assert_cmpmem(decoded, expected, expected_len);
+      g_assert_cmpuint(decoded[size], ==, 0xAB);
+    }
+
+    free(decoded);
+    free(expected);
+    free(text);
+  }
+
+  otrl_base64_set_kernel(best);
+}
+
+void test_b64_perf_throughput() {
+  const char *names[] = {"scalar", "sse4.1", "avx2"};
+  otrl_b64_kernel_t best = otrl_base64_kernel();
+  const size_t max_len = 1 << 20;
+
+  unsigned char *raw = malloc(max_len);
+  char *encoded = malloc(((max_len + 2) / 3) * 4);
+  unsigned char *decoded = malloc(max_len);
+  fill_random(raw, max_len);
+
+  for (size_t len = 1 << 10; len <= max_len; len <<= 2) {
+    // Around 64 MB through each kernel
+    int iterations = (64 << 20) / len;
+    size_t encoded_len = ((len + 2) / 3) * 4;
+
+    for (int k = OTRL_B64_SCALAR; k <= best; k++) {
+      otrl_base64_set_kernel(k);
+
+      g_test_timer_start();
+      for (int i = 0; i < iterations; i++)
+        otrl_base64_encode(encoded, raw, len);
+      double encode_time = g_test_timer_elapsed();
+
+      g_test_timer_start();
+      for (int i = 0; i < iterations; i++)
+        otrl_base64_decode(decoded, encoded, encoded_len);
+      double decode_time = g_test_timer_elapsed();
+
+      otrv4_assert_cmpmem(decoded, raw, len);
+
+      double mb = (double)len * iterations / (1 << 20);
+      g_test_message("%s, %zu KB: encode %.0f MB/s, decode %.0f MB/s",
+                     names[k], len >> 10, mb / encode_time, mb / decode_time);
+      if (k == best && len == max_len)
+        g_test_maximized_result(mb / decode_time, "decode: %.0f MB/s",
+                                mb / decode_time);
+    }
+  }
+
+  otrl_base64_set_kernel(best);
+  free(decoded);
+  free(encoded);
+  free(raw);
+}
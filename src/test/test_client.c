@@ -21,14 +21,14 @@ void test_client_conversation_api() {
   otr4_client_state_add_private_key_v4(alice_state, sym);
 
   otr4_client_t *alice = otr4_client_new(alice_state);
-  otrv4_assert(!alice->conversations);
+  otrv4_assert(!list_size(alice->conversations));
 
   otr4_conversation_t *alice_to_bob =
       otr4_client_get_conversation(!FORCE_CREATE_CONVO, BOB_IDENTITY, alice);
   otr4_conversation_t *alice_to_charlie = otr4_client_get_conversation(
       !FORCE_CREATE_CONVO, CHARLIE_IDENTITY, alice);
 
-  otrv4_assert(!alice->conversations);
+  otrv4_assert(!list_size(alice->conversations));
   otrv4_assert(!alice_to_bob);
   otrv4_assert(!alice_to_charlie);
 
@@ -41,16 +41,16 @@ void test_client_conversation_api() {
   otrv4_assert(alice_to_bob->conn);
   otrv4_assert(alice_to_charlie);
   otrv4_assert(alice_to_charlie->conn);
+  g_assert_cmpuint(alice->conversation_index->count, ==, 2);
 
-  alice_to_bob =
+  otr4_conversation_t *bob_again =
       otr4_client_get_conversation(!FORCE_CREATE_CONVO, BOB_IDENTITY, alice);
-  alice_to_charlie = otr4_client_get_conversation(!FORCE_CREATE_CONVO,
-                                                  CHARLIE_IDENTITY, alice);
+  otr4_conversation_t *charlie_again = otr4_client_get_conversation(
+      !FORCE_CREATE_CONVO, CHARLIE_IDENTITY, alice);
 
-  otrv4_assert(alice_to_bob);
-  otrv4_assert(alice_to_bob->conn);
-  otrv4_assert(alice_to_charlie);
-  otrv4_assert(alice_to_charlie->conn);
+  otrv4_assert(bob_again == alice_to_bob);
+  otrv4_assert(charlie_again == alice_to_charlie);
+  g_assert_cmpuint(list_size(alice->conversations), ==, 2);
 
   // Free memory
   otr4_client_state_free(alice_state);
@@ -376,6 +376,143 @@ void test_conversation_with_multiple_locations() {
   OTR4_FREE
 }
 
+static otr4_client_state_t *client_state_with_instance(const char *name,
+                                                       uint8_t sym_byte,
+                                                       unsigned int tag) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {sym_byte};
+  otr4_client_state_t *state = otr4_client_state_new((void *)name);
+  state->userstate = otrl_userstate_create();
+  state->account_name = otrv4_strdup("");
+  state->protocol_name = otrv4_strdup("");
+  otr4_client_state_add_private_key_v4(state, sym);
+  otr4_client_state_add_instance_tag(state, tag);
+
+  return state;
+}
+
+void test_conversation_with_multiple_instances() {
+  OTR4_INIT;
+
+  otr4_client_state_t *alice_state =
+      client_state_with_instance("alice", 1, 0x100 + 1);
+  otr4_client_state_t *bob_states[2] = {
+      client_state_with_instance("bob", 2, 0x100 + 2),
+      client_state_with_instance("bob", 2, 0x100 + 3),
+  };
+
+  otr4_client_t *alice = otr4_client_new(alice_state);
+  otr4_client_t *bobs[2] = {otr4_client_new(bob_states[0]),
+                            otr4_client_new(bob_states[1])};
+
+  char *query_msg = otr4_client_query_message(BOB_IDENTITY, "Hi bob", alice);
+  char *from_alice[2] = {NULL}, *from_bob[2] = {NULL};
+  char *todisplay = NULL;
+
+  // Both of Bob's instances receive the query message, and send Identity
+  // messages
+  for (int i = 0; i < 2; i++)
+    otr4_client_receive(&from_bob[i], &todisplay, query_msg, ALICE_IDENTITY,
+                        bobs[i]);
+
+  free(query_msg);
+
+  // Alice runs a DAKE with each of them
+  for (int step = 0; step < 2; step++) {
+    for (int i = 0; i < 2; i++) {
+      otr4_client_receive(&from_alice[i], &todisplay, from_bob[i],
+                          BOB_IDENTITY, alice);
+      free(from_bob[i]);
+      from_bob[i] = NULL;
+      otrv4_assert(!todisplay);
+    }
+
+    if (step == 1)
+      break;
+
+    for (int i = 0; i < 2; i++) {
+      otrv4_assert(from_alice[i]);
+      otr4_client_receive(&from_bob[i], &todisplay, from_alice[i],
+                          ALICE_IDENTITY, bobs[i]);
+      free(from_alice[i]);
+      from_alice[i] = NULL;
+    }
+  }
+
+  // Each instance has a conversation of its own
+  g_assert_cmpuint(list_size(alice->conversations), ==, 2);
+  otr4_conversation_t *first =
+      otr4_client_get_conversation(!FORCE_CREATE_CONVO, BOB_IDENTITY, alice);
+  otrv4_assert(otr4_client_get_instance_conversation(0x100 + 2, BOB_IDENTITY,
+                                                     alice) == first);
+
+  otr4_conversation_t *second = otr4_client_get_instance_conversation(
+      0x100 + 3, BOB_IDENTITY, alice);
+  otrv4_assert(second);
+  otrv4_assert(second != first);
+  otrv4_assert(otr4_conversation_is_encrypted(first));
+  otrv4_assert(otr4_conversation_is_encrypted(second));
+
+  // And both of them can talk to Alice, without another DAKE
+  const char *messages[] = {"from the first", "from the second"};
+  for (int i = 0; i < 2; i++) {
+    otrv4_assert(!otr4_client_send(&from_bob[i], messages[i], ALICE_IDENTITY,
+                                   bobs[i]));
+    otrv4_assert(!otr4_client_receive(&from_alice[i], &todisplay, from_bob[i],
+                                      BOB_IDENTITY, alice));
+    g_assert_cmpstr(todisplay, ==, messages[i]);
+    otrv4_assert(!from_alice[i]);
+
+    free(todisplay);
+    todisplay = NULL;
+    free(from_bob[i]);
+    from_bob[i] = NULL;
+  }
+
+  g_assert_cmpuint(list_size(alice->conversations), ==, 2);
+
+  // Alice can pick which instance she talks to
+  otrv4_assert(!otr4_client_send_instance(&from_alice[1], "to the second",
+                                          BOB_IDENTITY, 0x100 + 3, alice));
+  otrv4_assert(!otr4_client_receive(&from_bob[1], &todisplay, from_alice[1],
+                                    ALICE_IDENTITY, bobs[1]));
+  g_assert_cmpstr(todisplay, ==, "to the second");
+  otrv4_assert(!from_bob[1]);
+
+  free(todisplay);
+  todisplay = NULL;
+  free(from_alice[1]);
+  from_alice[1] = NULL;
+
+  // But not an instance she has no conversation with
+  otrv4_assert(otr4_client_send_instance(&from_alice[0], "to nobody",
+                                         BOB_IDENTITY, 0x100 + 4, alice));
+  otrv4_assert(!from_alice[0]);
+
+  // Disconnecting from all of them closes the conversation with each one
+  otr4_message_to_send_t *disconnected = otr4_message_new();
+  otrv4_assert(!otr4_client_disconnect_all(disconnected, BOB_IDENTITY, alice));
+  g_assert_cmpint(disconnected->total, ==, 2);
+  g_assert_cmpuint(list_size(alice->conversations), ==, 0);
+
+  for (int i = 0; i < 2; i++) {
+    otrv4_assert(otr4_client_receive(&from_bob[i], &todisplay,
+                                     disconnected->pieces[i], ALICE_IDENTITY,
+                                     bobs[i]));
+    otrv4_assert(!from_bob[i]);
+    otrv4_assert(!todisplay);
+  }
+
+  otr4_message_free(disconnected);
+
+  // Free memory
+  otrv4_userstate_free_all(3, alice_state->userstate,
+                           bob_states[0]->userstate, bob_states[1]->userstate);
+  otrv4_client_state_free_all(3, alice_state, bob_states[0], bob_states[1]);
+  otrv4_client_free_all(3, alice, bobs[0], bobs[1]);
+
+  OTR4_FREE
+}
+
 void test_valid_identity_msg_in_waiting_auth_i() {
   OTR4_INIT;
 
@@ -41,3 +41,79 @@ void test_snizkpk_auth() {
                               (unsigned char *)msg,
                               strlen(msg)) == OTR4_SUCCESS);
 }
+
+void test_snizkpk_auth_parts() {
+  snizkpk_proof_t dst[1];
+  snizkpk_keypair_t pair1[1], pair2[1], pair3[1];
+  const char *msg = "hi bob";
+  snizkpk_msg_part_t parts[3] = {
+      {(unsigned char *)msg, 2},
+      {(unsigned char *)msg + 2, 0},
+      {(unsigned char *)msg + 2, 4},
+  };
+
+  snizkpk_keypair_generate(pair1);
+  snizkpk_keypair_generate(pair2);
+  snizkpk_keypair_generate(pair3);
+
+  // Parts are the same message as their concatenation
+  otrv4_assert(snizkpk_authenticate_parts(dst, pair1, pair2->pub, pair3->pub,
+                                          parts, 3) == OTR4_SUCCESS);
+  otrv4_assert(snizkpk_verify(dst, pair1->pub, pair2->pub, pair3->pub,
+                              (unsigned char *)msg,
+                              strlen(msg)) == OTR4_SUCCESS);
+  otrv4_assert(snizkpk_verify_parts(dst, pair1->pub, pair2->pub, pair3->pub,
+                                    parts, 3) == OTR4_SUCCESS);
+  otrv4_assert(snizkpk_verify_parts(dst, pair1->pub, pair2->pub, pair3->pub,
+                                    parts, 2) == OTR4_ERROR);
+
+  otrv4_assert(snizkpk_authenticate(dst, pair1, pair2->pub, pair3->pub,
+                                    (unsigned char *)msg,
+                                    strlen(msg)) == OTR4_SUCCESS);
+  otrv4_assert(snizkpk_verify_parts(dst, pair1->pub, pair2->pub, pair3->pub,
+                                    parts, 3) == OTR4_SUCCESS);
+
+  snizkpk_proof_destroy(dst);
+}
+
+void test_snizkpk_verify_batch() {
+  snizkpk_proof_t proofs[3];
+  snizkpk_keypair_t pair1[1], pair2[1], pair3[1];
+  const unsigned char msg[] = "hi", other_msg[] = "bye";
+
+  snizkpk_keypair_generate(pair1);
+  snizkpk_keypair_generate(pair2);
+  snizkpk_keypair_generate(pair3);
+
+  otrv4_assert(snizkpk_authenticate(&proofs[0], pair1, pair2->pub, pair3->pub,
+                                    msg, sizeof(msg)) == OTR4_SUCCESS);
+  otrv4_assert(snizkpk_authenticate(&proofs[1], pair2, pair1->pub, pair3->pub,
+                                    msg, sizeof(msg)) == OTR4_SUCCESS);
+  otrv4_assert(snizkpk_authenticate(&proofs[2], pair3, pair1->pub, pair2->pub,
+                                    other_msg,
+                                    sizeof(other_msg)) == OTR4_SUCCESS);
+
+  snizkpk_verify_entry_t entries[3] = {
+      {&proofs[0], &pair1->pub, &pair2->pub, &pair3->pub, msg, sizeof(msg)},
+      {&proofs[1], &pair2->pub, &pair1->pub, &pair3->pub, msg, sizeof(msg)},
+      {&proofs[2], &pair3->pub, &pair1->pub, &pair2->pub, other_msg,
+       sizeof(other_msg)},
+  };
+
+  bool valid[3] = {false, false, false};
+  otrv4_assert(snizkpk_verify_batch(valid, entries, 3) == OTR4_SUCCESS);
+  otrv4_assert(valid[0] && valid[1] && valid[2]);
+
+  // A proof over a different message fails, and only that one
+  entries[1].msg = other_msg;
+  entries[1].msglen = sizeof(other_msg);
+  otrv4_assert(snizkpk_verify_batch(valid, entries, 3) == OTR4_ERROR);
+  otrv4_assert(valid[0]);
+  otrv4_assert(!valid[1]);
+  otrv4_assert(valid[2]);
+
+  otrv4_assert(snizkpk_verify_batch(NULL, entries, 0) == OTR4_SUCCESS);
+
+  for (int i = 0; i < 3; i++)
+    snizkpk_proof_destroy(&proofs[i]);
+}
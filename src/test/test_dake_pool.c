@@ -0,0 +1,64 @@
+#include "../dake_pool.h"
+
+#include <poll.h>
+
+static otr4_dake_result_t *wait_for_result(otr4_dake_pool_t *pool) {
+  struct pollfd ready = {.fd = otr4_dake_pool_fd(pool), .events = POLLIN};
+  otrv4_assert(poll(&ready, 1, 10000) == 1);
+
+  otr4_dake_result_t *result = otr4_dake_pool_next(pool);
+  otrv4_assert(result);
+  return result;
+}
+
+void test_dake_pool_delivers_results(void) {
+  OTR4_INIT;
+
+  const uint8_t sym[ED448_PRIVATE_BYTES] = {2};
+  char *bob_account = "bob@xmpp";
+  int received[8] = {0};
+
+  otr4_userstate_t *state = otr4_user_state_new(NULL);
+  otr4_user_state_add_private_key_v4(state, bob_account, sym);
+
+  otr4_dake_pool_t *pool = otr4_dake_pool_new(state, 2);
+  otrv4_assert(pool);
+  otrv4_assert(!otr4_dake_pool_next(pool));
+
+  for (int i = 0; i < 8; i++) {
+    char *recipient = g_strdup_printf("alice%d@xmpp", i);
+    otrv4_assert(otr4_dake_pool_receive(pool, bob_account, recipient,
+                                        "?OTRv4? Hi bob",
+                                        &received[i]) == OTR4_SUCCESS);
+    g_free(recipient);
+  }
+
+  // Each query message is answered with an identity message
+  for (int i = 0; i < 8; i++) {
+    otr4_dake_result_t *result = wait_for_result(pool);
+    otrv4_assert(result->to_send);
+    otrv4_assert(!strncmp(result->to_send, "?OTR:", 5));
+    otrv4_assert(!result->to_display);
+
+    int *seen = result->data;
+    otrv4_assert(seen >= received && seen < received + 8);
+    (*seen)++;
+    otr4_dake_result_free(result);
+  }
+
+  for (int i = 0; i < 8; i++)
+    g_assert_cmpint(received[i], ==, 1);
+
+  // Nothing left to poll for
+  struct pollfd ready = {.fd = otr4_dake_pool_fd(pool), .events = POLLIN};
+  g_assert_cmpint(poll(&ready, 1, 0), ==, 0);
+  otrv4_assert(!otr4_dake_pool_next(pool));
+
+  // Results not taken are freed with the pool
+  otrv4_assert(otr4_dake_pool_receive(pool, bob_account, "charlie@xmpp",
+                                      "?OTRv4?", NULL) == OTR4_SUCCESS);
+  otr4_dake_pool_free(pool);
+  otr4_user_state_free(state);
+
+  OTR4_FREE
+}
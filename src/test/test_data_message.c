@@ -1,3 +1,4 @@
+#include "../b64.h"
 #include "../data_message.h"
 
 void test_data_message_serializes() {
@@ -113,3 +114,139 @@ void test_data_message_serializes() {
   free(serialized);
   dh_free();
 }
+
+void test_data_message_valid_over_received_bytes() {
+  OTR4_INIT;
+
+  ecdh_keypair_t ecdh[1];
+  dh_keypair_t dh;
+
+  uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  ecdh_keypair_generate(ecdh, sym);
+  otrv4_assert(dh_keypair_generate(dh) == OTR4_SUCCESS);
+
+  data_message_t *data_msg = data_message_new();
+  data_msg->sender_instance_tag = 1;
+  data_msg->receiver_instance_tag = 2;
+  data_msg->message_id = 99;
+  ec_point_copy(data_msg->ecdh, ecdh->pub);
+  data_msg->dh = dh_mpi_copy(dh->pub);
+  data_msg->enc_msg = malloc(3);
+  memset(data_msg->enc_msg, 0xE, 3);
+  data_msg->enc_msg_len = 3;
+
+  uint8_t *body = NULL;
+  size_t bodylen = 0;
+  otrv4_assert(data_message_body_asprintf(&body, &bodylen, data_msg) ==
+               OTR4_SUCCESS);
+
+  m_mac_key_t mac_key;
+  memset(mac_key, 0x1A, sizeof(m_mac_key_t));
+
+  uint8_t *buff = malloc(bodylen + DATA_MSG_MAC_BYTES);
+  memcpy(buff, body, bodylen);
+  shake_256_mac(buff + bodylen, DATA_MSG_MAC_BYTES, mac_key,
+                sizeof(m_mac_key_t), body, bodylen);
+
+  data_message_t *received = data_message_new();
+  otrv4_assert(data_message_deserialize(received, buff,
+                                        bodylen + DATA_MSG_MAC_BYTES) ==
+               OTR4_SUCCESS);
+  otrv4_assert(received->body == buff);
+  g_assert_cmpint(received->body_len, ==, bodylen);
+  otrv4_assert(valid_data_message(mac_key, received));
+
+  // The MAC is checked over the received bytes, not a re-encoding of them
+  buff[bodylen - 1] ^= 0xFF;
+  otrv4_assert(!valid_data_message(mac_key, received));
+
+  free(body);
+  free(buff);
+  data_message_free(received);
+  data_message_free(data_msg);
+  dh_keypair_destroy(dh);
+  ecdh_keypair_destroy(ecdh);
+  dh_free();
+}
+
+void test_data_message_encode() {
+  OTR4_INIT;
+
+  ecdh_keypair_t ecdh[1];
+  dh_keypair_t dh;
+
+  uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  ecdh_keypair_generate(ecdh, sym);
+  otrv4_assert(dh_keypair_generate(dh) == OTR4_SUCCESS);
+
+  data_message_t *data_msg = data_message_new();
+  data_msg->sender_instance_tag = 1;
+  data_msg->receiver_instance_tag = 2;
+  data_msg->message_id = 99;
+  ec_point_copy(data_msg->ecdh, ecdh->pub);
+  data_msg->dh = dh_mpi_copy(dh->pub);
+  memset(data_msg->nonce, 0xF, DATA_MSG_NONCE_BYTES);
+
+  const uint8_t message[] = "hello";
+  m_enc_key_t enc_key;
+  m_mac_key_t mac_key;
+  memset(enc_key, 0x1B, sizeof(m_enc_key_t));
+  memset(mac_key, 0x1A, sizeof(m_mac_key_t));
+  uint8_t mac_keys[2 * MAC_KEY_BYTES];
+  memset(mac_keys, 0x1C, sizeof mac_keys);
+
+  size_t size =
+      data_message_encoded_size(data_msg, sizeof message, sizeof mac_keys);
+  otrv4_assert(size > 0);
+
+  // The encoding fills a caller-supplied buffer of exactly that size
+  char *into = malloc(size);
+  otr4_err_t err =
+      data_message_encode_into(into, size, data_msg, message, sizeof message,
+                               enc_key, mac_key, mac_keys, sizeof mac_keys);
+  otrv4_assert(err == OTR4_SUCCESS);
+  g_assert_cmpuint(strlen(into) + 1, ==, size);
+
+  otrv4_assert(data_message_encode_into(into, size - 1, data_msg, message,
+                                        sizeof message, enc_key, mac_key,
+                                        mac_keys,
+                                        sizeof mac_keys) == OTR4_ERROR);
+
+  // Otherwise it goes into a single allocation of that size
+  string_t encoded = NULL;
+  err = data_message_encode(&encoded, data_msg, message, sizeof message,
+                            enc_key, mac_key, mac_keys, sizeof mac_keys);
+  otrv4_assert(err == OTR4_SUCCESS);
+  g_assert_cmpuint(strlen(encoded) + 1, ==, size);
+  g_assert_cmpstr(encoded, ==, into);
+
+  uint8_t *decoded = NULL;
+  size_t decoded_len = 0;
+  g_assert_cmpint(otrl_base64_otr_decode(encoded, &decoded, &decoded_len), ==,
+                  0);
+
+  data_message_t *received = data_message_new();
+  otrv4_assert(data_message_deserialize(received, decoded, decoded_len) ==
+               OTR4_SUCCESS);
+  otrv4_assert(valid_data_message(mac_key, received));
+  g_assert_cmpuint(received->message_id, ==, 99);
+  g_assert_cmpuint(received->enc_msg_len, ==, sizeof message);
+
+  uint8_t plain[sizeof message];
+  crypto_stream_xor(plain, received->enc_msg, received->enc_msg_len,
+                    received->nonce, enc_key);
+  otrv4_assert_cmpmem(plain, message, sizeof message);
+
+  size_t revealed = received->body_len + DATA_MSG_MAC_BYTES;
+  g_assert_cmpuint(decoded_len - revealed, ==, sizeof mac_keys);
+  otrv4_assert_cmpmem(decoded + revealed, mac_keys, sizeof mac_keys);
+
+  data_message_free(received);
+  free(decoded);
+  free(encoded);
+  free(into);
+  data_message_free(data_msg);
+  dh_keypair_destroy(dh);
+  ecdh_keypair_destroy(ecdh);
+  dh_free();
+}
@@ -62,3 +62,71 @@ void dh_test_keypair_destroy() {
 
   dh_free();
 }
+
+void dh_test_keypair_pool() {
+  OTR4_INIT;
+
+  otrv4_assert(dh_keypair_pool_start(3, 3) == OTR4_ERROR);
+  otrv4_assert(dh_keypair_pool_start(1, 3) == OTR4_SUCCESS);
+  otrv4_assert(dh_keypair_pool_start(1, 3) == OTR4_ERROR);
+
+  for (int i = 0; i < 10000 && dh_keypair_pool_available() < 3; i++)
+    g_usleep(1000);
+  g_assert_cmpint(dh_keypair_pool_available(), ==, 3);
+
+  dh_keypair_t alice, bob;
+  otrv4_assert(dh_keypair_generate(alice) == OTR4_SUCCESS);
+  otrv4_assert(dh_keypair_generate(bob) == OTR4_SUCCESS);
+  otrv4_assert(dh_mpi_valid(alice->pub));
+  otrv4_assert(dh_mpi_valid(bob->pub));
+
+  uint8_t shared1[DH3072_MOD_LEN_BYTES] = {0};
+  uint8_t shared2[DH3072_MOD_LEN_BYTES] = {0};
+  otrv4_assert(dh_shared_secret(shared1, sizeof(shared1), alice->priv,
+                                bob->pub) == OTR4_SUCCESS);
+  otrv4_assert(dh_shared_secret(shared2, sizeof(shared2), bob->priv,
+                                alice->pub) == OTR4_SUCCESS);
+  otrv4_assert_cmpmem(shared1, shared2, sizeof(shared1));
+
+  dh_keypair_destroy(alice);
+  dh_keypair_destroy(bob);
+
+  dh_free();
+  g_assert_cmpint(dh_keypair_pool_available(), ==, 0);
+}
+
+void dh_perf_keypair_generate() {
+  OTR4_INIT;
+
+  const int iterations = 100;
+  dh_public_key_t generator = gcry_mpi_set_ui(NULL, 2);
+  uint8_t generic[DH3072_MOD_LEN_BYTES], fixed[DH3072_MOD_LEN_BYTES];
+  double fixed_base_time = 0, generic_time = 0;
+
+  for (int i = 0; i < iterations; i++) {
+    dh_keypair_t keypair;
+
+    g_test_timer_start();
+    dh_keypair_generate(keypair);
+    fixed_base_time += g_test_timer_elapsed();
+
+    g_test_timer_start();
+    dh_shared_secret(generic, sizeof(generic), keypair->priv, generator);
+    generic_time += g_test_timer_elapsed();
+
+    size_t written = 0;
+    dh_mpi_serialize(fixed, sizeof(fixed), &written, keypair->pub);
+    otrv4_assert_cmpmem(generic, fixed, written);
+
+    dh_keypair_destroy(keypair);
+  }
+
+  g_test_minimized_result(fixed_base_time / iterations,
+                          "dh_keypair_generate: %.3f ms/keypair",
+                          1000 * fixed_base_time / iterations);
+  g_test_message("generic g^x mod p: %.3f ms/keypair",
+                 1000 * generic_time / iterations);
+
+  gcry_mpi_release(generator);
+  dh_free();
+}
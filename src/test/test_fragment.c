@@ -5,7 +5,7 @@
 #include "../fragment.h"
 
 void test_create_fragments(void) {
-  int mms = 40;
+  int mms = 49;
   char *message = "one two tree";
 
   otr4_message_to_send_t *frag_message = malloc(sizeof(otr4_message_to_send_t));
@@ -13,24 +13,64 @@ void test_create_fragments(void) {
   otrv4_assert(otr4_fragment_message(mms, frag_message, 1, 2, message) ==
                OTR4_SUCCESS);
 
-  g_assert_cmpstr(frag_message->pieces[0], ==,
-                  "?OTR|00000001|00000002,00001,00004,one,");
-  g_assert_cmpstr(frag_message->pieces[1], ==,
-                  "?OTR|00000001|00000002,00002,00004, tw,");
-  g_assert_cmpstr(frag_message->pieces[2], ==,
-                  "?OTR|00000001|00000002,00003,00004,o t,");
-  g_assert_cmpstr(frag_message->pieces[3], ==,
-                  "?OTR|00000001|00000002,00004,00004,ree,");
+  // All pieces share a random identifier
+  unsigned int identifier = 0;
+  otrv4_assert(sscanf(frag_message->pieces[0], "?OTR|%08x|", &identifier) ==
+               1);
+
+  const char *pieces[] = {"00001,00004,one,", "00002,00004, tw,",
+                          "00003,00004,o t,", "00004,00004,ree,"};
+  for (int i = 0; i < 4; i++) {
+    char *expected = g_strdup_printf("?OTR|%08x|00000001|00000002,%s",
+                                     identifier, pieces[i]);
+    g_assert_cmpstr(frag_message->pieces[i], ==, expected);
+    g_free(expected);
+  }
 
   g_assert_cmpint(frag_message->total, ==, 4);
 
   otr4_message_free(frag_message);
 }
 
+void test_create_fragments_exact_sizes(void) {
+  char *message = "0123456789";
+  otr4_message_to_send_t *frag_message = otr4_message_new();
+
+  otrv4_assert(otr4_fragment_message(FRAGMENT_HEADER_LEN, frag_message, 1, 2,
+                                     message) == OTR4_ERROR);
+
+  otrv4_assert(otr4_fragment_message(FRAGMENT_HEADER_LEN + 4, frag_message, 1,
+                                     2, message) == OTR4_SUCCESS);
+  g_assert_cmpint(frag_message->total, ==, 3);
+
+  // Pieces of 4, 4 and 2, back to back
+  size_t header_len = FRAGMENT_HEADER_LEN - 2;
+  const char *pieces[] = {"0123,", "4567,", "89,"};
+  for (int i = 0; i < 3; i++) {
+    g_assert_cmpstr(frag_message->pieces[i] + header_len, ==, pieces[i]);
+    if (i > 0)
+      otrv4_assert(frag_message->pieces[i] ==
+                   frag_message->pieces[i - 1] +
+                       strlen(frag_message->pieces[i - 1]) + 1);
+  }
+
+  fragment_context_t *context = fragment_context_new();
+  char *unfrag = NULL;
+  for (int i = 0; i < 3; i++)
+    otrv4_assert(otr4_unfragment_message(&unfrag, context,
+                                         frag_message->pieces[i],
+                                         2) == OTR4_SUCCESS);
+  g_assert_cmpstr(unfrag, ==, message);
+
+  free(unfrag);
+  fragment_context_free(context);
+  otr4_message_free(frag_message);
+}
+
 void test_defragment_valid_message(void) {
   string_t fragments[2];
-  fragments[0] = "?OTR|00000001|00000002,00001,00002,one ,";
-  fragments[1] = "?OTR|00000001|00000002,00002,00002,more,";
+  fragments[0] = "?OTR|0000000a|00000001|00000002,00001,00002,one ,";
+  fragments[1] = "?OTR|0000000a|00000001|00000002,00002,00002,more,";
 
   fragment_context_t *context;
   context = fragment_context_new();
@@ -39,19 +79,20 @@ void test_defragment_valid_message(void) {
   otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[0], 2) ==
                OTR4_SUCCESS);
 
-  g_assert_cmpint(context->N, ==, 2);
-  g_assert_cmpint(context->K, ==, 1);
-  g_assert_cmpstr(context->fragment, ==, "one ");
-  g_assert_cmpint(context->fragment_len, ==, 4);
+  g_assert_cmpint(context->count, ==, 1);
+  g_assert_cmpint(context->slots[0].identifier, ==, 0xa);
+  g_assert_cmpint(context->slots[0].sender_tag, ==, 1);
+  g_assert_cmpint(context->slots[0].N, ==, 2);
+  g_assert_cmpint(context->slots[0].K, ==, 1);
+  g_assert_cmpstr(context->slots[0].pieces[0], ==, "one ");
   otrv4_assert(!unfrag);
   otrv4_assert(context->status == OTR4_FRAGMENT_INCOMPLETE);
 
   otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[1], 2) ==
                OTR4_SUCCESS);
 
-  g_assert_cmpint(context->N, ==, 2);
-  g_assert_cmpint(context->K, ==, 2);
-  g_assert_cmpint(context->fragment_len, ==, 8);
+  g_assert_cmpint(context->count, ==, 0);
+  g_assert_cmpint(context->buffered, ==, 0);
   g_assert_cmpstr(unfrag, ==, "one more");
   otrv4_assert(context->status == OTR4_FRAGMENT_COMPLETE);
 
@@ -60,7 +101,7 @@ void test_defragment_valid_message(void) {
 }
 
 void test_defragment_single_fragment(void) {
-  string_t msg = "?OTR|00000001|00000002,00001,00001,small lol,";
+  string_t msg = "?OTR|0000000a|00000001|00000002,00001,00001,small lol,";
 
   fragment_context_t *context;
   context = fragment_context_new();
@@ -69,9 +110,7 @@ void test_defragment_single_fragment(void) {
   otrv4_assert(otr4_unfragment_message(&unfrag, context, msg, 2) ==
                OTR4_SUCCESS);
 
-  g_assert_cmpint(context->N, ==, 1);
-  g_assert_cmpint(context->K, ==, 1);
-  g_assert_cmpint(context->fragment_len, ==, 9);
+  g_assert_cmpint(context->count, ==, 0);
   g_assert_cmpstr(unfrag, ==, "small lol");
   otrv4_assert(context->status == OTR4_FRAGMENT_COMPLETE);
 
@@ -80,63 +119,121 @@ void test_defragment_single_fragment(void) {
 }
 
 void test_defragment_without_comma_fails(void) {
-  string_t msg = "?OTR|00000001|00000002,00001,00001,blergh";
+  string_t msg = "?OTR|0000000a|00000001|00000002,00001,00001,blergh";
 
   fragment_context_t *context;
   context = fragment_context_new();
 
   char *unfrag = NULL;
   otrv4_assert(otr4_unfragment_message(&unfrag, context, msg, 2) == OTR4_ERROR);
-  g_assert_cmpint(context->N, ==, 0);
-  g_assert_cmpint(context->K, ==, 0);
-  g_assert_cmpint(context->fragment_len, ==, 0);
+  g_assert_cmpint(context->count, ==, 0);
+  g_assert_cmpint(context->buffered, ==, 0);
   g_assert_cmpstr(unfrag, ==, NULL);
 
   free(unfrag);
   fragment_context_free(context);
 }
 
-void test_defragment_clean_context_for_frag_out_of_order(void) {
-  string_t fragments[3];
-  fragments[0] = "?OTR|00000001|00000002,00001,00003,one more ,";
-  fragments[1] = "?OTR|00000001|00000002,00003,00003,send,";
-  fragments[2] = "?OTR|00000001|00000002,00002,00003,fragment ,";
+void test_defragment_out_of_order(void) {
+  string_t fragments[4];
+  fragments[0] = "?OTR|0000000a|00000001|00000002,00003,00003,send,";
+  fragments[1] = "?OTR|0000000a|00000001|00000002,00001,00003,one more ,";
+  fragments[2] = "?OTR|0000000a|00000001|00000002,00001,00003,one more ,";
+  fragments[3] = "?OTR|0000000a|00000001|00000002,00002,00003,fragment ,";
 
   fragment_context_t *context;
   context = fragment_context_new();
 
   char *unfrag = NULL;
-  otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[0], 2) ==
+  for (int i = 0; i < 3; i++) {
+    otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[i], 2) ==
+                 OTR4_SUCCESS);
+    otrv4_assert(context->status == OTR4_FRAGMENT_INCOMPLETE);
+    otrv4_assert(!unfrag);
+  }
+
+  // The repeated first piece is only kept once
+  g_assert_cmpint(context->count, ==, 1);
+  g_assert_cmpint(context->slots[0].K, ==, 2);
+
+  otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[3], 2) ==
                OTR4_SUCCESS);
-  otrv4_assert(context->status == OTR4_FRAGMENT_INCOMPLETE);
-  otrv4_assert(!unfrag);
-  g_assert_cmpint(context->N, ==, 3);
-  g_assert_cmpint(context->K, ==, 1);
-  g_assert_cmpstr(context->fragment, ==, "one more ");
-  g_assert_cmpint(context->fragment_len, ==, 9);
+  otrv4_assert(context->status == OTR4_FRAGMENT_COMPLETE);
+  g_assert_cmpstr(unfrag, ==, "one more fragment send");
+  g_assert_cmpint(context->count, ==, 0);
 
-  otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[1], 2) ==
-               OTR4_SUCCESS);
-  otrv4_assert(context->status == OTR4_FRAGMENT_UNFRAGMENTED);
-  otrv4_assert(!unfrag);
-  g_assert_cmpstr(context->fragment, ==, "");
-  g_assert_cmpint(context->N, ==, 0);
-  g_assert_cmpint(context->K, ==, 0);
+  free(unfrag);
+  fragment_context_free(context);
+}
 
-  otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[2], 2) ==
+void test_defragment_interleaved_messages(void) {
+  string_t fragments[6];
+  fragments[0] = "?OTR|0000000a|00000001|00000002,00001,00002,from ,";
+  fragments[1] = "?OTR|0000000b|00000001|00000002,00002,00002,second,";
+  fragments[2] = "?OTR|0000000a|00000003|00000002,00002,00002,other,";
+  fragments[3] = "?OTR|0000000b|00000001|00000002,00001,00002,the ,";
+  fragments[4] = "?OTR|0000000a|00000001|00000002,00002,00002,first,";
+  fragments[5] = "?OTR|0000000a|00000003|00000002,00001,00002,the ,";
+
+  const char *expected[] = {NULL,          NULL,        NULL,
+                            "the second", "from first", "the other"};
+
+  fragment_context_t *context;
+  context = fragment_context_new();
+
+  for (int i = 0; i < 6; i++) {
+    char *unfrag = NULL;
+    otrv4_assert(otr4_unfragment_message(&unfrag, context, fragments[i], 2) ==
+                 OTR4_SUCCESS);
+    g_assert_cmpstr(unfrag, ==, expected[i]);
+    free(unfrag);
+  }
+
+  g_assert_cmpint(context->count, ==, 0);
+  g_assert_cmpint(context->buffered, ==, 0);
+
+  fragment_context_free(context);
+}
+
+void test_defragment_forgets_stale_and_excess_messages(void) {
+  fragment_context_t *context;
+  context = fragment_context_new();
+
+  char *unfrag = NULL;
+  for (int i = 0; i <= FRAGMENT_MAX_PENDING; i++) {
+    char *msg =
+        g_strdup_printf("?OTR|%08x|00000001|00000002,00001,00002,piece,", i);
+    otrv4_assert(otr4_unfragment_message(&unfrag, context, msg, 2) ==
+                 OTR4_SUCCESS);
+    context->slots[context->count - 1].last_seen -= FRAGMENT_MAX_PENDING - i;
+    g_free(msg);
+  }
+
+  // The least recently seen message made room for the last one
+  g_assert_cmpint(context->count, ==, FRAGMENT_MAX_PENDING);
+  for (int i = 0; i < context->count; i++)
+    g_assert_cmpint(context->slots[i].identifier, !=, 0);
+
+  // Messages not seen for a while are forgotten
+  for (int i = 1; i < context->count; i++)
+    context->slots[i].last_seen -= FRAGMENT_TIMEOUT + 1;
+
+  string_t msg = "?OTR|0000000a|00000001|00000002,00001,00002,piece,";
+  otrv4_assert(otr4_unfragment_message(&unfrag, context, msg, 2) ==
                OTR4_SUCCESS);
-  otrv4_assert(context->status == OTR4_FRAGMENT_UNFRAGMENTED);
+  g_assert_cmpint(context->count, ==, 2);
+
+  // A message that can never fit is refused, without forgetting others
+  msg = "?OTR|0000000b|00000001|00000002,00001,fffff,piece,";
+  otrv4_assert(otr4_unfragment_message(&unfrag, context, msg, 2) == OTR4_ERROR);
+  g_assert_cmpint(context->count, ==, 2);
   otrv4_assert(!unfrag);
-  g_assert_cmpstr(context->fragment, ==, "");
-  g_assert_cmpint(context->N, ==, 0);
-  g_assert_cmpint(context->K, ==, 0);
 
-  free(unfrag);
   fragment_context_free(context);
 }
 
 void test_defragment_fails_for_invalid_tag(void) {
-  string_t msg = "?OTR|00000001|00000002,00001,00001,small lol,";
+  string_t msg = "?OTR|0000000a|00000001|00000002,00001,00001,small lol,";
 
   fragment_context_t *context;
   context = fragment_context_new();
@@ -144,9 +241,8 @@ void test_defragment_fails_for_invalid_tag(void) {
   char *unfrag = NULL;
   otrv4_assert(otr4_unfragment_message(&unfrag, context, msg, 1) == OTR4_ERROR);
 
-  g_assert_cmpint(context->N, ==, 0);
-  g_assert_cmpint(context->K, ==, 0);
-  g_assert_cmpint(context->fragment_len, ==, 0);
+  g_assert_cmpint(context->count, ==, 0);
+  g_assert_cmpint(context->buffered, ==, 0);
   g_assert_cmpstr(unfrag, ==, NULL);
   otrv4_assert(context->status == OTR4_FRAGMENT_COMPLETE);
 
@@ -0,0 +1,79 @@
+#include "../hashmap.h"
+
+static size_t int_hash(const void *key) {
+  return hashmap_hash_bytes(HASHMAP_HASH_INIT, key, sizeof(int));
+}
+
+// Puts every key in the same few buckets
+static size_t colliding_hash(const void *key) { return *(const int *)key % 3; }
+
+static int int_eq(const void *a, const void *b) {
+  return *(const int *)a == *(const int *)b;
+}
+
+static void check_put_get_remove(hashmap_hash_fn hash) {
+  int keys[1000], values[1000];
+  hashmap_t *map = hashmap_new(hash, int_eq);
+  otrv4_assert(map);
+
+  for (int i = 0; i < 1000; i++) {
+    keys[i] = i;
+    values[i] = -i;
+    otrv4_assert(hashmap_put(map, &keys[i], &values[i]) == OTR4_SUCCESS);
+  }
+
+  g_assert_cmpuint(map->count, ==, 1000);
+  otrv4_assert(map->capacity >= 4 * map->count / 3);
+
+  // Equal keys find the same entry
+  for (int i = 0; i < 1000; i++) {
+    int key = i;
+    otrv4_assert(hashmap_get(map, &key) == &values[i]);
+  }
+
+  int missing = 1000;
+  otrv4_assert(!hashmap_get(map, &missing));
+  otrv4_assert(!hashmap_remove(map, &missing));
+
+  // Removing keeps the others reachable
+  for (int i = 0; i < 1000; i += 2)
+    otrv4_assert(hashmap_remove(map, &keys[i]) == &values[i]);
+
+  g_assert_cmpuint(map->count, ==, 500);
+  for (int i = 0; i < 1000; i++)
+    otrv4_assert(hashmap_get(map, &keys[i]) == (i % 2 ? &values[i] : NULL));
+
+  // Putting an equal key replaces the value
+  int replacement = 42;
+  otrv4_assert(hashmap_put(map, &keys[1], &replacement) == OTR4_SUCCESS);
+  g_assert_cmpuint(map->count, ==, 500);
+  otrv4_assert(hashmap_get(map, &keys[1]) == &replacement);
+
+  hashmap_free(map);
+}
+
+void test_hashmap_put_get_remove() {
+  check_put_get_remove(int_hash);
+  check_put_get_remove(colliding_hash);
+}
+
+void test_hashmap_pointer_keys() {
+  int values[3];
+  hashmap_t *map = hashmap_new(hashmap_pointer_hash, hashmap_pointer_eq);
+  otrv4_assert(map);
+
+  // Any pointer can be a key, including NULL, but values must not be NULL
+  otrv4_assert(hashmap_put(map, NULL, &values[0]) == OTR4_SUCCESS);
+  otrv4_assert(hashmap_put(map, &values[1], &values[1]) == OTR4_SUCCESS);
+  otrv4_assert(hashmap_put(map, &values[2], NULL) == OTR4_ERROR);
+
+  otrv4_assert(hashmap_get(map, NULL) == &values[0]);
+  otrv4_assert(hashmap_get(map, &values[1]) == &values[1]);
+  otrv4_assert(!hashmap_get(map, &values[2]));
+  g_assert_cmpuint(map->count, ==, 2);
+
+  otrv4_assert(hashmap_remove(map, NULL) == &values[0]);
+  otrv4_assert(!hashmap_get(map, NULL));
+
+  hashmap_free(map);
+}
@@ -63,3 +63,212 @@ void test_key_manager_destroy() {
 
   OTR4_FREE;
 }
+
+void test_key_manager_old_mac_keys() {
+  key_manager_t manager[1];
+  key_manager_init(manager);
+
+  m_mac_key_t mac_keys[6];
+  for (int i = 0; i < 6; i++)
+    memset(mac_keys[i], i + 1, sizeof(m_mac_key_t));
+
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==, 0);
+
+  // Kept back to back, in the order they were stored
+  for (int i = 0; i < 5; i++)
+    otrv4_assert(key_manager_store_old_mac_key(mac_keys[i], manager) ==
+                 OTR4_SUCCESS);
+
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==,
+                   5 * MAC_KEY_BYTES);
+  for (int i = 0; i < 5; i++)
+    otrv4_assert_cmpmem(manager->old_mac_keys->keys + i * MAC_KEY_BYTES,
+                        mac_keys[i], MAC_KEY_BYTES);
+
+  // Revealing the keys forgets them
+  key_manager_forget_old_mac_keys(manager);
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==, 0);
+
+  // No more than max_old_mac_keys are revealed at once
+  key_manager_set_max_old_mac_keys(3, manager);
+  for (int i = 0; i < 6; i++)
+    otrv4_assert(key_manager_store_old_mac_key(mac_keys[i], manager) ==
+                 OTR4_SUCCESS);
+
+  g_assert_cmpuint(manager->old_mac_keys->count, ==, 6);
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==,
+                   3 * MAC_KEY_BYTES);
+  otrv4_assert_cmpmem(manager->old_mac_keys->keys, mac_keys[0],
+                      3 * MAC_KEY_BYTES);
+
+  // But the rest are revealed by the following messages
+  key_manager_forget_old_mac_keys(manager);
+  g_assert_cmpuint(manager->old_mac_keys->count, ==, 3);
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==,
+                   3 * MAC_KEY_BYTES);
+  for (int i = 0; i < 3; i++)
+    otrv4_assert_cmpmem(manager->old_mac_keys->keys + i * MAC_KEY_BYTES,
+                        mac_keys[3 + i], MAC_KEY_BYTES);
+
+  key_manager_set_max_old_mac_keys(1, manager);
+  g_assert_cmpuint(manager->old_mac_keys->count, ==, 3);
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==, MAC_KEY_BYTES);
+
+  key_manager_forget_old_mac_keys(manager);
+  key_manager_forget_old_mac_keys(manager);
+  g_assert_cmpuint(manager->old_mac_keys->count, ==, 1);
+  otrv4_assert_cmpmem(manager->old_mac_keys->keys, mac_keys[5],
+                      MAC_KEY_BYTES);
+
+  key_manager_forget_old_mac_keys(manager);
+  g_assert_cmpuint(key_manager_old_mac_keys_len(manager), ==, 0);
+
+  key_manager_destroy(manager);
+  otrv4_assert(!manager->old_mac_keys->keys);
+}
+
+static void key_manager_with_keys(key_manager_t *manager, uint8_t seed) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {seed};
+
+  key_manager_init(manager);
+  ecdh_keypair_generate(manager->our_ecdh, sym);
+}
+
+/* Looks the key up and uses it up, as an authenticated message does */
+static otr4_err_t receive_chain_key(chain_key_t received, int message_id,
+                                    key_manager_t *manager) {
+  if (key_manager_get_receiving_chain_key(received, message_id, manager))
+    return OTR4_ERROR;
+
+  return key_manager_consume_receiving_chain_key(message_id, manager);
+}
+
+void test_key_manager_skipped_keys() {
+  OTR4_INIT;
+
+  key_manager_t alice[1], bob[1];
+  key_manager_with_keys(alice, 1);
+  key_manager_with_keys(bob, 2);
+  key_manager_set_their_ecdh(bob->our_ecdh->pub, alice);
+  key_manager_set_their_ecdh(alice->our_ecdh->pub, bob);
+
+  shared_secret_t shared;
+  memset(shared, 0, sizeof(shared_secret_t));
+  otrv4_assert(key_manager_new_ratchet(alice, shared) == OTR4_SUCCESS);
+  otrv4_assert(key_manager_new_ratchet(bob, shared) == OTR4_SUCCESS);
+
+  chain_key_t sent[6], received;
+  bob->j = 1;
+  for (int i = 0; i < 6; i++) {
+    g_assert_cmpint(key_manager_get_sending_chain_key(sent[i], bob), ==, i);
+    otrv4_assert(key_manager_prepare_next_chain_key(bob) == OTR4_SUCCESS);
+  }
+
+  // Looking keys up, as for a forged message, uses nothing up
+  otrv4_assert(key_manager_get_receiving_chain_key(received, 3, alice) ==
+               OTR4_SUCCESS);
+  otrv4_assert_chain_key_eq(received, sent[3]);
+  otrv4_assert(key_manager_get_receiving_chain_key(received, 900, alice) ==
+               OTR4_SUCCESS);
+  g_assert_cmpint(alice->skipped_keys->count, ==, 0);
+  g_assert_cmpint(alice->chain->receiving->id, ==, 0);
+
+  // Out of order
+  otrv4_assert(receive_chain_key(received, 3, alice) == OTR4_SUCCESS);
+  otrv4_assert_chain_key_eq(received, sent[3]);
+  g_assert_cmpint(alice->skipped_keys->count, ==, 3);
+
+  otrv4_assert(receive_chain_key(received, 1, alice) == OTR4_SUCCESS);
+  otrv4_assert_chain_key_eq(received, sent[1]);
+
+  // Each key is handed out only once
+  otrv4_assert(receive_chain_key(received, 1, alice) == OTR4_ERROR);
+  otrv4_assert(receive_chain_key(received, 3, alice) == OTR4_ERROR);
+
+  otrv4_assert(receive_chain_key(received, 0, alice) == OTR4_SUCCESS);
+  otrv4_assert_chain_key_eq(received, sent[0]);
+
+  otrv4_assert(receive_chain_key(received, 4, alice) == OTR4_SUCCESS);
+  otrv4_assert_chain_key_eq(received, sent[4]);
+  g_assert_cmpint(alice->skipped_keys->count, ==, 1);
+
+  // Can not skip more than max_skip messages
+  key_manager_set_max_skip(3, alice);
+  otrv4_assert(receive_chain_key(received, 9, alice) == OTR4_ERROR);
+
+  otrv4_assert(receive_chain_key(received, 2, alice) == OTR4_SUCCESS);
+  otrv4_assert_chain_key_eq(received, sent[2]);
+  g_assert_cmpint(alice->skipped_keys->count, ==, 0);
+
+  // Skipped keys do not survive a new ratchet
+  otrv4_assert(receive_chain_key(received, 7, alice) == OTR4_SUCCESS);
+  g_assert_cmpint(alice->skipped_keys->count, ==, 2);
+  otrv4_assert(key_manager_new_ratchet(alice, shared) == OTR4_SUCCESS);
+  g_assert_cmpint(alice->skipped_keys->count, ==, 0);
+  otrv4_assert(receive_chain_key(received, 5, alice) == OTR4_ERROR);
+
+  key_manager_destroy(alice);
+  key_manager_destroy(bob);
+
+  OTR4_FREE;
+}
+
+/* What every key derivation used to do before the decision was cached */
+static int legacy_decide_between_chain_keys(const ec_point_t our,
+                                            const ec_point_t their) {
+  message_chain_t *chain = malloc(sizeof(message_chain_t));
+  gcry_mpi_t our_mpi = NULL, their_mpi = NULL;
+  gcry_mpi_scan(&our_mpi, GCRYMPI_FMT_USG, our, sizeof(ec_public_key_t), NULL);
+  gcry_mpi_scan(&their_mpi, GCRYMPI_FMT_USG, their, sizeof(ec_public_key_t),
+                NULL);
+  int cmp = gcry_mpi_cmp(our_mpi, their_mpi);
+  gcry_mpi_release(our_mpi);
+  gcry_mpi_release(their_mpi);
+  free(chain);
+
+  return cmp;
+}
+
+void test_key_manager_perf_chain_decision() {
+  OTR4_INIT;
+
+  key_manager_t alice[1], bob[1];
+  key_manager_with_keys(alice, 1);
+  key_manager_with_keys(bob, 2);
+  key_manager_set_their_ecdh(bob->our_ecdh->pub, alice);
+  key_manager_set_their_ecdh(alice->our_ecdh->pub, bob);
+
+  shared_secret_t shared;
+  memset(shared, 0, sizeof(shared_secret_t));
+  otrv4_assert(key_manager_new_ratchet(bob, shared) == OTR4_SUCCESS);
+
+  const int messages = 10000;
+  m_enc_key_t enc_key;
+  m_mac_key_t mac_key;
+
+  bob->j = 1;
+  g_test_timer_start();
+  for (int i = 0; i < messages; i++) {
+    key_manager_prepare_next_chain_key(bob);
+    key_manager_retrieve_sending_message_keys(enc_key, mac_key, bob);
+    bob->j++;
+  }
+  double cached = g_test_timer_elapsed();
+
+  /* Sending a message used to decide twice */
+  g_test_timer_start();
+  for (int i = 0; i < 2 * messages; i++)
+    legacy_decide_between_chain_keys(bob->our_ecdh->pub, bob->their_ecdh);
+  double decisions = g_test_timer_elapsed();
+
+  g_test_minimized_result(cached / messages,
+                          "sending keys: %.3f us/message",
+                          1e6 * cached / messages);
+  g_test_message("deciding between chains on every call: %.3f us/message",
+                 1e6 * (cached + decisions) / messages);
+
+  key_manager_destroy(alice);
+  key_manager_destroy(bob);
+
+  OTR4_FREE;
+}
@@ -77,3 +77,73 @@ void test_list_empty_size() {
   g_assert_cmpint(list_len(empty), ==, 0);
   list_free_nodes(empty);
 }
+
+void test_list_append() {
+  int one = 1, two = 2, three = 3;
+  list_t list[1];
+  list_init(list);
+  g_assert_cmpuint(list_size(list), ==, 0);
+
+  otrv4_assert(list_append(list, &one));
+  otrv4_assert(list->head == list->tail);
+
+  otrv4_assert(list_append(list, &two));
+  otrv4_assert(list_append(list, &three));
+  g_assert_cmpuint(list_size(list), ==, 3);
+  g_assert_cmpint(one, ==, *((int *)list->head->data));
+  g_assert_cmpint(two, ==, *((int *)list->head->next->data));
+  g_assert_cmpint(three, ==, *((int *)list->tail->data));
+
+  // Removes the last one, and then the first one
+  list_element_t *last = list->tail;
+  list_unlink(list, last);
+  otrv4_assert(!last->next);
+  list_free_nodes(last);
+  g_assert_cmpuint(list_size(list), ==, 2);
+  g_assert_cmpint(two, ==, *((int *)list->tail->data));
+
+  list_element_t *first = list->head;
+  list_unlink(list, first);
+  list_free_nodes(first);
+  g_assert_cmpuint(list_size(list), ==, 1);
+  otrv4_assert(list->head == list->tail);
+
+  // Appends after what is left
+  otrv4_assert(list_append(list, &three));
+  g_assert_cmpint(two, ==, *((int *)list->head->data));
+  g_assert_cmpint(three, ==, *((int *)list->head->next->data));
+  g_assert_cmpuint(list_size(list), ==, 2);
+
+  list_clear(list, NULL);
+  otrv4_assert(!list->head);
+  otrv4_assert(!list->tail);
+  g_assert_cmpuint(list_size(list), ==, 0);
+}
+
+void test_list_perf_append() {
+  int one = 1;
+  list_t list[1];
+  list_init(list);
+
+  for (size_t len = 10000; len <= 40000; len *= 2) {
+    list_element_t *head = NULL;
+
+    g_test_timer_start();
+    for (size_t i = 0; i < len; i++)
+      head = list_add(&one, head);
+    g_assert_cmpuint(list_len(head), ==, len);
+    double walking = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (size_t i = 0; i < len; i++)
+      list_append(list, &one);
+    g_assert_cmpuint(list_size(list), ==, len);
+    double appending = g_test_timer_elapsed();
+
+    g_test_message("%zu elements: list_add %.4fs, list_append %.4fs", len,
+                   walking, appending);
+
+    list_free_nodes(head);
+    list_clear(list, NULL);
+  }
+}
@@ -74,6 +74,40 @@ void test_api_messaging(void) {
   test_state = NULL;
 }
 
+void test_messaging_client_lookup(void) {
+  OTR4_INIT;
+
+  char accounts[100];
+  otr4_messaging_client_t *clients[100];
+
+  otr4_userstate_t *state = otr4_user_state_new(NULL);
+  otrv4_assert(!otr4_messaging_client_new(state, NULL));
+
+  for (int i = 0; i < 100; i++) {
+    clients[i] = otr4_messaging_client_new(state, &accounts[i]);
+    otrv4_assert(clients[i]);
+    otrv4_assert(clients[i]->state->client_id == &accounts[i]);
+  }
+
+  // Clients are found by the client_id pointer, not by its contents
+  for (int i = 0; i < 100; i++) {
+    otrv4_assert(otr4_messaging_client_get(state, &accounts[i]) == clients[i]);
+    otrv4_assert(otr4_messaging_client_new(state, &accounts[i]) == clients[i]);
+  }
+
+  g_assert_cmpuint(state->clients_by_client_id->count, ==, 100);
+  g_assert_cmpuint(state->states_by_client_id->count, ==, 100);
+
+  // A client shares the state its keys were added to
+  const uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  otr4_user_state_add_private_key_v4(state, &accounts[7], sym);
+  otrv4_assert(clients[7]->state->keypair ==
+               otr4_user_state_get_private_key_v4(state, &accounts[7]));
+  g_assert_cmpuint(state->states_by_client_id->count, ==, 100);
+
+  otr4_user_state_free(state);
+}
+
 void test_instance_tag_api(void) {
   char *alice_account = "alice@xmpp";
   char *icq_alice_account = "alice_icq";
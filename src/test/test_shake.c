@@ -0,0 +1,77 @@
+#include "../shake.h"
+
+#define SHAKE_TEST_MAX_BYTES 300
+
+void test_shake_kdf_lanes() {
+  shake_lanes_kernel_t best = shake_lanes_kernel();
+  const size_t secret_lens[] = {0, 1, 64, 135, 136, 137, 300};
+  const size_t key_lens[] = {32, 64, 1, 136, 137, 300};
+  uint8_t secret[SHAKE_TEST_MAX_BYTES];
+
+  for (size_t i = 0; i < sizeof(secret); i++)
+    secret[i] = g_test_rand_int_range(0, 256);
+
+  for (int k = SHAKE_LANES_SCALAR; k <= best; k++) {
+    shake_lanes_set_kernel(k);
+
+    for (size_t s = 0; s < sizeof(secret_lens) / sizeof(size_t); s++)
+      for (size_t count = 1; count <= SHAKE_KDF_LANES + 2; count++) {
+        shake_kdf_lane_t lanes[SHAKE_KDF_LANES + 2];
+        uint8_t keys[SHAKE_KDF_LANES + 2][SHAKE_TEST_MAX_BYTES + 1];
+        memset(keys, 0xAB, sizeof(keys));
+
+        for (size_t l = 0; l < count; l++) {
+          lanes[l].key = keys[l];
+          lanes[l].keylen = key_lens[(l + s) % 6];
+          lanes[l].magic = l + 1;
+        }
+
+        shake_256_kdf_lanes(lanes, count, secret, secret_lens[s]);
+
+        for (size_t l = 0; l < count; l++) {
+          uint8_t expected[SHAKE_TEST_MAX_BYTES];
+          shake_256_kdf(expected, lanes[l].keylen, &lanes[l].magic, secret,
+                        secret_lens[s]);
+          otrv4_assert_cmpmem(keys[l], expected, lanes[l].keylen);
+          g_assert_cmpuint(keys[l][lanes[l].keylen], ==, 0xAB);
+        }
+      }
+  }
+
+  shake_lanes_set_kernel(best);
+}
+
+void test_shake_perf_kdf_lanes() {
+  const char *names[] = {"scalar", "avx2"};
+  shake_lanes_kernel_t best = shake_lanes_kernel();
+  const int iterations = 100000;
+  uint8_t secret[CHAIN_KEY_BYTES] = {1}, keys[SHAKE_KDF_LANES][MAC_KEY_BYTES];
+
+  shake_kdf_lane_t lanes[SHAKE_KDF_LANES];
+  for (int l = 0; l < SHAKE_KDF_LANES; l++) {
+    lanes[l].key = keys[l];
+    lanes[l].keylen = MAC_KEY_BYTES;
+    lanes[l].magic = l + 1;
+  }
+
+  g_test_timer_start();
+  for (int i = 0; i < iterations; i++)
+    for (int l = 0; l < SHAKE_KDF_LANES; l++)
+      shake_256_kdf(keys[l], MAC_KEY_BYTES, &lanes[l].magic, secret,
+                    sizeof(secret));
+  g_test_message("one at a time: %.0f derivations/s",
+                 SHAKE_KDF_LANES * iterations / g_test_timer_elapsed());
+
+  for (int k = SHAKE_LANES_SCALAR; k <= best; k++) {
+    shake_lanes_set_kernel(k);
+
+    g_test_timer_start();
+    for (int i = 0; i < iterations; i++)
+      shake_256_kdf_lanes(lanes, SHAKE_KDF_LANES, secret, sizeof(secret));
+    g_test_message("%s, %d lanes: %.0f derivations/s", names[k],
+                   SHAKE_KDF_LANES,
+                   SHAKE_KDF_LANES * iterations / g_test_timer_elapsed());
+  }
+
+  shake_lanes_set_kernel(best);
+}
@@ -0,0 +1,140 @@
+#include "../shard.h"
+
+#include <unistd.h>
+
+#define SHARD_QUERY_MESSAGE "?OTRv4? Hi bob"
+
+static char *shard_bob_account = "bob@xmpp";
+
+typedef struct {
+  int result;
+  char *to_send;
+  char *to_display;
+} shard_result_t;
+
+static void store_result(int result, char *to_send, char *to_display,
+                         void *data) {
+  shard_result_t *stored = data;
+  stored->result = result;
+  stored->to_send = to_send;
+  stored->to_display = to_display;
+}
+
+static otr4_userstate_t *shard_bob_state(void) {
+  const uint8_t sym[ED448_PRIVATE_BYTES] = {2};
+
+  otr4_userstate_t *state = otr4_user_state_new(NULL);
+  otr4_user_state_add_private_key_v4(state, shard_bob_account, sym);
+
+  return state;
+}
+
+// Bob answers a query message from each of the recipients
+static void receive_queries(otr4_userstate_t *state, size_t shard_count,
+                            size_t recipients, shard_result_t *results) {
+  otr4_shards_t *shards = otr4_shards_new(state, shard_count);
+  otrv4_assert(shards);
+
+  for (size_t i = 0; i < recipients; i++) {
+    char *recipient = g_strdup_printf("alice%zu@xmpp", i);
+    otrv4_assert(otr4_shards_receive(shards, shard_bob_account, recipient,
+                                     SHARD_QUERY_MESSAGE, store_result,
+                                     &results[i]) == OTR4_SUCCESS);
+    g_free(recipient);
+  }
+
+  // Waits for every message
+  otr4_shards_free(shards);
+}
+
+void test_shards_receive_messages(void) {
+  OTR4_INIT;
+
+  const size_t recipients = 16;
+  shard_result_t results[16];
+  memset(results, 0, sizeof(results));
+
+  otr4_userstate_t *state = shard_bob_state();
+  receive_queries(state, 4, recipients, results);
+
+  for (size_t i = 0; i < recipients; i++) {
+    otrv4_assert(results[i].to_send);
+    otrv4_assert(!strncmp(results[i].to_send, "?OTR:", 5));
+    otrv4_assert(!results[i].to_display);
+    free(results[i].to_send);
+  }
+
+  // Each recipient has its own conversation
+  otr4_client_t *bob = otr4_messaging_client_get(state, shard_bob_account);
+  g_assert_cmpuint(list_size(bob->conversations), ==, recipients);
+
+  otr4_user_state_free(state);
+
+  OTR4_FREE
+}
+
+void test_shards_index(void) {
+  otr4_userstate_t *state = otr4_user_state_new(NULL);
+  otr4_shards_t *shards = otr4_shards_new(state, 3);
+  otrv4_assert(shards);
+  otrv4_assert(!otr4_shards_new(state, 0));
+
+  size_t used[3] = {0};
+  for (int i = 0; i < 300; i++) {
+    char *recipient = g_strdup_printf("alice%d@xmpp", i);
+    size_t index = otr4_shards_index(shards, shard_bob_account, recipient);
+    g_assert_cmpuint(index, <, 3);
+    g_assert_cmpuint(otr4_shards_index(shards, shard_bob_account, recipient),
+                     ==, index);
+    used[index]++;
+    g_free(recipient);
+  }
+
+  for (int i = 0; i < 3; i++)
+    g_assert_cmpuint(used[i], >, 0);
+
+  otr4_shards_free(shards);
+  otr4_user_state_free(state);
+}
+
+void test_shards_perf_scaling(void) {
+  OTR4_INIT;
+
+  const size_t recipients = 256;
+  shard_result_t *results = malloc(recipients * sizeof(shard_result_t));
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+    cores = 1;
+
+  for (size_t count = 1; count <= (size_t)cores; count++) {
+    // Powers of two, and all the cores
+    if ((count & (count - 1)) && count != (size_t)cores)
+      continue;
+
+    otr4_userstate_t *state = shard_bob_state();
+    memset(results, 0, recipients * sizeof(shard_result_t));
+
+    g_test_timer_start();
+    receive_queries(state, count, recipients, results);
+    double elapsed = g_test_timer_elapsed();
+
+    for (size_t i = 0; i < recipients; i++) {
+      otrv4_assert(results[i].to_send);
+      free(results[i].to_send);
+    }
+
+    if (count == (size_t)cores)
+      g_test_maximized_result(recipients / elapsed,
+                              "%zu shards: %.0f identity messages/s", count,
+                              recipients / elapsed);
+    else
+      g_test_message("%zu shards: %.0f identity messages/s", count,
+                     recipients / elapsed);
+
+    otr4_user_state_free(state);
+  }
+
+  free(results);
+
+  OTR4_FREE
+}
@@ -213,6 +213,7 @@ void test_smp_validates_msg_2(void) {
   uint8_t *buff = NULL;
   size_t bufflen = 0;
   tlv_t *tlv;
+  tlv_view_t view[1];
 
   smp_context_t smp;
   smp->msg1 = NULL;
@@ -227,7 +228,8 @@ void test_smp_validates_msg_2(void) {
   tlv = otrv4_tlv_new(OTRV4_TLV_SMP_MSG_2, bufflen, buff);
   free(buff);
 
-  g_assert_cmpint(smp_msg_2_deserialize(smp_msg_2, tlv), ==, 0);
+  otrv4_tlv_view(view, tlv);
+  g_assert_cmpint(smp_msg_2_deserialize(smp_msg_2, view), ==, 0);
   otrv4_tlv_free(tlv);
 
   otrv4_assert(smp_msg_2_valid_points(msg_2) == true);
@@ -252,6 +254,7 @@ void test_smp_validates_msg_3(void) {
   uint8_t *buff = NULL;
   size_t bufflen = 0;
   tlv_t *tlv;
+  tlv_view_t view[1];
 
   smp_context_t smp;
   smp->msg1 = NULL;
@@ -277,7 +280,8 @@ void test_smp_validates_msg_3(void) {
   tlv = otrv4_tlv_new(OTRV4_TLV_SMP_MSG_3, bufflen, buff);
   free(buff);
 
-  g_assert_cmpint(smp_msg_3_deserialize(msg_3, tlv), ==, 0);
+  otrv4_tlv_view(view, tlv);
+  g_assert_cmpint(smp_msg_3_deserialize(msg_3, view), ==, 0);
   otrv4_tlv_free(tlv);
 
   otrv4_assert(smp_msg_3_validate_zkp(msg_3, smp2) == true);
@@ -297,6 +301,7 @@ void test_smp_validates_msg_4(void) {
   uint8_t *buff = NULL;
   size_t bufflen = 0;
   tlv_t *tlv;
+  tlv_view_t view[1];
 
   smp_context_t smp;
   smp->msg1 = NULL;
@@ -324,7 +329,8 @@ void test_smp_validates_msg_4(void) {
   tlv = otrv4_tlv_new(OTRV4_TLV_SMP_MSG_4, bufflen, buff);
   free(buff);
 
-  g_assert_cmpint(smp_msg_4_deserialize(msg_4, tlv), ==, 0);
+  otrv4_tlv_view(view, tlv);
+  g_assert_cmpint(smp_msg_4_deserialize(msg_4, view), ==, 0);
   otrv4_tlv_free(tlv);
 
   otrv4_assert(smp_msg_4_validate_zkp(msg_4, smp) == true);
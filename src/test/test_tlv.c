@@ -66,7 +66,42 @@ void test_tlv_parse() {
   assert_tlv_structure(tlv5->next->next, OTRV4_TLV_SMP_MSG_4, sizeof(data1),
                        data1, !next_exists);
 
-  otrv4_tlv_free_all(5, tlv1, tlv2, tlv3, tlv4, tlv5);
+  // Padding can be left out
+  uint8_t msg6[12] = {0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+                      0x06, 0x00, 0x03, 0x08, 0x05, 0x09};
+  otrv4_assert(!otrv4_parse_tlvs_unpadded(msg2, sizeof(msg2)));
+
+  tlv_t *tlv6 = otrv4_parse_tlvs_unpadded(msg6, sizeof(msg6));
+  assert_tlv_structure(tlv6, OTRV4_TLV_SMP_ABORT, sizeof(data1), data1,
+                       !next_exists);
+
+  otrv4_tlv_free_all(6, tlv1, tlv2, tlv3, tlv4, tlv5, tlv6);
+}
+
+void test_tlv_iterate() {
+  uint8_t msg[22] = {0x00, 0x06, 0x00, 0x03, 0x08, 0x05, 0x09, 0x00,
+                     0x02, 0x00, 0x04, 0xac, 0x04, 0x05, 0x06, 0x00,
+                     0x09, 0x00, 0x05, 0x08, 0x05, 0x09};
+
+  tlv_view_t view[1];
+  tlv_iter_t it[1];
+  otrv4_tlv_iter_init(it, msg, sizeof(msg));
+
+  otrv4_assert(otrv4_tlv_iter_next(view, it));
+  otrv4_assert(view->type == OTRV4_TLV_SMP_ABORT);
+  otrv4_assert(view->len == 3);
+  otrv4_assert(view->data == msg + 4);
+
+  otrv4_assert(otrv4_tlv_iter_next(view, it));
+  otrv4_assert(view->type == OTRV4_TLV_SMP_MSG_1);
+  otrv4_assert(view->len == 4);
+  otrv4_assert(view->data == msg + 11);
+
+  // The last one is truncated
+  otrv4_assert(!otrv4_tlv_iter_next(view, it));
+
+  otrv4_tlv_iter_init(it, msg, 0);
+  otrv4_assert(!otrv4_tlv_iter_next(view, it));
 }
 
 void test_tlv_new_padding() {
@@ -147,4 +182,36 @@ void test_append_padding_tlv() {
   otrv4_assert(tlv->next->next == NULL);
 
   otrv4_tlv_free(tlv);
+
+  // There is no chain to append to
+  append_padding_tlv(NULL, 15);
+}
+
+void test_padding_policy() {
+  otrv4_padding_policy_t block = OTRV4_PADDING_POLICY_DEFAULT;
+  otrv4_assert(otrv4_padding_policy_valid(&block));
+  g_assert_cmpuint(otrv4_padding_len(&block, 2), ==, 250);
+  g_assert_cmpuint(otrv4_padding_len(&block, 252), ==, 256);
+
+  block.max_overhead = 16;
+  g_assert_cmpuint(otrv4_padding_len(&block, 2), ==, 16);
+  g_assert_cmpuint(otrv4_padding_len(&block, 250), ==, 2);
+
+  block.block = 0;
+  otrv4_assert(!otrv4_padding_policy_valid(&block));
+
+  otrv4_padding_policy_t none = {OTRV4_PADDING_NONE, 0, 0};
+  otrv4_assert(otrv4_padding_policy_valid(&none));
+  g_assert_cmpuint(otrv4_padding_len(&none, 2), ==, 0);
+
+  otrv4_padding_policy_t buckets = {OTRV4_PADDING_BUCKETS, 32, 0};
+  otrv4_assert(otrv4_padding_policy_valid(&buckets));
+  g_assert_cmpuint(otrv4_padding_len(&buckets, 2), ==, 26);
+  g_assert_cmpuint(otrv4_padding_len(&buckets, 28), ==, 0);
+  g_assert_cmpuint(otrv4_padding_len(&buckets, 29), ==, 31);
+  g_assert_cmpuint(otrv4_padding_len(&buckets, 1000), ==, 20);
+  g_assert_cmpuint(otrv4_padding_len(&buckets, 100000), ==, 31068);
+
+  buckets.block = 0x8001;
+  otrv4_assert(!otrv4_padding_policy_valid(&buckets));
 }
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "../client_state.h"
 #include "../serialize.h"
 #include "../str.h"
 #include "../user_profile.h"
@@ -170,3 +171,148 @@ void test_user_profile_build() {
 
   user_profile_free(profile);
 }
+
+void test_user_profile_caches_valid_signatures() {
+  otrv4_keypair_t keypair[1];
+  uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  otrv4_keypair_generate(keypair, sym);
+  user_profile_cache_clear();
+
+  user_profile_t *profile = user_profile_build("4", keypair);
+  otrv4_assert(user_profile_valid_signature(profile));
+  g_assert_cmpuint(user_profile_cache_count(), ==, 1);
+  otrv4_assert(user_profile_valid_signature(profile));
+  g_assert_cmpuint(user_profile_cache_count(), ==, 1);
+
+  // Changing what was signed, or the signature, misses the cache
+  profile->expires++;
+  otrv4_assert(!user_profile_valid_signature(profile));
+  profile->expires--;
+  profile->signature[0] ^= 1;
+  otrv4_assert(!user_profile_valid_signature(profile));
+  profile->signature[0] ^= 1;
+  g_assert_cmpuint(user_profile_cache_count(), ==, 1);
+
+  // Expired profiles are not remembered
+  user_profile_t *expired = user_profile_new("4");
+  expired->expires = 15;
+  user_profile_sign(expired, keypair);
+  otrv4_assert(user_profile_valid_signature(expired));
+  g_assert_cmpuint(user_profile_cache_count(), ==, 1);
+
+  // The least recently used are forgotten
+  for (int i = 0; i <= USER_PROFILE_CACHE_SIZE; i++) {
+    expired->expires = time(NULL) + 60 + i;
+    user_profile_sign(expired, keypair);
+    otrv4_assert(user_profile_valid_signature(expired));
+  }
+
+  g_assert_cmpuint(user_profile_cache_count(), ==, USER_PROFILE_CACHE_SIZE);
+  otrv4_assert(user_profile_valid_signature(profile));
+
+  user_profile_cache_clear();
+  g_assert_cmpuint(user_profile_cache_count(), ==, 0);
+
+  user_profile_free(expired);
+  user_profile_free(profile);
+}
+
+void test_user_profile_caches_serialized() {
+  otrv4_keypair_t keypair[1];
+  uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  otrv4_keypair_generate(keypair, sym);
+
+  user_profile_t *profile = user_profile_build("4", keypair);
+  size_t len = 0, expected_len = 0;
+  uint8_t *expected = NULL;
+  otrv4_assert(user_profile_asprintf(&expected, &expected_len, profile) ==
+               OTR4_SUCCESS);
+
+  const uint8_t *serialized = user_profile_serialized(profile, &len);
+  g_assert_cmpuint(len, ==, expected_len);
+  otrv4_assert_cmpmem(serialized, expected, len);
+  otrv4_assert(user_profile_serialized(profile, NULL) == serialized);
+
+  uint8_t expected_hash[HASH_BYTES], hash[HASH_BYTES];
+  decaf_shake256_ctx_t hd;
+  hash_init_with_dom(hd);
+  hash_update(hd, expected, expected_len);
+  hash_final(hd, expected_hash, HASH_BYTES);
+  hash_destroy(hd);
+
+  otrv4_assert(user_profile_hash(hash, profile) == OTR4_SUCCESS);
+  otrv4_assert_cmpmem(hash, expected_hash, HASH_BYTES);
+  free(expected);
+
+  // Copies carry the cache along
+  user_profile_t copy[1];
+  user_profile_copy(copy, profile);
+  otrv4_assert(copy->serialized && copy->serialized != serialized);
+  otrv4_assert_cmpmem(user_profile_serialized(copy, NULL), serialized, len);
+  otrv4_assert(user_profile_hash(hash, copy) == OTR4_SUCCESS);
+  otrv4_assert_cmpmem(hash, expected_hash, HASH_BYTES);
+  user_profile_destroy(copy);
+
+  // Signing again forgets it
+  profile->expires++;
+  user_profile_sign(profile, keypair);
+  otrv4_assert(!profile->serialized && !profile->hashed);
+  otrv4_assert(user_profile_asprintf(&expected, &expected_len, profile) ==
+               OTR4_SUCCESS);
+  otrv4_assert_cmpmem(user_profile_serialized(profile, NULL), expected,
+                      expected_len);
+  otrv4_assert(user_profile_hash(hash, profile) == OTR4_SUCCESS);
+  otrv4_assert(memcmp(hash, expected_hash, HASH_BYTES));
+
+  free(expected);
+  user_profile_free(profile);
+}
+
+void test_user_profile_renews_in_background() {
+  OTR4_INIT;
+
+  uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  otr4_client_state_t *state = otr4_client_state_new(NULL);
+  otr4_client_state_add_private_key_v4(state, sym);
+
+  otrv4_assert(!otr4_client_state_profile_expires(state));
+  otrv4_assert(!otr4_client_state_get_profile(state, "4", 0));
+  otrv4_assert(otr4_client_state_start_profile_renewal(state, "4", 3, 3) ==
+               OTR4_ERROR);
+
+  // Lives for 3 seconds, and is replaced 2 seconds before it expires
+  otrv4_assert(otr4_client_state_start_profile_renewal(state, "4", 3, 2) ==
+               OTR4_SUCCESS);
+  otrv4_assert(otr4_client_state_start_profile_renewal(state, "4", 3, 2) ==
+               OTR4_ERROR);
+
+  uint64_t expires = otr4_client_state_profile_expires(state);
+  otrv4_assert(expires >= time(NULL) + 2);
+
+  user_profile_t *first = otr4_client_state_get_profile(state, "4", 0);
+  otrv4_assert(first);
+  g_assert_cmpuint(first->expires, ==, expires);
+  otrv4_assert(user_profile_valid_signature(first));
+  otrv4_assert(!otr4_client_state_get_profile(state, "43", 0));
+  otrv4_assert(!otr4_client_state_get_profile(state, "4", expires));
+
+  for (int i = 0; i < 50 && otr4_client_state_profile_expires(state) == expires;
+       i++)
+    g_usleep(100 * 1000);
+
+  user_profile_t *renewed =
+      otr4_client_state_get_profile(state, "4", first->expires);
+  otrv4_assert(renewed);
+  g_assert_cmpuint(renewed->expires, >, first->expires);
+  otrv4_assert(user_profile_valid_signature(renewed));
+
+  otr4_client_state_stop_profile_renewal(state);
+  otrv4_assert(!otr4_client_state_profile_expires(state));
+  otrv4_assert(!otr4_client_state_get_profile(state, "4", 0));
+
+  user_profile_free(first);
+  user_profile_free(renewed);
+  otr4_client_state_free(state);
+
+  OTR4_FREE
+}
@@ -10,63 +10,45 @@ const tlv_type_t tlv_types[] = {OTRV4_TLV_PADDING,   OTRV4_TLV_DISCONNECTED,
                                 OTRV4_TLV_SMP_MSG_3, OTRV4_TLV_SMP_MSG_4,
                                 OTRV4_TLV_SMP_ABORT};
 
-void set_tlv_type(tlv_t *tlv, uint16_t tlv_type) {
-  tlv_type_t type = OTRV4_TLV_NONE;
+static tlv_type_t get_tlv_type(uint16_t tlv_type) {
+  if (tlv_type < sizeof(tlv_types) / sizeof(tlv_type_t))
+    return tlv_types[tlv_type];
 
-  if (tlv_type >= 0 && tlv_type < 7) {
-    type = tlv_types[tlv_type];
-  }
-
-  tlv->type = type;
+  return OTRV4_TLV_NONE;
 }
 
-static tlv_t *extract_tlv(const uint8_t *src, size_t len, size_t *written) {
-  size_t w = 0;
-  tlv_t *tlv = NULL;
-  uint16_t tlv_type = -1;
-  const uint8_t *start = src + *written;
-  const uint8_t *cursor = start;
-
-  do {
-
-    tlv = malloc(sizeof(tlv_t));
-    if (!tlv)
-      continue;
-
-    if (deserialize_uint16(&tlv_type, cursor, len, &w))
-      continue;
-
-    set_tlv_type(tlv, tlv_type);
-
-    len -= w;
-    cursor += w;
+void otrv4_tlv_iter_init(tlv_iter_t *it, const uint8_t *src, size_t len) {
+  it->cursor = src;
+  it->len = len;
+}
 
-    if (deserialize_uint16(&tlv->len, cursor, len, &w))
-      continue;
+bool otrv4_tlv_iter_next(tlv_view_t *view, tlv_iter_t *it) {
+  uint16_t tlv_type = 0;
+  size_t read = 0;
 
-    len -= w;
-    cursor += w;
+  if (deserialize_uint16(&tlv_type, it->cursor, it->len, &read))
+    return false;
 
-    if (len < tlv->len)
-      continue;
-
-    tlv->data = malloc(tlv->len);
-    if (!tlv->data)
-      continue;
+  if (deserialize_uint16(&view->len, it->cursor + read, it->len - read,
+                         &read))
+    return false;
 
-    memcpy(tlv->data, cursor, tlv->len);
-    len -= tlv->len;
-    cursor += tlv->len;
+  if (it->len - 4 < view->len)
+    return false;
 
-    *written += cursor - start;
+  view->type = get_tlv_type(tlv_type);
+  view->data = it->cursor + 4;
 
-    tlv->next = NULL;
+  it->cursor += 4 + view->len;
+  it->len -= 4 + view->len;
 
-    return tlv;
-  } while (0);
+  return true;
+}
 
-  free(tlv);
-  return NULL;
+void otrv4_tlv_view(tlv_view_t *view, const tlv_t *tlv) {
+  view->type = tlv->type;
+  view->len = tlv->len;
+  view->data = tlv->data;
 }
 
 tlv_t *create_tlv_chain(tlv_t *head, tlv_t *tlv) {
@@ -84,26 +66,35 @@ tlv_t *create_tlv_chain(tlv_t *head, tlv_t *tlv) {
   return head;
 }
 
-tlv_t *otrv4_parse_tlvs(const uint8_t *src, size_t len) {
-  size_t written = 0;
-  tlv_t *tlv = NULL, *ret = NULL;
-
-  int data_to_parse = len;
+static tlv_t *parse_tlvs(const uint8_t *src, size_t len, bool with_padding) {
+  tlv_t *ret = NULL, **last = &ret;
+  tlv_view_t view[1];
+  tlv_iter_t it[1];
 
-  while (data_to_parse > 0) {
+  otrv4_tlv_iter_init(it, src, len);
+  while (otrv4_tlv_iter_next(view, it)) {
+    if (!with_padding && view->type == OTRV4_TLV_PADDING)
+      continue;
 
-    tlv = extract_tlv(src, data_to_parse, &written);
+    tlv_t *tlv = otrv4_tlv_new(view->type, view->len, (uint8_t *)view->data);
     if (!tlv)
       break;
 
-    ret = create_tlv_chain(ret, tlv);
-
-    data_to_parse = len - written;
+    *last = tlv;
+    last = &tlv->next;
   }
 
   return ret;
 }
 
+tlv_t *otrv4_parse_tlvs(const uint8_t *src, size_t len) {
+  return parse_tlvs(src, len, true);
+}
+
+tlv_t *otrv4_parse_tlvs_unpadded(const uint8_t *src, size_t len) {
+  return parse_tlvs(src, len, false);
+}
+
 void tlv_foreach(tlv_t *head) {
   tlv_t *current = head;
   while (current) {
@@ -119,7 +110,7 @@ void tlv_foreach(tlv_t *head) {
 
 void otrv4_tlv_free(tlv_t *tlv) { tlv_foreach(tlv); }
 
-tlv_t *otrv4_tlv_new(uint16_t type, uint16_t len, uint8_t *data) {
+tlv_t *otrv4_tlv_new(tlv_type_t type, uint16_t len, uint8_t *data) {
   tlv_t *tlv = malloc(sizeof(tlv_t));
   if (!tlv)
     return NULL;
@@ -157,11 +148,59 @@ tlv_t *otrv4_disconnected_tlv_new(void) {
   return otrv4_tlv_new(OTRV4_TLV_DISCONNECTED, 0, NULL);
 }
 
+bool otrv4_padding_policy_valid(const otrv4_padding_policy_t *policy) {
+  switch (policy->mode) {
+  case OTRV4_PADDING_NONE:
+    return true;
+  case OTRV4_PADDING_BLOCK:
+    return policy->block > 0;
+  case OTRV4_PADDING_BUCKETS:
+    /* Beyond this the buckets no longer fit in a TLV */
+    return policy->block > 0 && policy->block <= 0x8000;
+  }
+
+  return false;
+}
+
+size_t otrv4_padding_len(const otrv4_padding_policy_t *policy,
+                         size_t message_len) {
+  size_t padded_len = message_len + 4, padding_len = 0;
+
+  switch (policy->mode) {
+  case OTRV4_PADDING_NONE:
+    return 0;
+  case OTRV4_PADDING_BLOCK:
+    padding_len = policy->block - (padded_len % policy->block);
+    break;
+  case OTRV4_PADDING_BUCKETS:
+    /* Past the largest bucket, pad like a block of that size */
+    if (padded_len > 0x8000) {
+      padding_len = 0x8000 - (padded_len % 0x8000);
+      break;
+    }
+
+    size_t bucket = policy->block;
+    while (bucket < padded_len)
+      bucket <<= 1;
+
+    padding_len = bucket - padded_len;
+    break;
+  }
+
+  if (policy->max_overhead && padding_len > policy->max_overhead)
+    padding_len = policy->max_overhead;
+
+  return padding_len;
+}
+
 void append_padding_tlv(tlv_t *tlvs, int message_len) {
-  int padding_factor = 256;
-  int padding_len = padding_factor - ((message_len + 4) % padding_factor);
+  /* There is no chain to append it to */
+  if (!tlvs || message_len < 0)
+    return;
 
-  tlv_t *padding = otrv4_padding_tlv_new(padding_len);
+  otrv4_padding_policy_t policy = OTRV4_PADDING_POLICY_DEFAULT;
+  tlv_t *padding =
+      otrv4_padding_tlv_new(otrv4_padding_len(&policy, message_len));
 
-  tlvs = create_tlv_chain(tlvs, padding);
+  create_tlv_chain(tlvs, padding);
 }
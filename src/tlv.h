@@ -1,6 +1,7 @@
 #ifndef TLV_H
 #define TLV_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -22,15 +23,65 @@ typedef struct tlv_s {
   struct tlv_s *next;
 } tlv_t;
 
+/* A TLV inside a buffer it does not own */
+typedef struct {
+  tlv_type_t type;
+  uint16_t len;
+  const uint8_t *data;
+} tlv_view_t;
+
+typedef struct {
+  const uint8_t *cursor;
+  size_t len;
+} tlv_iter_t;
+
 void otrv4_tlv_free(tlv_t *tlv);
-tlv_t *otrv4_tlv_new(uint16_t type, uint16_t len, uint8_t *data);
+tlv_t *otrv4_tlv_new(tlv_type_t type, uint16_t len, uint8_t *data);
 
 tlv_t *otrv4_padding_tlv_new(size_t len);
 tlv_t *otrv4_disconnected_tlv_new(void);
 
 tlv_t *otrv4_parse_tlvs(const uint8_t *src, size_t len);
 
+/* Same, leaving out the padding TLVs */
+tlv_t *otrv4_parse_tlvs_unpadded(const uint8_t *src, size_t len);
+
+void otrv4_tlv_iter_init(tlv_iter_t *it, const uint8_t *src, size_t len);
+
+/* Points view at the next TLV, which stays valid as long as the buffer given
+ * to otrv4_tlv_iter_init. Returns false once there are no more, or the next
+ * one is truncated. */
+bool otrv4_tlv_iter_next(tlv_view_t *view, tlv_iter_t *it);
+
+void otrv4_tlv_view(tlv_view_t *view, const tlv_t *tlv);
+
 tlv_t *create_tlv_chain(tlv_t *tlvs, tlv_t *new_tlv);
+
+typedef enum {
+  OTRV4_PADDING_NONE,    /* No padding TLV at all */
+  OTRV4_PADDING_BLOCK,   /* Up to the next multiple of block */
+  OTRV4_PADDING_BUCKETS, /* Up to the next power of two, at least block */
+} otrv4_padding_mode_t;
+
+/* How much messages are padded to hide their length. Padding is measured
+ * over the message and the padding TLV's header. */
+typedef struct {
+  otrv4_padding_mode_t mode;
+  uint16_t block;
+  uint16_t max_overhead; /* Most bytes of padding added, or 0 for no cap */
+} otrv4_padding_policy_t;
+
+#define OTRV4_PADDING_POLICY_DEFAULT                                           \
+  { OTRV4_PADDING_BLOCK, 256, 0 }
+
+bool otrv4_padding_policy_valid(const otrv4_padding_policy_t *policy);
+
+/* Length of the padding TLV's data for a message of message_len bytes */
+size_t otrv4_padding_len(const otrv4_padding_policy_t *policy,
+                         size_t message_len);
+
+/* Pads as OTRV4_PADDING_POLICY_DEFAULT does, after the last of tlvs. Does
+ * nothing if tlvs is NULL. */
 void append_padding_tlv(tlv_t *tlvs, int message_len);
 
 #endif
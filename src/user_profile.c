@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <sodium.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,12 +6,48 @@
 #include <time.h>
 
 #include "deserialize.h"
+#include "hashmap.h"
 #include "mpi.h"
 #include "random.h"
 #include "serialize.h"
+#include "shake.h"
 #include "str.h"
 #include "user_profile.h"
 
+/* Profiles whose signature verified, identified by a digest of the signed
+ * body and the signature. Remembered until they expire, and the least
+ * recently used is forgotten when the cache is full. */
+#define VERIFIED_DIGEST_BYTES 64
+
+typedef struct verified_profile_t {
+  uint8_t digest[VERIFIED_DIGEST_BYTES];
+  uint64_t expires;
+  struct verified_profile_t *newer;
+  struct verified_profile_t *older;
+} verified_profile_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  hashmap_t *index;
+  verified_profile_t *newest;
+  verified_profile_t *oldest;
+} verified_cache_t;
+
+static verified_cache_t verified[1] = {{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+}};
+
+static void init_serialized(user_profile_t *profile) {
+  profile->serialized = NULL;
+  profile->serialized_len = 0;
+  profile->hashed = false;
+}
+
+static void forget_serialized(user_profile_t *profile) {
+  free(profile->serialized);
+  init_serialized(profile);
+}
+
 user_profile_t *user_profile_new(const string_t versions) {
   if (!versions)
     return NULL;
@@ -25,6 +62,7 @@ user_profile_t *user_profile_new(const string_t versions) {
   profile->versions = otrv4_strdup(versions);
   memset(profile->signature, 0, sizeof(eddsa_signature_t));
   otr_mpi_init(profile->transitional_signature);
+  init_serialized(profile);
 
   return profile;
 }
@@ -40,6 +78,22 @@ void user_profile_copy(user_profile_t *dst, const user_profile_t *src) {
 
   memcpy(dst->signature, src->signature, sizeof(eddsa_signature_t));
   otr_mpi_copy(dst->transitional_signature, src->transitional_signature);
+
+  /* Copies of our profile are sent in every DAKE, so they share the cache */
+  init_serialized(dst);
+  size_t len = 0;
+  const uint8_t *serialized = user_profile_serialized(src, &len);
+  if (!serialized)
+    return;
+
+  dst->serialized = malloc(len);
+  if (!dst->serialized)
+    return;
+
+  memcpy(dst->serialized, serialized, len);
+  dst->serialized_len = len;
+  memcpy(dst->hash, src->hash, HASH_BYTES);
+  dst->hashed = src->hashed;
 }
 
 void user_profile_destroy(user_profile_t *profile) {
@@ -52,6 +106,7 @@ void user_profile_destroy(user_profile_t *profile) {
   sodium_memzero(profile->signature, ED448_SIGNATURE_BYTES);
 
   otr_mpi_free(profile->transitional_signature);
+  forget_serialized(profile);
 }
 
 void user_profile_free(user_profile_t *profile) {
@@ -119,6 +174,42 @@ otr4_err_t user_profile_asprintf(uint8_t **dst, size_t *nbytes,
   return OTR4_SUCCESS;
 }
 
+const uint8_t *user_profile_serialized(const user_profile_t *profile,
+                                       size_t *nbytes) {
+  /* Only the cache changes */
+  user_profile_t *cached = (user_profile_t *)profile;
+  if (!cached->serialized && user_profile_asprintf(&cached->serialized,
+                                                   &cached->serialized_len,
+                                                   profile))
+    return NULL;
+
+  if (nbytes)
+    *nbytes = cached->serialized_len;
+
+  return cached->serialized;
+}
+
+otr4_err_t user_profile_hash(uint8_t dst[HASH_BYTES],
+                             const user_profile_t *profile) {
+  user_profile_t *cached = (user_profile_t *)profile;
+  if (!cached->hashed) {
+    size_t len = 0;
+    const uint8_t *serialized = user_profile_serialized(profile, &len);
+    if (!serialized)
+      return OTR4_ERROR;
+
+    decaf_shake256_ctx_t hd;
+    hash_init_with_dom(hd);
+    hash_update(hd, serialized, len);
+    hash_final(hd, cached->hash, HASH_BYTES);
+    hash_destroy(hd);
+    cached->hashed = true;
+  }
+
+  memcpy(dst, cached->hash, HASH_BYTES);
+  return OTR4_SUCCESS;
+}
+
 otr4_err_t user_profile_deserialize(user_profile_t *target,
                                     const uint8_t *buffer, size_t buflen,
                                     size_t *nread) {
@@ -128,6 +219,8 @@ otr4_err_t user_profile_deserialize(user_profile_t *target,
   if (!target)
     return OTR4_ERROR;
 
+  init_serialized(target);
+
   otr4_err_t ok = OTR4_ERROR;
   do {
     if (deserialize_otrv4_public_key(target->pub_key, buffer, buflen, &read))
@@ -175,6 +268,8 @@ otr4_err_t user_profile_sign(user_profile_t *profile,
   uint8_t *body = NULL;
   size_t bodylen = 0;
 
+  forget_serialized(profile);
+
   ec_point_copy(profile->pub_key, keypair->pub);
   if (user_profile_body_asprintf(&body, &bodylen, profile))
     return OTR4_ERROR;
@@ -192,6 +287,140 @@ otr4_err_t user_profile_sign(user_profile_t *profile,
   return OTR4_SUCCESS;
 }
 
+static size_t verified_hash(const void *key) {
+  const verified_profile_t *entry = key;
+  size_t hash = 0;
+  memcpy(&hash, entry->digest, sizeof(hash));
+  return hash;
+}
+
+static int verified_eq(const void *a, const void *b) {
+  const verified_profile_t *entry_a = a, *entry_b = b;
+  return !memcmp(entry_a->digest, entry_b->digest, VERIFIED_DIGEST_BYTES);
+}
+
+static void digest_signed_profile(uint8_t digest[VERIFIED_DIGEST_BYTES],
+                                  const uint8_t *body, size_t bodylen,
+                                  const eddsa_signature_t signature) {
+  decaf_shake256_ctx_t hd;
+  hash_init(hd);
+  hash_update(hd, body, bodylen);
+  hash_update(hd, signature, sizeof(eddsa_signature_t));
+  hash_final(hd, digest, VERIFIED_DIGEST_BYTES);
+  hash_destroy(hd);
+}
+
+/* Must be called with the cache locked */
+static void unlink_verified(verified_profile_t *entry) {
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    verified->newest = entry->older;
+
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    verified->oldest = entry->newer;
+
+  entry->newer = NULL;
+  entry->older = NULL;
+}
+
+/* Must be called with the cache locked */
+static void link_newest(verified_profile_t *entry) {
+  entry->older = verified->newest;
+  entry->newer = NULL;
+
+  if (verified->newest)
+    verified->newest->newer = entry;
+  else
+    verified->oldest = entry;
+
+  verified->newest = entry;
+}
+
+/* Must be called with the cache locked */
+static void forget_verified(verified_profile_t *entry) {
+  hashmap_remove(verified->index, entry);
+  unlink_verified(entry);
+  free(entry);
+}
+
+static bool verified_before(const uint8_t digest[VERIFIED_DIGEST_BYTES]) {
+  verified_profile_t wanted;
+  memcpy(wanted.digest, digest, VERIFIED_DIGEST_BYTES);
+
+  bool found = false;
+  pthread_mutex_lock(&verified->lock);
+  verified_profile_t *entry =
+      verified->index ? hashmap_get(verified->index, &wanted) : NULL;
+
+  if (entry && entry->expires <= (uint64_t)time(NULL)) {
+    forget_verified(entry);
+  } else if (entry) {
+    unlink_verified(entry);
+    link_newest(entry);
+    found = true;
+  }
+  pthread_mutex_unlock(&verified->lock);
+
+  return found;
+}
+
+static void remember_verified(const uint8_t digest[VERIFIED_DIGEST_BYTES],
+                              uint64_t expires) {
+  if (expires <= (uint64_t)time(NULL))
+    return;
+
+  verified_profile_t *entry = malloc(sizeof(verified_profile_t));
+  if (!entry)
+    return;
+
+  memcpy(entry->digest, digest, VERIFIED_DIGEST_BYTES);
+  entry->expires = expires;
+
+  pthread_mutex_lock(&verified->lock);
+  do {
+    if (!verified->index)
+      verified->index = hashmap_new(verified_hash, verified_eq);
+
+    /* Another thread may have verified it meanwhile */
+    if (!verified->index || hashmap_get(verified->index, entry)) {
+      free(entry);
+      continue;
+    }
+
+    if (verified->index->count == USER_PROFILE_CACHE_SIZE)
+      forget_verified(verified->oldest);
+
+    if (hashmap_put(verified->index, entry, entry)) {
+      free(entry);
+      continue;
+    }
+
+    link_newest(entry);
+  } while (0);
+  pthread_mutex_unlock(&verified->lock);
+}
+
+void user_profile_cache_clear(void) {
+  pthread_mutex_lock(&verified->lock);
+  while (verified->oldest)
+    forget_verified(verified->oldest);
+
+  hashmap_free(verified->index);
+  verified->index = NULL;
+  pthread_mutex_unlock(&verified->lock);
+}
+
+size_t user_profile_cache_count(void) {
+  pthread_mutex_lock(&verified->lock);
+  size_t count = verified->index ? verified->index->count : 0;
+  pthread_mutex_unlock(&verified->lock);
+
+  return count;
+}
+
 // TODO: I dont think this needs the data structure. Could verify from the
 // deserialized bytes.
 bool user_profile_valid_signature(const user_profile_t *profile) {
@@ -207,6 +436,15 @@ bool user_profile_valid_signature(const user_profile_t *profile) {
   if (user_profile_body_asprintf(&body, &bodylen, profile))
     return false;
 
+  /* The body includes the public key, so the digest covers everything the
+   * signature is checked against */
+  uint8_t digest[VERIFIED_DIGEST_BYTES];
+  digest_signed_profile(digest, body, bodylen, profile->signature);
+  if (verified_before(digest)) {
+    free(body);
+    return true;
+  }
+
   uint8_t pubkey[ED448_POINT_BYTES];
   if (ec_point_serialize(pubkey, ED448_POINT_BYTES, profile->pub_key)) {
     free(body);
@@ -215,6 +453,8 @@ bool user_profile_valid_signature(const user_profile_t *profile) {
   }
 
   bool valid = ec_verify(profile->signature, pubkey, body, bodylen);
+  if (valid)
+    remember_verified(digest, profile->expires);
 
   free(body);
   body = NULL;
@@ -224,13 +464,18 @@ bool user_profile_valid_signature(const user_profile_t *profile) {
 
 user_profile_t *user_profile_build(const string_t versions,
                                    otrv4_keypair_t *keypair) {
+  return user_profile_build_expiring(
+      versions, keypair, time(NULL) + USER_PROFILE_EXPIRATION_SECONDS);
+}
+
+user_profile_t *user_profile_build_expiring(const string_t versions,
+                                            otrv4_keypair_t *keypair,
+                                            uint64_t expires) {
   user_profile_t *profile = user_profile_new(versions);
   if (!profile)
     return NULL;
 
-#define PROFILE_EXPIRATION_SECONDS 2 * 7 * 24 * 60 * 60; /* 2 weeks */
-  time_t expires = time(NULL);
-  profile->expires = expires + PROFILE_EXPIRATION_SECONDS;
+  profile->expires = expires;
 
   if (user_profile_sign(profile, keypair)) {
     user_profile_free(profile);
@@ -1,18 +1,29 @@
 #ifndef USER_PROFILE_H
 #define USER_PROFILE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "constants.h"
 #include "keys.h"
 #include "mpi.h"
 #include "str.h"
 
+#define USER_PROFILE_EXPIRATION_SECONDS (2 * 7 * 24 * 60 * 60) /* 2 weeks */
+#define USER_PROFILE_RENEWAL_SECONDS (24 * 60 * 60)            /* 1 day */
+
 typedef struct {
   otrv4_public_key_t pub_key;
   string_t versions;
   uint64_t expires;
   eddsa_signature_t signature;
   otr_mpi_t transitional_signature; // TODO: this should be a signature type
+
+  /* Filled in when first needed, and forgotten when the profile is signed */
+  uint8_t *serialized;
+  size_t serialized_len;
+  uint8_t hash[HASH_BYTES];
+  bool hashed;
 } user_profile_t;
 
 user_profile_t *user_profile_new(const string_t versions);
@@ -20,8 +31,16 @@ user_profile_t *user_profile_new(const string_t versions);
 otr4_err_t user_profile_sign(user_profile_t *profile,
                              const otrv4_keypair_t *keypair);
 
+/* Remembers valid signatures until the profile expires, so verifying a
+ * profile seen before is cheap. */
+#define USER_PROFILE_CACHE_SIZE 256
+
 bool user_profile_valid_signature(const user_profile_t *profile);
 
+void user_profile_cache_clear(void);
+
+size_t user_profile_cache_count(void);
+
 void user_profile_copy(user_profile_t *dst, const user_profile_t *src);
 
 void user_profile_destroy(user_profile_t *profile);
@@ -38,7 +57,21 @@ otr4_err_t user_profile_body_asprintf(uint8_t **dst, size_t *nbytes,
 otr4_err_t user_profile_asprintf(uint8_t **dst, size_t *nbytes,
                                  const user_profile_t *profile);
 
+/* The cached serialized profile, owned by it, or NULL on error. A profile
+ * must be signed again after changing it, for this to see the change. */
+const uint8_t *user_profile_serialized(const user_profile_t *profile,
+                                       size_t *nbytes);
+
+/* The cached hash of the serialized profile, as used by the DAKE */
+otr4_err_t user_profile_hash(uint8_t dst[HASH_BYTES],
+                             const user_profile_t *profile);
+
+/* Signed, and expiring USER_PROFILE_EXPIRATION_SECONDS from now */
 user_profile_t *user_profile_build(const string_t versions,
                                    otrv4_keypair_t *keypair);
 
+user_profile_t *user_profile_build_expiring(const string_t versions,
+                                            otrv4_keypair_t *keypair,
+                                            uint64_t expires);
+
 #endif